@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - blocked Bloom filter
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtBloom.h"
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+	const uint64_t kStep = 0x9E3779B97F4A7C15ULL; // odd, 2^64 / golden ratio
+
+	// Block of the key, and the seed of its bit positions
+	uint64_t locate(uint64_t key, uint64_t blockCount, uint64_t& block)
+	{
+		// splitmix64 finalizer, the bucket bits of the index are the top bits of the key
+		uint64_t h = key;
+		h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+		h ^= h >> 31;
+
+		// multiply-shift instead of a modulo
+		block = ((h >> 32) * blockCount) >> 32;
+		return h | 1;
+	}
+
+	// Next bit of the block : top 9 bits of the seed, multiplied each time
+	uint32_t nextBit(uint64_t& seed)
+	{
+		seed *= kStep;
+		return (uint32_t)(seed >> (64 - 9));
+	}
+}
+
+VtBloom::VtBloom()
+	: blocks(nullptr), count(0), hashes(VT_BLOOM_HASHES)
+{
+}
+
+void VtBloom::attach(const uint64_t* filterBlocks, uint64_t blockCount, uint32_t hashCount)
+{
+	blocks = blockCount > 0 ? filterBlocks : nullptr;
+	count = blockCount;
+	hashes = hashCount;
+}
+
+bool VtBloom::mayContain(uint64_t key) const
+{
+	if (blocks == nullptr) {
+		return true;
+	}
+
+	uint64_t block;
+	uint64_t seed = locate(key, count, block);
+
+	const uint64_t* words = blocks + block * (VT_BLOOM_BLOCK_BITS / 64);
+	for (uint32_t i = 0; i < hashes; i++) {
+		uint32_t bit = nextBit(seed);
+		if ((words[bit >> 6] & (1ULL << (bit & 63))) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void VtBloom::add(uint64_t* filterBlocks, uint64_t blockCount, uint32_t hashCount, uint64_t key)
+{
+	uint64_t block;
+	uint64_t seed = locate(key, blockCount, block);
+
+	uint64_t* words = filterBlocks + block * (VT_BLOOM_BLOCK_BITS / 64);
+	for (uint32_t i = 0; i < hashCount; i++) {
+		uint32_t bit = nextBit(seed);
+		words[bit >> 6] |= 1ULL << (bit & 63);
+	}
+}
+
+uint64_t VtBloom::blocksFor(uint64_t keys, double bitsPerKey)
+{
+	if (keys == 0 || bitsPerKey <= 0) {
+		return 0;
+	}
+	return (uint64_t)ceil(keys * bitsPerKey / VT_BLOOM_BLOCK_BITS);
+}
+
+// The keys of a block follow a Poisson law, each block is a small classic
+// Bloom filter : FPR = sum over n of P(n keys in the block) * (1 - (1 - 1/B)^(k n))^k
+double VtBloom::falsePositiveRate(uint64_t keys, uint64_t blockCount, uint32_t hashCount)
+{
+	if (blockCount == 0) {
+		return 1.0;
+	}
+
+	double lambda = (double)keys / blockCount;
+	double rate = 0;
+	double poisson = exp(-lambda); // P(0)
+	int last = (int)(lambda * 4) + 64;
+	for (int n = 0; n <= last; n++) {
+		if (n > 0) {
+			poisson *= lambda / n;
+		}
+		double unset = pow(1.0 - 1.0 / VT_BLOOM_BLOCK_BITS, (double)hashCount * n);
+		rate += poisson * pow(1.0 - unset, (double)hashCount);
+	}
+	return rate;
+}
@@ -0,0 +1,44 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - blocked Bloom filter
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Probabilistic prefilter of the known-hash index : "no" is certain and
+// costs a single 64-byte block, "maybe" falls through to the exact lookup.
+// The keys are the 64-bit fingerprints of the index, mixed once : the high
+// half picks the block, the low half the bits, all set in the same cache line.
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#define VT_BLOOM_BLOCK_BITS	512 // one cache line
+#define VT_BLOOM_HASHES		8	// bits set per key
+
+class VtBloom {
+public:
+	VtBloom();
+
+	// Filter stored elsewhere (mapped file), blocks of 8 64-bit words
+	void attach(const uint64_t* blocks, uint64_t blockCount, uint32_t hashes);
+	bool isAttached() const { return blocks != nullptr; }
+
+	bool mayContain(uint64_t key) const;
+
+	uint64_t blockCount() const { return count; }
+	uint64_t sizeBytes() const { return count * VT_BLOOM_BLOCK_BITS / 8; }
+	uint32_t hashCount() const { return hashes; }
+
+	// Building : blocks must hold blockCount * 8 zeroed words
+	static void add(uint64_t* blocks, uint64_t blockCount, uint32_t hashes, uint64_t key);
+
+	// Blocks needed for about bitsPerKey bits per key
+	static uint64_t blocksFor(uint64_t keys, double bitsPerKey);
+
+	// Expected false positive rate with keys entries
+	static double falsePositiveRate(uint64_t keys, uint64_t blockCount, uint32_t hashes);
+
+private:
+	const uint64_t* blocks;
+	uint64_t count;
+	uint32_t hashes;
+};
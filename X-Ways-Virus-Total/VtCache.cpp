@@ -0,0 +1,587 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - persistent verdict cache
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtCache.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+VtCache::VtCache()
+	:
+#ifdef _WIN32
+	hIndex(INVALID_HANDLE_VALUE), hMapping(NULL), hReports(INVALID_HANDLE_VALUE),
+#else
+	indexFd(-1), reportsFd(-1), mappedSize(0),
+#endif
+	header(nullptr), records(nullptr), ttl(0), unknownTtl(0), foreign(false), reclaimedBytes(0)
+{
+}
+
+VtCache::~VtCache()
+{
+	close();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// open / close
+
+bool VtCache::open(const string& path, unsigned ttlDays, unsigned unknownTtlDays)
+{
+	close();
+	ttl = (int64_t)ttlDays * 86400;
+	unknownTtl = (int64_t)unknownTtlDays * 86400;
+	foreign = false;
+	reclaimedBytes = 0;
+
+	// Read the header of an existing index to know how much to map
+	VtCacheHeader existing = {};
+	size_t read = 0;
+	int64_t size = 0;
+
+#ifdef _WIN32
+	// ANSI path as read from config.ini, like the journal and the known-hash index
+	hIndex = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hIndex == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize = {};
+	GetFileSizeEx(hIndex, &fileSize);
+	size = fileSize.QuadPart;
+	if (size >= (int64_t)sizeof(VtCacheHeader)) {
+		DWORD got = 0;
+		ReadFile(hIndex, &existing, sizeof(existing), &got, NULL);
+		read = got;
+	}
+#else
+	indexFd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (indexFd < 0) {
+		return false;
+	}
+
+	struct stat info = {};
+	fstat(indexFd, &info);
+	size = (int64_t)info.st_size;
+	if (size >= (int64_t)sizeof(VtCacheHeader)) {
+		ssize_t got = pread(indexFd, &existing, sizeof(existing), 0);
+		read = got > 0 ? (size_t)got : 0;
+	}
+#endif
+
+	bool valid = read == sizeof(existing)
+		&& existing.magic == VT_CACHE_MAGIC
+		&& existing.version == VT_CACHE_VERSION
+		&& existing.capacity >= VT_CACHE_MIN_SLOTS
+		&& (existing.capacity & (existing.capacity - 1)) == 0
+		&& size == (int64_t)(sizeof(VtCacheHeader) + (int64_t)existing.capacity * sizeof(VtCacheRecord));
+
+	// Anything else than a new index is kept as it is : a damaged cache, an
+	// older version or another file named by mistake is for the user to delete
+	if (!valid && size != 0) {
+		foreign = true;
+		close();
+		return false;
+	}
+
+	reportPath = path + ".dat";
+	if (!openReports()) {
+		close();
+		return false;
+	}
+
+	if (!map(valid ? existing.capacity : VT_CACHE_MIN_SLOTS)) {
+		close();
+		return false;
+	}
+
+	// New index : start from an empty table
+	if (!valid) {
+		memset(header, 0, sizeof(VtCacheHeader) + (size_t)VT_CACHE_MIN_SLOTS * sizeof(VtCacheRecord));
+		header->magic = VT_CACHE_MAGIC;
+		header->version = VT_CACHE_VERSION;
+		header->capacity = VT_CACHE_MIN_SLOTS;
+		header->count = 0;
+	}
+
+	// Interrupted while the .dat file was replaced : the verdicts are kept,
+	// their reports are given up and the whole file is reclaimed
+	if (header->flags & VT_CACHE_COMPACTING) {
+		for (uint32_t i = 0; i < header->capacity; i++) {
+			records[i].reportOfs = 0;
+			records[i].reportLen = 0;
+		}
+		header->deadBytes = (uint64_t)reportsSize();
+		header->flags &= ~VT_CACHE_COMPACTING;
+	}
+
+	// reports replaced run after run : compacted once half of the file is dead
+	uint64_t dead = header->deadBytes;
+	if (dead >= VT_CACHE_COMPACT_MIN && dead * 2 >= (uint64_t)reportsSize() && compact()) {
+		reclaimedBytes = dead;
+	}
+	return true;
+}
+
+void VtCache::close()
+{
+	unmap();
+	closeReports();
+
+#ifdef _WIN32
+	if (hIndex != INVALID_HANDLE_VALUE) {
+		CloseHandle(hIndex);
+		hIndex = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (indexFd >= 0) {
+		::close(indexFd);
+		indexFd = -1;
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Mapping of the index file
+
+bool VtCache::map(uint32_t capacity)
+{
+	uint64_t bytes = sizeof(VtCacheHeader) + (uint64_t)capacity * sizeof(VtCacheRecord);
+	uint8_t* view = nullptr;
+
+#ifdef _WIN32
+	// CreateFileMapping extends the file when it is smaller than the mapping
+	hMapping = CreateFileMappingW(hIndex, NULL, PAGE_READWRITE,
+		(DWORD)(bytes >> 32), (DWORD)(bytes & 0xFFFFFFFF), NULL);
+	if (hMapping == NULL) {
+		return false;
+	}
+
+	view = (uint8_t*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (size_t)bytes);
+	if (view == nullptr) {
+		CloseHandle(hMapping);
+		hMapping = NULL;
+		return false;
+	}
+#else
+	// mmap does not extend the file, it is sized first
+	struct stat info = {};
+	if (fstat(indexFd, &info) != 0
+		|| ((uint64_t)info.st_size < bytes && ftruncate(indexFd, (off_t)bytes) != 0)) {
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, (size_t)bytes, PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+	view = (uint8_t*)mapped;
+	mappedSize = (size_t)bytes;
+#endif
+
+	header = (VtCacheHeader*)view;
+	records = (VtCacheRecord*)(view + sizeof(VtCacheHeader));
+	return true;
+}
+
+void VtCache::unmap()
+{
+#ifdef _WIN32
+	if (header != nullptr) {
+		FlushViewOfFile(header, 0);
+		UnmapViewOfFile(header);
+		header = nullptr;
+		records = nullptr;
+	}
+	if (hMapping != NULL) {
+		CloseHandle(hMapping);
+		hMapping = NULL;
+	}
+#else
+	if (header != nullptr) {
+		msync(header, mappedSize, MS_ASYNC);
+		munmap(header, mappedSize);
+		header = nullptr;
+		records = nullptr;
+		mappedSize = 0;
+	}
+#endif
+}
+
+// Doubles the number of slots and re-inserts every record
+bool VtCache::grow()
+{
+	uint32_t capacity = header->capacity;
+	vector<VtCacheRecord> used;
+	used.reserve(header->count);
+	for (uint32_t i = 0; i < capacity; i++) {
+		if (records[i].used) {
+			used.push_back(records[i]);
+		}
+	}
+
+	unmap();
+	if (!map(capacity * 2)) {
+		// keep the old table if the bigger one cannot be mapped
+		if (!map(capacity)) {
+			return false;
+		}
+		return header->count + 1 < capacity;
+	}
+
+	memset(header, 0, sizeof(VtCacheHeader) + (size_t)capacity * 2 * sizeof(VtCacheRecord));
+	header->magic = VT_CACHE_MAGIC;
+	header->version = VT_CACHE_VERSION;
+	header->capacity = capacity * 2;
+
+	for (const VtCacheRecord& rec : used) {
+		*findSlot(rec.digest) = rec;
+		header->count++;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lookup / store
+
+// Linear probing from the first 8 bytes of the digest, SHA-1 is uniform enough
+// Returns the slot holding the digest or the free slot where it belongs
+VtCacheRecord* VtCache::findSlot(const uint8_t* digest) const
+{
+	uint64_t key;
+	memcpy(&key, digest, sizeof(key));
+
+	uint32_t mask = header->capacity - 1;
+	uint32_t i = (uint32_t)(key & mask);
+	while (records[i].used && memcmp(records[i].digest, digest, VT_DIGEST_SIZE) != 0) {
+		i = (i + 1) & mask;
+	}
+	return &records[i];
+}
+
+bool VtCache::lookup(const uint8_t* digest, VtCacheRecord& rec) const
+{
+	if (!isOpen()) {
+		return false;
+	}
+
+	const VtCacheRecord* slot = findSlot(digest);
+	if (!slot->used) {
+		return false;
+	}
+
+	// an unknown file is asked again sooner, it may have been submitted since
+	if (slot->responseCode != 1) {
+		if (unknownTtl == 0 || (int64_t)time(nullptr) - slot->storedAt > unknownTtl) {
+			return false;
+		}
+	}
+	else if (ttl > 0 && (int64_t)time(nullptr) - slot->storedAt > ttl) {
+		return false;
+	}
+
+	rec = *slot;
+	return true;
+}
+
+bool VtCache::store(const uint8_t* digest, int responseCode, int positives, int total,
+	int64_t scanDate, const char* rawReport, size_t rawSize)
+{
+	if (!isOpen()) {
+		return false;
+	}
+
+	// keep the load factor under 75%
+	if ((uint64_t)(header->count + 1) * 4 > (uint64_t)header->capacity * 3 && !grow()) {
+		return false;
+	}
+
+	VtCacheRecord* slot = findSlot(digest);
+	uint32_t written = 0;
+	int64_t offset;
+
+	// looked up again : the new report takes the place of the old one when it
+	// fits, what it does not use is left for the compaction
+	if (slot->used && slot->reportLen > 0 && rawSize <= slot->reportLen) {
+		offset = slot->reportOfs;
+		written = writeReport(offset, rawReport, rawSize);
+		header->deadBytes += slot->reportLen - written;
+	}
+	else {
+		if (slot->used) {
+			header->deadBytes += slot->reportLen;
+		}
+		offset = appendReport(rawReport, rawSize, written);
+	}
+
+	if (!slot->used) {
+		header->count++;
+	}
+
+	memset(slot, 0, sizeof(VtCacheRecord));
+	memcpy(slot->digest, digest, VT_DIGEST_SIZE);
+	slot->responseCode = (uint8_t)responseCode;
+	slot->positives = (uint16_t)positives;
+	slot->total = (uint16_t)total;
+	slot->scanDate = scanDate;
+	slot->storedAt = (int64_t)time(nullptr);
+	slot->reportOfs = offset;
+	slot->reportLen = written;
+	slot->used = 1;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw report file
+
+bool VtCache::openReports()
+{
+#ifdef _WIN32
+	hReports = CreateFileA(reportPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return hReports != INVALID_HANDLE_VALUE;
+#else
+	reportsFd = ::open(reportPath.c_str(), O_RDWR | O_CREAT, 0644);
+	return reportsFd >= 0;
+#endif
+}
+
+void VtCache::closeReports()
+{
+#ifdef _WIN32
+	if (hReports != INVALID_HANDLE_VALUE) {
+		CloseHandle(hReports);
+		hReports = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (reportsFd >= 0) {
+		::close(reportsFd);
+		reportsFd = -1;
+	}
+#endif
+}
+
+// -1 if the file cannot be read
+int64_t VtCache::reportsSize() const
+{
+#ifdef _WIN32
+	LARGE_INTEGER fileSize = {};
+	if (hReports == INVALID_HANDLE_VALUE || !GetFileSizeEx(hReports, &fileSize)) {
+		return -1;
+	}
+	return fileSize.QuadPart;
+#else
+	struct stat info = {};
+	if (reportsFd < 0 || fstat(reportsFd, &info) != 0) {
+		return -1;
+	}
+	return (int64_t)info.st_size;
+#endif
+}
+
+// Bytes written at offset
+uint32_t VtCache::writeReport(int64_t offset, const char* rawReport, size_t rawSize)
+{
+	if (rawSize == 0) {
+		return 0;
+	}
+#ifdef _WIN32
+	OVERLAPPED ovl = {};
+	ovl.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	ovl.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD count = 0;
+	if (!WriteFile(hReports, rawReport, (DWORD)rawSize, &count, &ovl)) {
+		return 0;
+	}
+	return count;
+#else
+	ssize_t count = pwrite(reportsFd, rawReport, rawSize, (off_t)offset);
+	return count > 0 ? (uint32_t)count : 0;
+#endif
+}
+
+int64_t VtCache::appendReport(const char* rawReport, size_t rawSize, uint32_t& written)
+{
+	written = 0;
+	int64_t end = reportsSize();
+	if (end < 0) {
+		return 0;
+	}
+	written = writeReport(end, rawReport, rawSize);
+	return end;
+}
+
+// Flushes the index to disk before returning
+void VtCache::syncIndex()
+{
+#ifdef _WIN32
+	FlushViewOfFile(header, 0);
+	FlushFileBuffers(hIndex);
+#else
+	msync(header, mappedSize, MS_SYNC);
+#endif
+}
+
+// The reports still used are copied in file order to <cachefile>.dat.tmp,
+// which then replaces the .dat file. VT_CACHE_COMPACTING is kept in the
+// index from the replacement until the offsets are updated : if the run is
+// interrupted in between, the next open gives up the reports, not the
+// verdicts
+bool VtCache::compact()
+{
+	vector<uint32_t> live;
+	for (uint32_t i = 0; i < header->capacity; i++) {
+		if (records[i].used && records[i].reportLen > 0) {
+			live.push_back(i);
+		}
+	}
+	sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b) { return records[a].reportOfs < records[b].reportOfs; });
+
+	string tmpPath = reportPath + ".tmp";
+#ifdef _WIN32
+	HANDLE tmp = CreateFileA(tmpPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (tmp == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+#else
+	int tmp = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (tmp < 0) {
+		return false;
+	}
+#endif
+
+	vector<int64_t> offsets(live.size());
+	vector<uint32_t> lengths(live.size());
+	int64_t end = 0;
+	bool ok = true;
+	for (size_t n = 0; n < live.size() && ok; n++) {
+		string report = readReport(records[live[n]]);
+#ifdef _WIN32
+		DWORD count = 0;
+		ok = report.empty() || (WriteFile(tmp, report.data(), (DWORD)report.size(), &count, NULL) && count == report.size());
+#else
+		ok = report.empty() || write(tmp, report.data(), report.size()) == (ssize_t)report.size();
+#endif
+		offsets[n] = end;
+		lengths[n] = (uint32_t)report.size();
+		end += (int64_t)report.size();
+	}
+#ifdef _WIN32
+	ok = ok && FlushFileBuffers(tmp);
+	CloseHandle(tmp);
+#else
+	ok = ok && fsync(tmp) == 0;
+	::close(tmp);
+#endif
+	if (!ok) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	header->flags |= VT_CACHE_COMPACTING;
+	syncIndex();
+	closeReports();
+#ifdef _WIN32
+	bool replaced = MoveFileExA(tmpPath.c_str(), reportPath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool replaced = rename(tmpPath.c_str(), reportPath.c_str()) == 0;
+#endif
+	if (replaced) {
+		for (size_t n = 0; n < live.size(); n++) {
+			records[live[n]].reportOfs = offsets[n];
+			records[live[n]].reportLen = lengths[n];
+		}
+		header->deadBytes = 0;
+	}
+	else {
+		remove(tmpPath.c_str());
+	}
+	header->flags &= ~VT_CACHE_COMPACTING;
+	syncIndex();
+
+	return openReports() && replaced;
+}
+
+string VtCache::readReport(const VtCacheRecord& rec) const
+{
+	string report;
+	if (!isOpen() || rec.reportLen == 0) {
+		return report;
+	}
+
+	report.resize(rec.reportLen);
+	size_t read = 0;
+#ifdef _WIN32
+	OVERLAPPED ovl = {};
+	ovl.Offset = (DWORD)(rec.reportOfs & 0xFFFFFFFF);
+	ovl.OffsetHigh = (DWORD)(rec.reportOfs >> 32);
+
+	DWORD count = 0;
+	if (ReadFile(hReports, &report[0], rec.reportLen, &count, &ovl)) {
+		read = count;
+	}
+#else
+	ssize_t count = pread(reportsFd, &report[0], rec.reportLen, (off_t)rec.reportOfs);
+	read = count > 0 ? (size_t)count : 0;
+#endif
+	report.resize(read);
+	return report;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// scan_date conversion
+
+int64_t VtCache::parseScanDate(const string& scanDate)
+{
+	struct tm t = {};
+#ifdef _WIN32
+	if (sscanf_s(scanDate.c_str(), "%d-%d-%d %d:%d:%d",
+#else
+	if (sscanf(scanDate.c_str(), "%d-%d-%d %d:%d:%d",
+#endif
+		&t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) {
+		return 0;
+	}
+	t.tm_year -= 1900;
+	t.tm_mon -= 1;
+#ifdef _WIN32
+	return (int64_t)_mkgmtime(&t);
+#else
+	return (int64_t)timegm(&t);
+#endif
+}
+
+string VtCache::formatScanDate(int64_t scanDate)
+{
+	if (scanDate <= 0) {
+		return "";
+	}
+
+	struct tm t = {};
+	time_t tt = (time_t)scanDate;
+#ifdef _WIN32
+	gmtime_s(&t, &tt);
+#else
+	gmtime_r(&tt, &t);
+#endif
+
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+	return buf;
+}
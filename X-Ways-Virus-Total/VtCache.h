@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - persistent verdict cache
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// The cache is made of two files :
+// - <cachefile>     : memory-mapped index, a header followed by an open
+//                     addressing table of fixed-size records keyed by the
+//                     key of the digest (vtDigestKey, the SHA-1 itself)
+// - <cachefile>.dat : raw VirusTotal reports, appended one after another. A
+//                     verdict looked up again reuses the place of its old
+//                     report when the new one fits, the bytes left behind
+//                     are counted and the file is compacted by open() once
+//                     they make up half of it
+// The same files are read and written on Windows and on Linux (tools).
+
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#define VT_CACHE_MAGIC		0x48435456 // "VTCH"
+#define VT_CACHE_VERSION	1
+#define VT_CACHE_MIN_SLOTS	4096 // must be a power of 2
+#define VT_CACHE_COMPACT_MIN	(16 << 20) // dead bytes in the .dat file before it is compacted
+
+// VtCacheHeader::flags
+#define VT_CACHE_COMPACTING	0x1 // the .dat file was being replaced, its offsets cannot be trusted
+#define VT_DIGEST_SIZE		20 // VT_DIGEST_KEY_SIZE
+
+#pragma pack(push)
+#pragma pack(1)
+struct VtCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;	// number of slots, power of 2
+	uint32_t count;		// used slots
+	uint64_t deadBytes;	// bytes of the .dat file no record points to
+	uint32_t flags;		// VT_CACHE_COMPACTING
+	uint8_t reserved[36];
+};
+
+struct VtCacheRecord {
+	uint8_t digest[VT_DIGEST_SIZE];
+	uint8_t used;			// 0 = free slot
+	uint8_t responseCode;	// VirusTotal response_code (1 = known file, 0 = unknown)
+	uint16_t positives;
+	uint16_t total;
+	uint16_t reserved;
+	uint32_t reportLen;		// size of the raw report in the .dat file
+	int64_t scanDate;		// VirusTotal scan_date, seconds since 1970 (UTC)
+	int64_t storedAt;		// when the verdict was cached, seconds since 1970 (UTC)
+	int64_t reportOfs;		// offset of the raw report in the .dat file
+	int64_t reserved2;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VtCacheHeader) == 64, "VtCacheHeader must stay 64 bytes");
+static_assert(sizeof(VtCacheRecord) == 64, "VtCacheRecord must stay 64 bytes");
+
+class VtCache {
+public:
+	VtCache();
+	~VtCache();
+
+	// Opens (or creates) the cache, ttlDays = 0 means verdicts never expire.
+	// Unknown files (response_code 0) get unknownTtlDays, 0 = never served :
+	// they may be submitted to VirusTotal by someone else at any time.
+	// Only a missing or empty index is initialized : any other file that is
+	// not a verdict cache of this version is left alone and open fails
+	bool open(const std::string& path, unsigned ttlDays, unsigned unknownTtlDays);
+	void close();
+	bool isOpen() const { return header != nullptr; }
+
+	// The last open failed because the index is not a verdict cache
+	bool isForeign() const { return foreign; }
+	uint32_t count() const { return header ? header->count : 0; }
+
+	// Bytes of the .dat file freed by the compaction of the last open
+	uint64_t reclaimed() const { return reclaimedBytes; }
+
+	// Returns true if a verdict younger than its TTL exists for this digest
+	bool lookup(const uint8_t* digest, VtCacheRecord& rec) const;
+
+	// Adds or replaces the verdict of a digest
+	bool store(const uint8_t* digest, int responseCode, int positives, int total,
+		int64_t scanDate, const char* rawReport, size_t rawSize);
+
+	// Reads back the raw report of a record
+	std::string readReport(const VtCacheRecord& rec) const;
+
+	// "2023-05-01 10:11:12" <-> seconds since 1970 (UTC)
+	static int64_t parseScanDate(const std::string& scanDate);
+	static std::string formatScanDate(int64_t scanDate);
+
+private:
+	bool map(uint32_t capacity);
+	void unmap();
+	bool grow();
+	VtCacheRecord* findSlot(const uint8_t* digest) const;
+
+	// raw report file : end before appending, then read back
+	bool openReports();
+	void closeReports();
+	int64_t reportsSize() const;
+	int64_t appendReport(const char* rawReport, size_t rawSize, uint32_t& written);
+	uint32_t writeReport(int64_t offset, const char* rawReport, size_t rawSize);
+
+	// Copies the reports still used to a new .dat file, which replaces the old one
+	bool compact();
+	void syncIndex();
+
+#ifdef _WIN32
+	void* hIndex;
+	void* hMapping;
+	void* hReports;
+#else
+	int indexFd;
+	int reportsFd;
+	size_t mappedSize;
+#endif
+	VtCacheHeader* header;
+	VtCacheRecord* records;
+	int64_t ttl; // seconds
+	int64_t unknownTtl; // seconds, response_code != 1
+	bool foreign;
+	std::string reportPath;
+	uint64_t reclaimedBytes;
+};
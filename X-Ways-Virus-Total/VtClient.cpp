@@ -0,0 +1,178 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - persistent HTTP client
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtClient.h"
+
+using namespace std;
+
+namespace
+{
+	// The warm-up response is not needed
+	std::size_t discard(const char* in, std::size_t size, std::size_t num, void* out)
+	{
+		return size * num;
+	}
+}
+
+VtClient::VtClient()
+	: share(nullptr)
+{
+}
+
+VtClient::~VtClient()
+{
+	cleanup();
+}
+
+bool VtClient::init()
+{
+	if (share != nullptr) {
+		return true;
+	}
+
+	// init the curl winsock stuff
+	if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+		return false;
+	}
+
+	share = curl_share_init();
+	if (share == nullptr) {
+		curl_global_cleanup();
+		return false;
+	}
+
+	// The share is used by the engine thread and the warm-up thread
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	return true;
+}
+
+void VtClient::cleanup()
+{
+	if (warmer.joinable()) {
+		warmer.join();
+	}
+
+	if (share == nullptr) {
+		return;
+	}
+
+	// the handles must leave the share before it is destroyed
+	{
+		lock_guard<mutex> guard(poolLock);
+		for (CURL* curl : pool) {
+			curl_easy_cleanup(curl);
+		}
+		pool.clear();
+	}
+
+	curl_share_cleanup(share);
+	share = nullptr;
+
+	// global cleanup
+	curl_global_cleanup();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Share locking, one mutex per kind of shared data
+
+void VtClient::lockShare(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+	static_cast<VtClient*>(userptr)->shareLocks[data].lock();
+}
+
+void VtClient::unlockShare(CURL* curl, curl_lock_data data, void* userptr)
+{
+	static_cast<VtClient*>(userptr)->shareLocks[data].unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Handle pool
+
+// Options that survive between requests, curl_easy_reset clears them
+void VtClient::setDefaults(CURL* curl)
+{
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+	// keep idle connections alive between items
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 30L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 15L);
+	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+
+	// the address of the API does not change during a run
+	curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 3600L);
+
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+}
+
+CURL* VtClient::acquire()
+{
+	CURL* curl = nullptr;
+	{
+		lock_guard<mutex> guard(poolLock);
+		if (!pool.empty()) {
+			curl = pool.back();
+			pool.pop_back();
+		}
+	}
+
+	if (curl == nullptr) {
+		curl = curl_easy_init();
+	}
+	if (curl != nullptr) {
+		setDefaults(curl);
+	}
+	return curl;
+}
+
+// curl_easy_reset keeps the connections, the DNS cache and the TLS sessions
+void VtClient::release(CURL* curl)
+{
+	if (curl == nullptr) {
+		return;
+	}
+
+	curl_easy_reset(curl);
+	lock_guard<mutex> guard(poolLock);
+	pool.push_back(curl);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Warm-up
+
+void VtClient::warmUp(const string& url)
+{
+	if (share == nullptr) {
+		return;
+	}
+	if (warmer.joinable()) {
+		warmer.join();
+	}
+
+	warmer = thread([this, url]() {
+		CURL* curl = acquire();
+		if (curl == nullptr) {
+			return;
+		}
+
+		// a HEAD request is enough to resolve the host and negotiate TLS,
+		// the connection then stays in the shared connection cache
+		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+		curl_easy_perform(curl);
+
+		release(curl);
+	});
+}
@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - persistent HTTP client
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Lives from XT_Init to XT_Done so that lookups do not pay a DNS resolution,
+// a TCP handshake and a TLS negotiation each time :
+// - a curl share holds the DNS cache, the TLS sessions and the connections
+// - easy handles are pooled and reset instead of being destroyed
+// - warmUp() opens the connection in the background before the first item
+
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <curl/curl.h>
+
+class VtClient {
+public:
+	VtClient();
+	~VtClient();
+
+	bool init();
+	void cleanup();
+	bool isReady() const { return share != nullptr; }
+
+	// Resolves the host and opens a keep-alive connection in the background
+	void warmUp(const std::string& url);
+
+	// Easy handle attached to the share, to be given back with release()
+	CURL* acquire();
+	void release(CURL* curl);
+
+private:
+	static void lockShare(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr);
+	static void unlockShare(CURL* curl, curl_lock_data data, void* userptr);
+	void setDefaults(CURL* curl);
+
+	CURLSH* share;
+	std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+	std::mutex poolLock;
+	std::vector<CURL*> pool;
+
+	std::thread warmer;
+};
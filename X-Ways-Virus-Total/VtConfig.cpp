@@ -0,0 +1,321 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - configuration
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtConfig.h"
+#include "VtHasher.h"
+#include "VtLookup.h"
+#include <fstream>
+#include <map>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+
+using namespace std;
+
+namespace
+{
+	typedef map<string, string> IniSection;
+	typedef vector<pair<string, IniSection>> IniFile; // in file order
+
+	string trim(const string& s)
+	{
+		size_t first = s.find_first_not_of(" \t\r\n");
+		if (first == string::npos) {
+			return string();
+		}
+		size_t last = s.find_last_not_of(" \t\r\n");
+		return s.substr(first, last - first + 1);
+	}
+
+	string lower(string s)
+	{
+		for (char& c : s) {
+			c = (char)tolower((unsigned char)c);
+		}
+		return s;
+	}
+
+	// Reads the sections the way GetPrivateProfileString does : names are not
+	// case sensitive, the first occurrence of a key wins, quotes are removed
+	bool readIni(const string& path, IniFile& sections)
+	{
+		ifstream ini(path);
+		if (!ini) {
+			return false;
+		}
+
+		string line;
+		IniSection* section = nullptr;
+		bool firstLine = true;
+		while (getline(ini, line)) {
+			// UTF-8 BOM written by some editors
+			if (firstLine && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+				line.erase(0, 3);
+			}
+			firstLine = false;
+
+			line = trim(line);
+			if (line.empty() || line[0] == ';' || line[0] == '#') {
+				continue;
+			}
+
+			if (line[0] == '[') {
+				size_t end = line.find(']');
+				section = nullptr;
+				if (end != string::npos) {
+					string name = lower(trim(line.substr(1, end - 1)));
+					for (pair<string, IniSection>& existing : sections) {
+						if (existing.first == name) {
+							section = &existing.second;
+						}
+					}
+					if (section == nullptr) {
+						sections.push_back(make_pair(name, IniSection()));
+						section = &sections.back().second;
+					}
+				}
+				continue;
+			}
+
+			size_t equal = line.find('=');
+			if (section == nullptr || equal == string::npos) {
+				continue;
+			}
+
+			string key = lower(trim(line.substr(0, equal)));
+			string value = trim(line.substr(equal + 1));
+			if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'') && value.back() == value[0]) {
+				value = value.substr(1, value.size() - 2);
+			}
+			section->insert(make_pair(key, value));
+		}
+		return true;
+	}
+
+	// Integer setting within [minValue, maxValue], defaultValue if absent or empty
+	int readInt(const IniSection& section, const string& key, int defaultValue,
+		int minValue, int maxValue, vector<string>& errors)
+	{
+		IniSection::const_iterator it = section.find(key);
+		if (it == section.end() || it->second.empty()) {
+			return defaultValue;
+		}
+
+		const char* text = it->second.c_str();
+		char* end = nullptr;
+		errno = 0;
+		long value = strtol(text, &end, 10);
+		if (end == text || *end != '\0' || errno == ERANGE) {
+			errors.push_back(key + " : \"" + it->second + "\" is not a number");
+			return defaultValue;
+		}
+		if (value < minValue || value > maxValue) {
+			errors.push_back(key + " : " + it->second + " is out of range [" +
+				to_string(minValue) + ", " + to_string(maxValue) + "]");
+			return defaultValue;
+		}
+		return (int)value;
+	}
+
+	string readString(const IniSection& section, const string& key, const string& defaultValue)
+	{
+		IniSection::const_iterator it = section.find(key);
+		return it == section.end() ? defaultValue : it->second;
+	}
+
+	// apikey, public and quotas of a key, the errors are prefixed with the section
+	VtKeyConfig readKey(const string& name, const IniSection& section, const string& quotaFile,
+		vector<string>& errors)
+	{
+		size_t errorCount = errors.size();
+		VtKeyConfig key;
+		key.name = name;
+
+		// 64 hexadecimal characters
+		key.apiKey = readString(section, "apikey", "");
+		bool hexKey = key.apiKey.size() == VT_API_KEY_LENGTH;
+		for (char c : key.apiKey) {
+			hexKey = hexKey && isxdigit((unsigned char)c);
+		}
+		if (!hexKey) {
+			errors.push_back("apikey : \"" + key.apiKey + "\" is not a " + to_string(VT_API_KEY_LENGTH) + " characters hexadecimal key");
+		}
+
+		// Public keys : 4 requests per minute, 500 per day, 15.5K per month
+		key.publicKey = readInt(section, "public", 0, 0, 1, errors) == 1;
+		key.perMinute = readInt(section, "perminute", key.publicKey ? 4 : 0, 0, INT_MAX, errors);
+		key.perDay = readInt(section, "perday", key.publicKey ? 500 : 0, 0, INT_MAX, errors);
+		key.perMonth = readInt(section, "permonth", key.publicKey ? 15500 : 0, 0, INT_MAX, errors);
+
+		key.quotaFile = readString(section, "quotafile", quotaFile);
+		if (key.quotaFile.empty()) {
+			errors.push_back("quotafile : a file name is required");
+		}
+
+		for (size_t i = errorCount; i < errors.size(); i++) {
+			errors[i] = "[" + name + "] " + errors[i];
+		}
+		return key;
+	}
+
+	// Relative file names are relative to the folder of config.ini,
+	// not to the current directory of X-Ways
+	string resolve(const string& folder, const string& file)
+	{
+		if (file.empty() || folder.empty()) {
+			return file;
+		}
+
+		bool absolute = file[0] == '\\' || file[0] == '/' || (file.size() > 1 && file[1] == ':');
+		return absolute ? file : folder + file;
+	}
+
+	// [key], [key2], [key-team], [key_2]... but not [keywords]
+	bool isKeySection(const string& name)
+	{
+		if (name.compare(0, 3, "key") != 0) {
+			return false;
+		}
+		return name.size() == 3 || isdigit((unsigned char)name[3]) || name[3] == '-' || name[3] == '_';
+	}
+}
+
+VtConfig::VtConfig()
+	: apiUrl(VT_API_URL), minScore(0), batchSize(VT_BATCH_PUBLIC), maxInFlight(8), connectTimeout(VT_CONNECT_TIMEOUT), requestTimeout(VT_REQUEST_TIMEOUT), hashThreads(4),
+	cacheFile("vtcache.bin"), cacheTtl(30), unknownTtl(1), journal("vtjournal"), reportFile("reportXTension.txt"), reportFormat(VT_REPORT_TEXT),
+	logLevel(VT_LOG_INFO), progress(10)
+{
+}
+
+bool vtLoadConfig(const string& path, VtConfig& config, vector<string>& errors)
+{
+	IniFile ini;
+	if (!readIni(path, ini)) {
+		errors.push_back("unable to read " + path);
+		return false;
+	}
+
+	IniSection section;
+	for (const pair<string, IniSection>& named : ini) {
+		if (named.first == "config") {
+			section = named.second;
+		}
+	}
+
+	size_t errorCount = errors.size();
+	VtConfig loaded;
+
+	string folder;
+	size_t slash = path.find_last_of("\\/");
+	if (slash != string::npos) {
+		folder = path.substr(0, slash + 1);
+	}
+
+	// apikey of [config] then one key per [key...] section ([key2], [key-team]...),
+	// [config] may hold no key when sections do
+	bool keySections = false;
+	for (const pair<string, IniSection>& named : ini) {
+		keySections = keySections || isKeySection(named.first);
+	}
+	if (!keySections || !readString(section, "apikey", "").empty()) {
+		loaded.keys.push_back(readKey("config", section, "vtquota.txt", errors));
+	}
+	for (const pair<string, IniSection>& named : ini) {
+		if (isKeySection(named.first)) {
+			loaded.keys.push_back(readKey(named.first, named.second, "vtquota-" + named.first + ".txt", errors));
+		}
+	}
+
+	bool anyPublic = false;
+	for (size_t i = 0; i < loaded.keys.size(); i++) {
+		VtKeyConfig& key = loaded.keys[i];
+		key.quotaFile = resolve(folder, key.quotaFile);
+		anyPublic = anyPublic || key.publicKey;
+		for (size_t j = 0; j < i; j++) {
+			if (loaded.keys[j].apiKey == key.apiKey) {
+				errors.push_back("[" + key.name + "] apikey : same key as [" + loaded.keys[j].name + "]");
+			}
+		}
+	}
+
+	// http(s)://host[:port]/path/ of the v2 API
+	loaded.apiUrl = readString(section, "apiurl", VT_API_URL);
+	if (loaded.apiUrl.compare(0, 7, "http://") != 0 && loaded.apiUrl.compare(0, 8, "https://") != 0) {
+		errors.push_back("apiurl : \"" + loaded.apiUrl + "\" is not an http:// or https:// URL");
+	}
+	else if (loaded.apiUrl.back() != '/') {
+		loaded.apiUrl += '/';
+	}
+
+	loaded.minScore = readInt(section, "minscore", 0, 0, 1000, errors);
+
+	// Public keys : 4 hashes per request, a batch may go to any key
+	if (anyPublic) {
+		loaded.batchSize = VT_BATCH_PUBLIC;
+	}
+	else {
+		loaded.batchSize = readInt(section, "batchsize", VT_BATCH_PAID, 1, VT_BATCH_PAID, errors);
+	}
+	loaded.maxInFlight = readInt(section, "maxinflight", 8, 1, VT_MAX_IN_FLIGHT, errors);
+	loaded.connectTimeout = readInt(section, "connecttimeout", VT_CONNECT_TIMEOUT, 1, 300, errors);
+	loaded.requestTimeout = readInt(section, "requesttimeout", VT_REQUEST_TIMEOUT, 1, 3600, errors);
+	loaded.hashThreads = readInt(section, "hashthreads", 4, 0, VT_HASHER_MAX_THREADS, errors);
+
+	loaded.knownFile = resolve(folder, readString(section, "knownfile", ""));
+	loaded.cacheFile = resolve(folder, readString(section, "cachefile", "vtcache.bin"));
+	loaded.cacheTtl = readInt(section, "cachettl", 30, 0, 36500, errors);
+	loaded.unknownTtl = readInt(section, "unknownttl", 1, 0, 36500, errors);
+	loaded.journal = resolve(folder, readString(section, "journal", "vtjournal"));
+
+	loaded.reportFile = resolve(folder, readString(section, "reportfile", "reportXTension.txt"));
+	if (loaded.reportFile.empty()) {
+		errors.push_back("reportfile : a file name is required");
+	}
+	string format = lower(readString(section, "reportformat", "text"));
+	if (!VtReport::parseFormat(format, loaded.reportFormat)) {
+		errors.push_back("reportformat : \"" + format + "\" is not text, csv or jsonl");
+	}
+
+	// engines=Microsoft,Kaspersky,...
+	string engines = readString(section, "engines", "");
+	size_t start = 0;
+	while (start <= engines.size()) {
+		size_t comma = engines.find(',', start);
+		if (comma == string::npos) {
+			comma = engines.size();
+		}
+		string engine = trim(engines.substr(start, comma - start));
+		if (!engine.empty()) {
+			loaded.engines.push_back(engine);
+		}
+		start = comma + 1;
+	}
+
+	loaded.archiveFile = resolve(folder, readString(section, "archivefile", ""));
+	loaded.timingFile = resolve(folder, readString(section, "timingfile", ""));
+
+	string level = lower(readString(section, "loglevel", "info"));
+	if (!VtLog::parseLevel(level, loaded.logLevel)) {
+		errors.push_back("loglevel : \"" + level + "\" is not error, warning, info or verbose");
+	}
+	loaded.progress = readInt(section, "progress", 10, 0, 3600, errors);
+
+	// items skipped before they are hashed, checked now, compiled by each run
+	for (const pair<string, IniSection>& named : ini) {
+		if (named.first == "filter") {
+			loaded.filterRules.assign(named.second.begin(), named.second.end());
+		}
+	}
+	VtFilter filter;
+	filter.compile(loaded.filterRules, errors);
+
+	if (errors.size() != errorCount) {
+		return false;
+	}
+
+	config = loaded;
+	return true;
+}
@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - configuration
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// config.ini is read once, in XT_Init, and checked before any run starts.
+// The parser only uses the standard library so the same file can be loaded
+// outside of X-Ways (tests, benchmarks) from an explicit path.
+
+#pragma once
+#include "VtReport.h"
+#include "VtLog.h"
+#include "VtFilter.h"
+#include <string>
+#include <vector>
+#include <utility>
+
+#define VT_CONFIG_FILE		"config.ini"
+#define VT_API_KEY_LENGTH	64
+#define VT_MAX_IN_FLIGHT	64
+
+// One VirusTotal key : apikey of [config] or of a [key...] section
+struct VtKeyConfig {
+	std::string name;		// section name
+	std::string apiKey;
+	bool publicKey;
+	int perMinute;			// quotas of the key, 0 = no limit
+	int perDay;
+	int perMonth;
+	std::string quotaFile;	// day / month usage of the key
+};
+
+// Settings of the [config] section, with the defaults already applied
+struct VtConfig {
+	std::string apiUrl;		// VT_API_URL unless a local stand-in is used
+	std::vector<VtKeyConfig> keys;	// at least one, [config] first
+	int minScore;			// report table threshold
+
+	size_t batchSize;		// hashes per request, 4 as soon as a key is public
+	int maxInFlight;		// concurrent requests
+	int connectTimeout;		// seconds to connect to VirusTotal
+	int requestTimeout;		// seconds for a whole request, then it is sent again
+	int hashThreads;		// threads computing the missing hashes, 0 = left to X-Ways
+
+	std::string knownFile;	// known-hash index (tools/vtknown), empty = none
+	std::string cacheFile;	// empty = no verdict cache
+	unsigned cacheTtl;		// days, 0 = never expires
+	unsigned unknownTtl;	// days for the files VirusTotal does not know, 0 = not served from the cache
+	std::string journal;	// resume journals, <journal>-<volume>.vtj, empty = none
+
+	std::string reportFile;
+	VtReportFormat reportFormat;
+
+	std::vector<std::string> engines;	// engines whose result is reported
+	std::string archiveFile;	// raw reports of the run, empty = not kept
+	std::string timingFile;	// stage timings of each run (CSV), empty = not kept
+
+	VtLogLevel logLevel;	// messages shown, info by default
+	unsigned progress;		// seconds between two progress lines, 0 = none
+
+	// rules of the [filter] section, name and conditions, checked by VtFilter
+	std::vector<std::pair<std::string, std::string>> filterRules;
+
+	VtConfig();
+};
+
+// Loads and validates the [config], [key...] and [filter] sections of an INI file
+// Relative file names (quotafile, cachefile) are resolved against the folder
+// of the INI file. Returns false with the reasons in errors if the file is
+// missing or a setting is invalid, config is left untouched in that case.
+bool vtLoadConfig(const std::string& path, VtConfig& config, std::vector<std::string>& errors);
@@ -0,0 +1,348 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - asynchronous lookup engine
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtEngine.h"
+#include "VtClient.h"
+#include "VtLookup.h"
+#include "VtKeyPool.h"
+#include <algorithm>
+#include <chrono>
+#include <curl/curl.h>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	// A request on the wire, owned by the worker thread
+	struct Transfer {
+		CURL* easy;
+		VtResponse response;
+	};
+}
+
+VtEngine::VtEngine()
+	: client(nullptr), keys(nullptr), maxInFlight(1), connectTimeout(VT_CONNECT_TIMEOUT), requestTimeout(VT_REQUEST_TIMEOUT), inFlight(0), refusals(0), retries(0), stopping(true)
+{
+}
+
+VtEngine::~VtEngine()
+{
+	stop();
+}
+
+bool VtEngine::start(VtClient* httpClient, const string& url, VtKeyPool* pool, int inFlightMax,
+	long connectSeconds, long requestSeconds)
+{
+	stop();
+
+	if (httpClient == nullptr || !httpClient->isReady() || pool == nullptr || pool->size() == 0) {
+		return false;
+	}
+
+	client = httpClient;
+	apiUrl = url;
+	keys = pool;
+	maxInFlight = max(1, inFlightMax);
+	connectTimeout = connectSeconds;
+	requestTimeout = requestSeconds;
+	stopping = false;
+	inFlight = 0;
+	refusals = 0;
+	retries = 0;
+	budget.reset();
+	queue.clear();
+	done.clear();
+
+	worker = thread(&VtEngine::run, this);
+	return true;
+}
+
+void VtEngine::stop()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+		queue.clear();
+	}
+	wake.notify_all();
+
+	if (worker.joinable()) {
+		worker.join();
+	}
+
+	lock_guard<mutex> guard(lock);
+	inFlight = 0;
+	finished.notify_all();
+}
+
+void VtEngine::submit(const VtRequest& request)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		if (stopping) {
+			return;
+		}
+		Queued queued;
+		queued.request = request;
+		queued.attempts = 0;
+		queued.notBefore = steady_clock::now();
+		queue.push_back(queued);
+	}
+	wake.notify_one();
+}
+
+bool VtEngine::collect(vector<VtResponse>& out, unsigned timeout)
+{
+	unique_lock<mutex> guard(lock);
+	bool working = !stopping && (inFlight > 0 || !queue.empty());
+	if (done.empty() && working) {
+		finished.wait_for(guard, milliseconds(timeout), [this] { return !done.empty(); });
+	}
+
+	bool more = !done.empty() || (!stopping && (inFlight > 0 || !queue.empty()));
+	for (VtResponse& response : done) {
+		out.push_back(move(response));
+	}
+	done.clear();
+	return more;
+}
+
+size_t VtEngine::pending()
+{
+	lock_guard<mutex> guard(lock);
+	return queue.size() + inFlight;
+}
+
+size_t VtEngine::refused()
+{
+	lock_guard<mutex> guard(lock);
+	return refusals;
+}
+
+size_t VtEngine::retried()
+{
+	lock_guard<mutex> guard(lock);
+	return retries;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker thread
+
+// Answers every queued request as not sent, the lock must be held
+void VtEngine::drop(const string& reason)
+{
+	for (const Queued& queued : queue) {
+		VtResponse response;
+		response.request = queued.request;
+		response.sent = false;
+		response.key = 0;
+		response.attempts = queued.attempts;
+		response.httpCode = 0;
+		response.error = reason;
+		response.seconds = 0;
+		done.push_back(response);
+	}
+	if (!queue.empty()) {
+		finished.notify_all();
+	}
+	queue.clear();
+}
+
+void VtEngine::run()
+{
+	CURLM* multi = curl_multi_init();
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)maxInFlight);
+	vector<Transfer*> transfers;
+	steady_clock::time_point nextDispatch = steady_clock::now();
+	string exhausted;
+
+	unique_lock<mutex> guard(lock);
+	while (!stopping) {
+
+		// Quota used up : nothing more will be sent
+		if (!exhausted.empty()) {
+			drop(exhausted);
+		}
+
+		// Send the queued requests while there is room and a token is available,
+		// the first one whose backoff is over
+		while ((int)inFlight < maxInFlight && steady_clock::now() >= nextDispatch) {
+			steady_clock::time_point now = steady_clock::now();
+			deque<Queued>::iterator ready = find_if(queue.begin(), queue.end(),
+				[now](const Queued& queued) { return queued.notBefore <= now; });
+			if (ready == queue.end()) {
+				break;
+			}
+
+			size_t key = 0;
+			unsigned waitMs = 0;
+			VtGrant grant = keys->reserve(key, waitMs);
+			if (grant == VT_WAIT) {
+				nextDispatch = steady_clock::now() + milliseconds(waitMs);
+				break;
+			}
+			if (grant == VT_EXHAUSTED) {
+				exhausted = "No API key left : quotas reached or access denied";
+				drop(exhausted);
+				break;
+			}
+
+			Transfer* transfer = new Transfer();
+			transfer->response.request = ready->request;
+			transfer->response.sent = true;
+			transfer->response.key = key;
+			transfer->response.attempts = ready->attempts + 1;
+			transfer->response.httpCode = 0;
+			transfer->response.seconds = 0;
+			queue.erase(ready);
+
+			transfer->easy = client->acquire();
+			vtSetupRequest(transfer->easy, vtReportUrl(apiUrl, keys->apiKey(key), transfer->response.request.resources),
+				&transfer->response.body, &transfer->response.apiMessage, connectTimeout, requestTimeout);
+			curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+			curl_multi_add_handle(multi, transfer->easy);
+
+			transfers.push_back(transfer);
+			inFlight++;
+		}
+
+		// Nothing on the wire : sleep until a request comes, the interval is
+		// over or a backoff ends
+		if (inFlight == 0) {
+			if (queue.empty()) {
+				wake.wait(guard);
+			}
+			else {
+				steady_clock::time_point until = queue.front().notBefore;
+				for (const Queued& queued : queue) {
+					until = min(until, queued.notBefore);
+				}
+				wake.wait_until(guard, max(until, nextDispatch));
+			}
+			continue;
+		}
+
+		guard.unlock();
+
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		vector<VtResponse> completed;
+		vector<Queued> again;
+		size_t refused = 0;
+		size_t retried = 0;
+		CURLMsg* msg;
+		int left = 0;
+		while ((msg = curl_multi_info_read(multi, &left)) != nullptr) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+
+			Transfer* transfer = nullptr;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+
+			CURLcode result = msg->data.result;
+			bool timedOut = result == CURLE_OPERATION_TIMEDOUT;
+			if (result == CURLE_OK) {
+				curl_easy_getinfo(transfer->easy, CURLINFO_RESPONSE_CODE, &transfer->response.httpCode);
+			}
+			else {
+				transfer->response.error = curl_easy_strerror(result);
+			}
+			curl_easy_getinfo(transfer->easy, CURLINFO_TOTAL_TIME, &transfer->response.seconds);
+
+			curl_multi_remove_handle(multi, transfer->easy);
+			client->release(transfer->easy);
+
+			VtResponse& response = transfer->response;
+			VtErrorClass error = vtErrorClass(response.httpCode, timedOut);
+			const VtRetryPolicy& policy = vtRetryPolicy(error);
+			bool retry = false;
+			switch (error) {
+			// that key backs off, several in a row mean its quota is used up on
+			// VirusTotal's side, the request waits for another key
+			case VT_ERROR_QUOTA:
+				refused++;
+				keys->refused(response.key);
+				retry = keys->available() > 0;
+				if (!retry) {
+					exhausted = "VirusTotal quota exceeded : " + response.apiMessage;
+					response.sent = false;
+				}
+				break;
+
+			// invalid key, dropped, 403 only comes back once no key is left
+			case VT_ERROR_DENIED:
+				keys->denied(response.key);
+				retry = keys->available() > 0;
+				break;
+
+			// transient, within the attempts of the class and the run budget
+			case VT_ERROR_NETWORK:
+			case VT_ERROR_TIMEOUT:
+			case VT_ERROR_SERVER:
+				retry = (policy.maxAttempts == 0 || response.attempts < policy.maxAttempts)
+					&& (!policy.budgeted || budget.withdraw());
+				retried += retry;
+				break;
+
+			case VT_ERROR_NONE:
+				if (response.attempts == 1) {
+					budget.succeeded();
+				}
+				keys->answered(response.key);
+				break;
+
+			case VT_ERROR_REQUEST:
+				keys->answered(response.key);
+				break;
+			}
+
+			if (retry) {
+				Queued queued;
+				queued.request = move(response.request);
+				queued.attempts = response.attempts;
+				queued.notBefore = steady_clock::now() + milliseconds(backoff.delayMs(policy, response.attempts));
+				again.push_back(move(queued));
+			}
+			else {
+				completed.push_back(move(response));
+			}
+
+			transfers.erase(find(transfers.begin(), transfers.end(), transfer));
+			delete transfer;
+		}
+
+		if (completed.empty() && again.empty()) {
+			int numfds = 0;
+			curl_multi_wait(multi, nullptr, 0, 50, &numfds);
+		}
+
+		guard.lock();
+		refusals += refused;
+		retries += retried;
+		for (Queued& queued : again) {
+			queue.push_back(move(queued));
+		}
+		inFlight -= again.size();
+		if (!completed.empty()) {
+			for (VtResponse& response : completed) {
+				done.push_back(move(response));
+			}
+			inFlight -= completed.size();
+			finished.notify_all();
+		}
+	}
+	guard.unlock();
+
+	// Stopped : drop what is still in flight
+	for (Transfer* transfer : transfers) {
+		curl_multi_remove_handle(multi, transfer->easy);
+		client->release(transfer->easy);
+		delete transfer;
+	}
+	curl_multi_cleanup(multi);
+}
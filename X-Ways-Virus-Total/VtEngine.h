@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - asynchronous lookup engine
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// A worker thread owns a curl multi handle and keeps several file/report
+// requests in flight. Requests are submitted from XT_ProcessItemEx, the
+// responses are collected from the X-Ways thread since the XWF_* functions
+// must not be called from the worker.
+// Each request reserves a token on one of the keys of the pool before it is
+// sent. A failed request is sent again according to the policy of its error
+// class (VtRetry) : it goes to the back of the queue, behind the new
+// requests, and waits for its backoff. An HTTP 204 backs the key off and an
+// HTTP 403 drops it, the request then goes to the other keys.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "VtRetry.h"
+
+class VtClient;
+class VtKeyPool;
+
+// One batch of resources, items are the caller's indexes of the resources
+struct VtRequest {
+	std::vector<size_t> items;
+	std::vector<std::string> resources;
+};
+
+struct VtResponse {
+	VtRequest request;
+	bool sent;				// false when dropped because the quota is used up
+	size_t key;				// key of the pool that sent the request
+	unsigned attempts;		// sends, retries included
+	long httpCode;			// 0 if the request could not be sent
+	std::string body;
+	std::string apiMessage;	// X-Api-Message header
+	std::string error;		// curl error, if any
+	double seconds;			// time on the wire, connection included
+};
+
+class VtEngine {
+public:
+	VtEngine();
+	~VtEngine();
+
+	// client : provides the easy handles, connections are reused between requests
+	// apiUrl : base URL of the API, VT_API_URL unless testing
+	// keys : API keys and their quotas, at least one
+	// maxInFlight : concurrent requests
+	// connectTimeout, requestTimeout : seconds, VT_CONNECT_TIMEOUT and VT_REQUEST_TIMEOUT by default
+	bool start(VtClient* client, const std::string& apiUrl, VtKeyPool* keys, int maxInFlight,
+		long connectTimeout, long requestTimeout);
+
+	// Stops the worker, the requests not sent yet are dropped
+	void stop();
+
+	// Ignored when the engine is not started
+	void submit(const VtRequest& request);
+
+	// Moves the finished responses to out, blocks up to timeout milliseconds
+	// when none is ready. Returns false once nothing is queued or in flight
+	bool collect(std::vector<VtResponse>& out, unsigned timeout);
+
+	// Requests queued or in flight
+	size_t pending();
+
+	// HTTP 204 answers received since start()
+	size_t refused();
+
+	// Requests sent again after a network or server error since start()
+	size_t retried();
+
+private:
+	// A request waiting to be sent, or sent again once notBefore is reached
+	struct Queued {
+		VtRequest request;
+		unsigned attempts;
+		std::chrono::steady_clock::time_point notBefore;
+	};
+
+	void run();
+
+	void drop(const std::string& reason);
+
+	VtClient* client;
+	std::string apiUrl;
+	VtKeyPool* keys;
+	int maxInFlight;
+	long connectTimeout;
+	long requestTimeout;
+
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wake;		// new request or stop
+	std::condition_variable finished;	// new response
+	std::deque<Queued> queue;
+	std::vector<VtResponse> done;
+	size_t inFlight;
+	size_t refusals;
+	size_t retries;
+	bool stopping;
+
+	// worker thread only
+	VtRetryBudget budget;
+	VtBackoff backoff;
+};
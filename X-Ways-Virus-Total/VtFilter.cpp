@@ -0,0 +1,359 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - item prefilter
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtFilter.h"
+#include <algorithm>
+#include <cwctype>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+
+using namespace std;
+
+namespace
+{
+	struct FlagName {
+		const char* name;
+		long long mask;
+	};
+
+	const FlagName kFlags[] = {
+		{ "directory", VT_ITEM_DIRECTORY }, { "virtual", VT_ITEM_VIRTUAL }, { "hidden", VT_ITEM_HIDDEN },
+		{ "tagged", VT_ITEM_TAGGED }, { "unknown", VT_ITEM_UNKNOWN }, { "duplicates", VT_ITEM_DUPLICATES },
+		{ "irrelevant", VT_ITEM_IRRELEVANT }, { "notable", VT_ITEM_NOTABLE }, { "inconsistent", VT_ITEM_INCONSISTENT },
+	};
+
+	string lower(string s)
+	{
+		for (char& c : s) {
+			c = (char)tolower((unsigned char)c);
+		}
+		return s;
+	}
+
+	string trim(const string& s)
+	{
+		size_t first = s.find_first_not_of(" \t");
+		if (first == string::npos) {
+			return string();
+		}
+		return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+	}
+
+	// a,b,c : lowercase words, widened as the other settings
+	vector<wstring> splitWords(const string& list)
+	{
+		vector<wstring> words;
+		size_t start = 0;
+		while (start <= list.size()) {
+			size_t comma = list.find(',', start);
+			if (comma == string::npos) {
+				comma = list.size();
+			}
+			string word = lower(trim(list.substr(start, comma - start)));
+			if (!word.empty()) {
+				words.push_back(wstring(word.begin(), word.end()));
+			}
+			start = comma + 1;
+		}
+		return words;
+	}
+
+	// 4096, 4K, 1.5M... binary units
+	bool parseSize(const string& text, long long& size)
+	{
+		if (text.empty() || !isdigit((unsigned char)text[0])) {
+			return false;
+		}
+		size_t end = 0;
+		double value = 0;
+		while (end < text.size() && (isdigit((unsigned char)text[end]) || text[end] == '.')) {
+			end++;
+		}
+		char* parsed = nullptr;
+		string number = text.substr(0, end);
+		value = strtod(number.c_str(), &parsed);
+		if (*parsed != '\0') {
+			return false;
+		}
+
+		string unit = lower(text.substr(end));
+		const char* units[] = { "", "k", "m", "g", "t" };
+		for (int i = 0; i < 5; i++) {
+			if (unit == units[i] || (i > 0 && unit == string(units[i]) + "b")) {
+				for (int j = 0; j < i; j++) {
+					value *= 1024;
+				}
+				if (value >= (double)LLONG_MAX) {
+					return false;
+				}
+				size = (long long)value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// word is lowercase, text is compared without its case
+	bool equalsWord(const wchar_t* text, size_t length, const wstring& word)
+	{
+		if (length != word.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < length; i++) {
+			if ((wchar_t)towlower(text[i]) != word[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool anyWord(const wchar_t* text, size_t length, const vector<wstring>& words)
+	{
+		for (const wstring& word : words) {
+			if (equalsWord(text, length, word)) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+bool VtFilter::compile(const vector<pair<string, string>>& ruleTexts, vector<string>& errors)
+{
+	rules.clear();
+	size_t errorCount = errors.size();
+
+	vector<Rule> compiled;
+	for (const pair<string, string>& text : ruleTexts) {
+		Rule rule;
+		rule.name = text.first;
+		size_t ruleErrors = errors.size();
+
+		size_t start = 0;
+		const string& conditions = text.second;
+		while (start < conditions.size()) {
+			size_t end = conditions.find_first_of(" \t", start);
+			if (end == string::npos) {
+				end = conditions.size();
+			}
+			if (end > start) {
+				Condition condition;
+				string error;
+				if (parse(conditions.substr(start, end - start), condition, error)) {
+					rule.conditions.push_back(condition);
+				}
+				else {
+					errors.push_back("[filter] " + rule.name + " : " + error);
+				}
+			}
+			start = end + 1;
+		}
+
+		if (errors.size() != ruleErrors) {
+			continue;
+		}
+		if (rule.conditions.empty()) {
+			errors.push_back("[filter] " + rule.name + " : no condition, every item would be skipped");
+			continue;
+		}
+
+		// cheapest first : flags and sizes before names and hash sets
+		stable_sort(rule.conditions.begin(), rule.conditions.end(),
+			[](const Condition& a, const Condition& b) { return a.field < b.field; });
+		compiled.push_back(rule);
+	}
+
+	if (errors.size() != errorCount) {
+		return false;
+	}
+	rules.swap(compiled);
+	return true;
+}
+
+bool VtFilter::parse(const string& token, Condition& condition, string& error)
+{
+	condition = Condition();
+	condition.negate = false;
+	condition.low = 0;
+	condition.high = LLONG_MAX;
+	condition.mask = 0;
+	condition.any = false;
+
+	string text = token;
+	if (!text.empty() && text[0] == '!') {
+		condition.negate = true;
+		text.erase(0, 1);
+	}
+	string name = lower(text.substr(0, text.find_first_of(":<>=")));
+	string rest = text.substr(name.size());
+
+	if (name == "deleted" && rest.empty()) {
+		condition.field = FIELD_DELETED;
+		return true;
+	}
+
+	if (name == "size") {
+		condition.field = FIELD_SIZE;
+		size_t opLength = rest.compare(0, 2, "<=") == 0 || rest.compare(0, 2, ">=") == 0 ? 2 : 1;
+		string op = rest.substr(0, opLength);
+		long long size = 0;
+		if ((op != "<" && op != ">" && op != "=" && op != "<=" && op != ">=") || !parseSize(rest.substr(opLength), size)) {
+			error = "\"" + token + "\" is not size<N, size<=N, size>N, size>=N or size=N";
+			return false;
+		}
+		if (op == "<") {
+			condition.high = size - 1;
+		}
+		else if (op == "<=") {
+			condition.high = size;
+		}
+		else if (op == ">") {
+			condition.low = size == LLONG_MAX ? size : size + 1;
+		}
+		else if (op == ">=") {
+			condition.low = size;
+		}
+		else {
+			condition.low = size;
+			condition.high = size;
+		}
+		return true;
+	}
+
+	if (rest.empty() || rest[0] != ':') {
+		error = "unknown condition \"" + token + "\"";
+		return false;
+	}
+	vector<wstring> words = splitWords(rest.substr(1));
+	if (words.empty()) {
+		error = "\"" + token + "\" : empty list";
+		return false;
+	}
+
+	if (name == "ext" || name == "type") {
+		condition.field = name == "ext" ? FIELD_EXT : FIELD_TYPE;
+		for (wstring& word : words) {
+			if (word[0] == L'.') {
+				word.erase(0, 1);
+			}
+		}
+		condition.words = words;
+		return true;
+	}
+
+	if (name == "hashset") {
+		condition.field = FIELD_HASHSET;
+		condition.any = find(words.begin(), words.end(), L"*") != words.end();
+		condition.words = words;
+		return true;
+	}
+
+	if (name == "flag") {
+		condition.field = FIELD_FLAGS;
+		for (const wstring& word : words) {
+			string flag(word.begin(), word.end());
+			long long mask = 0;
+			for (const FlagName& known : kFlags) {
+				if (flag == known.name) {
+					mask = known.mask;
+				}
+			}
+			if (mask == 0 && flag.compare(0, 2, "0x") == 0 && flag.size() > 2) {
+				char* end = nullptr;
+				mask = strtoll(flag.c_str() + 2, &end, 16);
+				if (*end != '\0') {
+					mask = 0;
+				}
+			}
+			if (mask == 0) {
+				error = "unknown flag \"" + flag + "\"";
+				return false;
+			}
+			condition.mask |= mask;
+		}
+		return true;
+	}
+
+	error = "unknown condition \"" + token + "\"";
+	return false;
+}
+
+int VtFilter::match(VtFilterItem& item) const
+{
+	for (size_t r = 0; r < rules.size(); r++) {
+		bool all = true;
+		for (const Condition& condition : rules[r].conditions) {
+			if (test(condition, item) == condition.negate) {
+				all = false;
+				break;
+			}
+		}
+		if (all) {
+			return (int)r;
+		}
+	}
+	return -1;
+}
+
+bool VtFilter::test(const Condition& condition, VtFilterItem& item)
+{
+	switch (condition.field) {
+	case FIELD_FLAGS:
+		return (item.flags() & condition.mask) != 0;
+
+	case FIELD_DELETED:
+		return item.deleted();
+
+	case FIELD_SIZE: {
+		long long size = item.size();
+		return size >= condition.low && size <= condition.high;
+	}
+
+	case FIELD_EXT: {
+		const wchar_t* name = item.name();
+		const wchar_t* dot = name != nullptr ? wcsrchr(name, L'.') : nullptr;
+		return dot != nullptr && anyWord(dot + 1, wcslen(dot + 1), condition.words);
+	}
+
+	case FIELD_TYPE: {
+		const wchar_t* type = item.type();
+		return type != nullptr && anyWord(type, wcslen(type), condition.words);
+	}
+
+	case FIELD_HASHSET: {
+		const wchar_t* sets = item.hashSets();
+		if (sets == nullptr || *sets == L'\0') {
+			return false;
+		}
+		if (condition.any) {
+			return true;
+		}
+		// "set1, set2"
+		while (*sets != L'\0') {
+			while (*sets == L' ') {
+				sets++;
+			}
+			const wchar_t* end = wcschr(sets, L',');
+			size_t length = end != nullptr ? (size_t)(end - sets) : wcslen(sets);
+			size_t trimmed = length;
+			while (trimmed > 0 && sets[trimmed - 1] == L' ') {
+				trimmed--;
+			}
+			if (anyWord(sets, trimmed, condition.words)) {
+				return true;
+			}
+			sets += length;
+			if (*sets == L',') {
+				sets++;
+			}
+		}
+		return false;
+	}
+	}
+	return false;
+}
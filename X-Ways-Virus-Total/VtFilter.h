@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - item prefilter
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Folders, empty files, media files, items already in a hash set... are
+// neither hashed nor looked up : the [filter] section of config.ini holds
+// rules, an item is skipped as soon as every condition of one rule holds.
+//
+//     [filter]
+//     folders=flag:directory
+//     empty=size<1
+//     media=ext:jpg,png,mp4,avi,mp3 size>1M
+//     known=hashset:* !flag:notable
+//
+// Conditions, ! in front negates one :
+//     size<N size<=N size>N size>=N size=N	N in bytes, or with K, M, G, T
+//     ext:a,b			extension of the name, case insensitive
+//     type:a,b			type detected from the signature
+//     hashset:a,b		hash sets of the item (XWF_GetHashSetAssocs), * = any
+//     flag:a,b			any of directory, virtual, hidden, tagged, unknown,
+//						duplicates, irrelevant, notable, inconsistent or 0x...
+//     deleted			deleted or carved item
+// The rules are compiled once, in XT_Prepare : the conditions of a rule are
+// tested from the cheapest to the most expensive one and what a condition
+// needs is only asked to X-Ways when it is tested, a folder or an empty file
+// is rejected before its name is even read.
+
+#pragma once
+#include "VtPriority.h"
+#include <string>
+#include <vector>
+#include <utility>
+
+// XWF_GetItemInformation(XWF_ITEM_INFO_FLAGS) bits the rules may name,
+// along with the ones of VtPriority.h
+#define VT_ITEM_DIRECTORY		0x00000001
+#define VT_ITEM_VIRTUAL			0x00000008
+#define VT_ITEM_HIDDEN			0x00000010 // hidden by the examiner
+#define VT_ITEM_UNKNOWN			0x00008000 // file contents totally unknown
+#define VT_ITEM_DUPLICATES		0x00080000
+
+// What the rules ask about an item, each question asked to X-Ways once at
+// most by the implementation
+class VtFilterItem {
+public:
+	virtual ~VtFilterItem() {}
+
+	virtual long long size() = 0;
+	virtual long long flags() = 0;			// XWF_ITEM_INFO_FLAGS
+	virtual bool deleted() = 0;
+	virtual const wchar_t* name() = 0;
+	virtual const wchar_t* type() = 0;		// detected from the signature, "" if none
+	virtual const wchar_t* hashSets() = 0;	// comma-separated names, "" if none
+};
+
+class VtFilter {
+public:
+	// rules : name and text of each rule of the [filter] section
+	// False with the reasons in errors if a rule cannot be read, the filter
+	// is left empty in that case
+	bool compile(const std::vector<std::pair<std::string, std::string>>& rules, std::vector<std::string>& errors);
+
+	void clear() { rules.clear(); }
+	bool isActive() const { return !rules.empty(); }
+	size_t ruleCount() const { return rules.size(); }
+
+	// Index of the first rule whose conditions all hold, -1 if none : the
+	// item is skipped when it is not -1
+	int match(VtFilterItem& item) const;
+
+	const std::string& ruleName(int rule) const { return rules[rule].name; }
+
+private:
+	// in the order the conditions are tested
+	enum Field {
+		FIELD_FLAGS,
+		FIELD_DELETED,
+		FIELD_SIZE,
+		FIELD_EXT,
+		FIELD_TYPE,
+		FIELD_HASHSET
+	};
+
+	struct Condition {
+		Field field;
+		bool negate;
+		long long low;		// size range, inclusive
+		long long high;
+		long long mask;		// flags, any of them
+		bool any;			// hashset:*
+		std::vector<std::wstring> words;	// lowercase
+	};
+
+	struct Rule {
+		std::string name;
+		std::vector<Condition> conditions;
+	};
+
+	static bool parse(const std::string& token, Condition& condition, std::string& error);
+	static bool test(const Condition& condition, VtFilterItem& item);
+
+	std::vector<Rule> rules;
+};
@@ -0,0 +1,506 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - MD5, SHA-1 and SHA-256
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtHash.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VT_HASH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VT_TARGET_SHA
+#else
+#include <cpuid.h>
+#define VT_TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+using namespace std;
+
+// Blocks hashed by each algorithm before moving to the next one : 16 KB
+// stay in the L1 cache between the three passes
+#define VT_HASH_SLICE_BLOCKS	256
+
+namespace
+{
+	typedef void (*BlockFunction)(uint32_t* state, const uint8_t* blocks, size_t count);
+
+	inline uint32_t rol(uint32_t x, int n)
+	{
+		return (x << n) | (x >> (32 - n));
+	}
+
+	inline uint32_t ror(uint32_t x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	inline uint32_t loadBig(const uint8_t* p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+
+	inline uint32_t loadLittle(const uint8_t* p)
+	{
+		return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+	}
+
+	inline void storeBig(uint8_t* p, uint32_t v)
+	{
+		p[0] = (uint8_t)(v >> 24);
+		p[1] = (uint8_t)(v >> 16);
+		p[2] = (uint8_t)(v >> 8);
+		p[3] = (uint8_t)v;
+	}
+
+	inline void storeLittle(uint8_t* p, uint32_t v)
+	{
+		p[0] = (uint8_t)v;
+		p[1] = (uint8_t)(v >> 8);
+		p[2] = (uint8_t)(v >> 16);
+		p[3] = (uint8_t)(v >> 24);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// MD5 (RFC 1321)
+
+	const uint32_t kMd5[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+
+	const int kMd5Shift[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+	void md5Blocks(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		for (; count > 0; count--, blocks += 64) {
+			uint32_t m[16];
+			for (int i = 0; i < 16; i++) {
+				m[i] = loadLittle(blocks + i * 4);
+			}
+
+			// one loop per round function, each one fully unrolled by the compiler
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			for (int i = 0; i < 16; i++) {
+				uint32_t t = b + rol(a + (d ^ (b & (c ^ d))) + kMd5[i] + m[i], kMd5Shift[i & 3]);
+				a = d; d = c; c = b; b = t;
+			}
+			for (int i = 16; i < 32; i++) {
+				uint32_t t = b + rol(a + (c ^ (d & (b ^ c))) + kMd5[i] + m[(5 * i + 1) & 15], kMd5Shift[4 + (i & 3)]);
+				a = d; d = c; c = b; b = t;
+			}
+			for (int i = 32; i < 48; i++) {
+				uint32_t t = b + rol(a + (b ^ c ^ d) + kMd5[i] + m[(3 * i + 5) & 15], kMd5Shift[8 + (i & 3)]);
+				a = d; d = c; c = b; b = t;
+			}
+			for (int i = 48; i < 64; i++) {
+				uint32_t t = b + rol(a + (c ^ (b | ~d)) + kMd5[i] + m[(7 * i) & 15], kMd5Shift[12 + (i & 3)]);
+				a = d; d = c; c = b; b = t;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// SHA-1 (FIPS 180-4)
+
+	// The message schedule is kept on 16 words, each one replaced once used
+	inline uint32_t sha1Schedule(uint32_t* w, int i)
+	{
+		if (i >= 16) {
+			w[i & 15] = rol(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+		}
+		return w[i & 15];
+	}
+
+	void sha1Portable(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		for (; count > 0; count--, blocks += 64) {
+			uint32_t w[16];
+			for (int i = 0; i < 16; i++) {
+				w[i] = loadBig(blocks + i * 4);
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+			for (int i = 0; i < 20; i++) {
+				uint32_t t = rol(a, 5) + (d ^ (b & (c ^ d))) + e + 0x5a827999 + sha1Schedule(w, i);
+				e = d; d = c; c = rol(b, 30); b = a; a = t;
+			}
+			for (int i = 20; i < 40; i++) {
+				uint32_t t = rol(a, 5) + (b ^ c ^ d) + e + 0x6ed9eba1 + sha1Schedule(w, i);
+				e = d; d = c; c = rol(b, 30); b = a; a = t;
+			}
+			for (int i = 40; i < 60; i++) {
+				uint32_t t = rol(a, 5) + ((b & c) | (d & (b | c))) + e + 0x8f1bbcdc + sha1Schedule(w, i);
+				e = d; d = c; c = rol(b, 30); b = a; a = t;
+			}
+			for (int i = 60; i < 80; i++) {
+				uint32_t t = rol(a, 5) + (b ^ c ^ d) + e + 0xca62c1d6 + sha1Schedule(w, i);
+				e = d; d = c; c = rol(b, 30); b = a; a = t;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// SHA-256 (FIPS 180-4)
+
+	const uint32_t kSha256[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	void sha256Portable(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		for (; count > 0; count--, blocks += 64) {
+			uint32_t w[64];
+			for (int i = 0; i < 16; i++) {
+				w[i] = loadBig(blocks + i * 4);
+			}
+			for (int i = 16; i < 64; i++) {
+				uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; i++) {
+				uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + (g ^ (e & (f ^ g))) + kSha256[i] + w[i];
+				uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) | (c & (a | b)));
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+	}
+
+#ifdef VT_HASH_X86
+	///////////////////////////////////////////////////////////////////////////
+	// SHA-NI : four SHA-1 rounds or two SHA-256 rounds per instruction, the
+	// message schedule is computed by dedicated instructions too
+
+	bool cpuHasSha()
+	{
+		unsigned int leaf1[4] = {}, leaf7[4] = {};
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 0);
+		if (regs[0] < 7) {
+			return false;
+		}
+		__cpuid(regs, 1);
+		memcpy(leaf1, regs, sizeof(regs));
+		__cpuidex(regs, 7, 0);
+		memcpy(leaf7, regs, sizeof(regs));
+#else
+		if (__get_cpuid_max(0, nullptr) < 7) {
+			return false;
+		}
+		__get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+		__get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+#endif
+		bool ssse3 = (leaf1[2] & (1u << 9)) != 0;
+		bool sse41 = (leaf1[2] & (1u << 19)) != 0;
+		bool sha = (leaf7[1] & (1u << 29)) != 0;
+		return ssse3 && sse41 && sha;
+	}
+
+	// rounds 4 * group to 4 * group + 3, the round function changes every 20 rounds
+	VT_TARGET_SHA inline __m128i sha1Rounds(__m128i abcd, __m128i e, int group)
+	{
+		switch (group / 5) {
+		case 0: return _mm_sha1rnds4_epu32(abcd, e, 0);
+		case 1: return _mm_sha1rnds4_epu32(abcd, e, 1);
+		case 2: return _mm_sha1rnds4_epu32(abcd, e, 2);
+		default: return _mm_sha1rnds4_epu32(abcd, e, 3);
+		}
+	}
+
+	VT_TARGET_SHA void sha1Hardware(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+		__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+		__m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+		for (; count > 0; count--, blocks += 64) {
+			__m128i abcdSave = abcd;
+			__m128i eSave = e0;
+			__m128i w[4];
+			__m128i previous = abcd;
+
+			for (int group = 0; group < 20; group++) {
+				// W[g] = msg2(msg1(W[g-4], W[g-3]) ^ W[g-2], W[g-1])
+				if (group < 4) {
+					w[group] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + group * 16)), byteSwap);
+				}
+				else {
+					__m128i next = _mm_sha1msg1_epu32(w[group & 3], w[(group + 1) & 3]);
+					next = _mm_xor_si128(next, w[(group + 2) & 3]);
+					w[group & 3] = _mm_sha1msg2_epu32(next, w[(group + 3) & 3]);
+				}
+
+				// E of the group, derived from A of the previous one
+				__m128i e = group == 0 ? _mm_add_epi32(e0, w[0]) : _mm_sha1nexte_epu32(previous, w[group & 3]);
+				previous = abcd;
+				abcd = sha1Rounds(abcd, e, group);
+			}
+
+			e0 = _mm_sha1nexte_epu32(previous, eSave);
+			abcd = _mm_add_epi32(abcd, abcdSave);
+		}
+
+		abcd = _mm_shuffle_epi32(abcd, 0x1B);
+		_mm_storeu_si128((__m128i*)state, abcd);
+		state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+	}
+
+	VT_TARGET_SHA void sha256Hardware(uint32_t* state, const uint8_t* blocks, size_t count)
+	{
+		const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		// the instructions work on the ABEF and CDGH halves of the state
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);	// CDAB
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);	// EFGH
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);		// ABEF
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);			// CDGH
+
+		for (; count > 0; count--, blocks += 64) {
+			__m128i save0 = state0;
+			__m128i save1 = state1;
+			__m128i w[4];
+
+			for (int group = 0; group < 16; group++) {
+				// W[g] = msg2(msg1(W[g-4], W[g-3]) + (W[g-2]:W[g-1] >> 32), W[g-1])
+				if (group < 4) {
+					w[group] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + group * 16)), byteSwap);
+				}
+				else {
+					__m128i next = _mm_sha256msg1_epu32(w[group & 3], w[(group + 1) & 3]);
+					next = _mm_add_epi32(next, _mm_alignr_epi8(w[(group + 3) & 3], w[(group + 2) & 3], 4));
+					w[group & 3] = _mm_sha256msg2_epu32(next, w[(group + 3) & 3]);
+				}
+
+				__m128i msg = _mm_add_epi32(w[group & 3], _mm_loadu_si128((const __m128i*)&kSha256[group * 4]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			}
+
+			state0 = _mm_add_epi32(state0, save0);
+			state1 = _mm_add_epi32(state1, save1);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);				// FEBA
+		state1 = _mm_shuffle_epi32(state1, 0xB1);			// DCHG
+		state0 = _mm_blend_epi16(tmp, state1, 0xF0);		// DCBA
+		state1 = _mm_alignr_epi8(state1, tmp, 8);			// ABEF
+		_mm_storeu_si128((__m128i*)&state[0], state0);
+		_mm_storeu_si128((__m128i*)&state[4], state1);
+	}
+
+	const bool kHardwareSha = cpuHasSha();
+	const BlockFunction sha1Blocks = kHardwareSha ? sha1Hardware : sha1Portable;
+	const BlockFunction sha256Blocks = kHardwareSha ? sha256Hardware : sha256Portable;
+#else
+	const bool kHardwareSha = false;
+	const BlockFunction sha1Blocks = sha1Portable;
+	const BlockFunction sha256Blocks = sha256Portable;
+#endif
+}
+
+VtMultiHash::VtMultiHash(unsigned hashTypes)
+	: types(hashTypes)
+{
+	reset();
+}
+
+bool VtMultiHash::hardwareSha()
+{
+	return kHardwareSha;
+}
+
+void VtMultiHash::reset()
+{
+	static const uint32_t md5Init[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	static const uint32_t sha1Init[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	static const uint32_t sha256Init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(md5, md5Init, sizeof(md5));
+	memcpy(sha1, sha1Init, sizeof(sha1));
+	memcpy(sha256, sha256Init, sizeof(sha256));
+	used = 0;
+	length = 0;
+}
+
+void VtMultiHash::compress(const uint8_t* blocks, size_t count)
+{
+	while (count > 0) {
+		size_t slice = count < VT_HASH_SLICE_BLOCKS ? count : VT_HASH_SLICE_BLOCKS;
+		if (types & VT_HASH_MD5) {
+			md5Blocks(md5, blocks, slice);
+		}
+		if (types & VT_HASH_SHA1) {
+			sha1Blocks(sha1, blocks, slice);
+		}
+		if (types & VT_HASH_SHA256) {
+			sha256Blocks(sha256, blocks, slice);
+		}
+		blocks += slice * 64;
+		count -= slice;
+	}
+}
+
+void VtMultiHash::update(const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	length += size;
+
+	if (used > 0) {
+		size_t take = 64 - used < size ? 64 - used : size;
+		memcpy(block + used, bytes, take);
+		used += take;
+		bytes += take;
+		size -= take;
+		if (used < 64) {
+			return;
+		}
+		compress(block, 1);
+		used = 0;
+	}
+
+	// whole blocks straight from the caller's buffer
+	compress(bytes, size / 64);
+	bytes += size / 64 * 64;
+	used = size % 64;
+	memcpy(block, bytes, used);
+}
+
+void VtMultiHash::final(VtDigests& digests)
+{
+	// 0x80, zeros, then the length in bits : little-endian for MD5,
+	// big-endian for SHA, so the last block is built for each
+	uint64_t bits = length * 8;
+	uint8_t tail[128] = {};
+	memcpy(tail, block, used);
+	tail[used] = 0x80;
+	size_t tailBlocks = used + 1 + 8 <= 64 ? 1 : 2;
+	uint8_t* lengthField = tail + tailBlocks * 64 - 8;
+
+	if (types & VT_HASH_MD5) {
+		for (int i = 0; i < 8; i++) {
+			lengthField[i] = (uint8_t)(bits >> (8 * i));
+		}
+		md5Blocks(md5, tail, tailBlocks);
+		for (int i = 0; i < 4; i++) {
+			storeLittle(digests.md5 + i * 4, md5[i]);
+		}
+	}
+
+	for (int i = 0; i < 8; i++) {
+		lengthField[i] = (uint8_t)(bits >> (56 - 8 * i));
+	}
+	if (types & VT_HASH_SHA1) {
+		sha1Blocks(sha1, tail, tailBlocks);
+		for (int i = 0; i < 5; i++) {
+			storeBig(digests.sha1 + i * 4, sha1[i]);
+		}
+	}
+	if (types & VT_HASH_SHA256) {
+		sha256Blocks(sha256, tail, tailBlocks);
+		for (int i = 0; i < 8; i++) {
+			storeBig(digests.sha256 + i * 4, sha256[i]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Digest keys
+
+const uint8_t* VtDigests::of(VtHashType type) const
+{
+	switch (type) {
+	case VT_HASH_MD5:
+		return md5;
+	case VT_HASH_SHA1:
+		return sha1;
+	case VT_HASH_SHA256:
+		return sha256;
+	}
+	return nullptr;
+}
+
+size_t vtDigestSize(VtHashType type)
+{
+	switch (type) {
+	case VT_HASH_MD5:
+		return VT_MD5_SIZE;
+	case VT_HASH_SHA1:
+		return VT_SHA1_SIZE;
+	case VT_HASH_SHA256:
+		return VT_SHA256_SIZE;
+	}
+	return 0;
+}
+
+const char* vtHashName(VtHashType type)
+{
+	switch (type) {
+	case VT_HASH_MD5:
+		return "MD5";
+	case VT_HASH_SHA1:
+		return "SHA-1";
+	case VT_HASH_SHA256:
+		return "SHA-256";
+	}
+	return "";
+}
+
+void vtDigestKey(VtHashType type, const uint8_t* digest, uint8_t* key)
+{
+	static const uint8_t md5Tag[4] = { 'M', 'D', '5', 0 };
+	static const uint8_t sha256Tag[4] = { 'S', '2', '5', '6' };
+
+	if (type == VT_HASH_SHA1) {
+		memcpy(key, digest, VT_DIGEST_KEY_SIZE);
+		return;
+	}
+	memcpy(key, digest, VT_DIGEST_KEY_SIZE - 4);
+	memcpy(key + VT_DIGEST_KEY_SIZE - 4, type == VT_HASH_MD5 ? md5Tag : sha256Tag, 4);
+}
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - MD5, SHA-1 and SHA-256
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// The three digests of the same data are computed in a single pass : the
+// data goes through the three algorithms by slices small enough to stay in
+// the L1 cache, so each byte is read from memory once.
+// SHA-1 and SHA-256 use the SHA extensions of x86 processors (SHA-NI) when
+// the processor has them, detected once at run time, and a portable version
+// otherwise. MD5 has no such instructions and is always portable.
+// Whatever the type of a digest, it is looked up by a key of 20 bytes : the
+// cache, the journal, the known-hash index and the duplicates of a run keep
+// their fixed-size records.
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#define VT_MD5_SIZE		16
+#define VT_SHA1_SIZE	20
+#define VT_SHA256_SIZE	32
+#define VT_DIGEST_KEY_SIZE	20
+
+// Digests to compute, may be combined
+enum VtHashType {
+	VT_HASH_MD5 = 1,
+	VT_HASH_SHA1 = 2,
+	VT_HASH_SHA256 = 4
+};
+
+struct VtDigests {
+	uint8_t md5[VT_MD5_SIZE];
+	uint8_t sha1[VT_SHA1_SIZE];
+	uint8_t sha256[VT_SHA256_SIZE];
+
+	// digest of one type, nullptr for a combination
+	const uint8_t* of(VtHashType type) const;
+};
+
+// Bytes of a digest, 0 for a combination
+size_t vtDigestSize(VtHashType type);
+
+// "MD5", "SHA-1" or "SHA-256"
+const char* vtHashName(VtHashType type);
+
+// Key of a digest : a SHA-1 is its own key, so the files built with SHA-1
+// keys stay valid, an MD5 or a SHA-256 is cut to 16 bytes and followed by a
+// 4 bytes tag of its type. The key starts with digest bytes, as uniform as
+// the digest itself.
+void vtDigestKey(VtHashType type, const uint8_t* digest, uint8_t* key);
+
+class VtMultiHash {
+public:
+	// types : VtHashType flags
+	explicit VtMultiHash(unsigned types);
+
+	void reset();
+	void update(const void* data, size_t size);
+
+	// Digests of the types asked for, the others are left untouched
+	// reset() before hashing other data
+	void final(VtDigests& digests);
+
+	// SHA-NI kernels in use
+	static bool hardwareSha();
+
+private:
+	void compress(const uint8_t* blocks, size_t count);
+
+	unsigned types;
+	uint32_t md5[4];
+	uint32_t sha1[5];
+	uint32_t sha256[8];
+	uint8_t block[64];	// bytes waiting for a full block
+	size_t used;
+	uint64_t length;	// bytes hashed
+};
@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - in-run hash index
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtHashIndex.h"
+#include <cstring>
+
+using namespace std;
+
+VtHashIndex::VtHashIndex()
+	: count(0)
+{
+}
+
+void VtHashIndex::clear()
+{
+	slots.clear();
+	count = 0;
+}
+
+// Linear probing from the first 8 bytes of the digest, like the verdict cache
+// Returns the slot holding the digest or the free slot where it belongs
+size_t VtHashIndex::findSlot(const unsigned char* digest) const
+{
+	uint64_t key;
+	memcpy(&key, digest, sizeof(key));
+
+	size_t mask = slots.size() - 1;
+	size_t i = (size_t)(key & mask);
+	while (slots[i].used && memcmp(slots[i].digest, digest, VT_INDEX_KEY_SIZE) != 0) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void VtHashIndex::grow()
+{
+	vector<Slot> old;
+	old.swap(slots);
+	slots.resize(old.empty() ? VT_INDEX_MIN_SLOTS : old.size() * 2);
+
+	for (const Slot& slot : old) {
+		if (slot.used) {
+			slots[findSlot(slot.digest)] = slot;
+		}
+	}
+}
+
+size_t VtHashIndex::insert(const unsigned char* digest, size_t value, bool& inserted)
+{
+	// keep the load factor under 75%
+	if ((count + 1) * 4 > slots.size() * 3) {
+		grow();
+	}
+
+	Slot& slot = slots[findSlot(digest)];
+	inserted = !slot.used;
+	if (inserted) {
+		memcpy(slot.digest, digest, VT_INDEX_KEY_SIZE);
+		slot.used = true;
+		slot.value = value;
+		count++;
+	}
+	return slot.value;
+}
+
+bool VtHashIndex::find(const unsigned char* digest, size_t& value) const
+{
+	if (slots.empty()) {
+		return false;
+	}
+
+	const Slot& slot = slots[findSlot(digest)];
+	if (!slot.used) {
+		return false;
+	}
+	value = slot.value;
+	return true;
+}
@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - in-run hash index
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Open addressing table mapping a digest to a number (index of the queued
+// hash). It only lives for one run and is used to send each distinct hash
+// once, whatever the number of items sharing it.
+
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define VT_INDEX_KEY_SIZE	20 // SHA-1
+#define VT_INDEX_MIN_SLOTS	1024 // must be a power of 2
+
+class VtHashIndex {
+public:
+	VtHashIndex();
+
+	void clear();
+	size_t size() const { return count; }
+
+	// Returns the value of the digest, adding it with value if it is not there
+	// inserted tells whether the digest was added
+	size_t insert(const unsigned char* digest, size_t value, bool& inserted);
+
+	bool find(const unsigned char* digest, size_t& value) const;
+
+private:
+	struct Slot {
+		unsigned char digest[VT_INDEX_KEY_SIZE];
+		bool used;
+		size_t value;
+	};
+
+	size_t findSlot(const unsigned char* digest) const;
+	void grow();
+
+	std::vector<Slot> slots;
+	size_t count;
+};
@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - background hashing
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtHasher.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+VtHasher::VtHasher()
+	: reader(nullptr), types(0), busy(0), stopping(true)
+{
+}
+
+VtHasher::~VtHasher()
+{
+	stop();
+}
+
+bool VtHasher::start(VtItemReader* itemReader, unsigned threads, unsigned hashTypes)
+{
+	stop();
+
+	if (itemReader == nullptr || threads == 0 || hashTypes == 0) {
+		return false;
+	}
+
+	reader = itemReader;
+	types = hashTypes;
+	stopping = false;
+	busy = 0;
+	queue.clear();
+	done.clear();
+
+	for (unsigned i = 0; i < min(threads, (unsigned)VT_HASHER_MAX_THREADS); i++) {
+		workers.push_back(thread(&VtHasher::run, this));
+	}
+	return true;
+}
+
+void VtHasher::stop()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+		queue.clear();
+	}
+	wake.notify_all();
+
+	for (thread& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+
+	lock_guard<mutex> guard(lock);
+	busy = 0;
+	finished.notify_all();
+}
+
+void VtHasher::submit(long itemID, long long size)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		if (stopping) {
+			return;
+		}
+		Job job;
+		job.itemID = itemID;
+		job.size = size;
+		queue.push_back(job);
+	}
+	wake.notify_one();
+}
+
+bool VtHasher::collect(vector<VtHashResult>& out, unsigned timeout)
+{
+	unique_lock<mutex> guard(lock);
+	bool working = !stopping && (busy > 0 || !queue.empty());
+	if (done.empty() && working) {
+		finished.wait_for(guard, milliseconds(timeout), [this] { return !done.empty(); });
+	}
+
+	bool more = !done.empty() || (!stopping && (busy > 0 || !queue.empty()));
+	out.insert(out.end(), done.begin(), done.end());
+	done.clear();
+	return more;
+}
+
+size_t VtHasher::pending()
+{
+	lock_guard<mutex> guard(lock);
+	return queue.size() + busy;
+}
+
+void VtHasher::run()
+{
+	// one buffer and one hash state per worker, reused from item to item
+	vector<unsigned char> buffer(VT_HASHER_CHUNK);
+	VtMultiHash digests(types);
+
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		wake.wait(guard, [this] { return stopping || !queue.empty(); });
+		if (stopping) {
+			return;
+		}
+
+		Job job = queue.front();
+		queue.pop_front();
+		busy++;
+
+		guard.unlock();
+		VtHashResult result = hash(job, digests, buffer);
+		guard.lock();
+
+		busy--;
+		if (stopping) {
+			return;
+		}
+		done.push_back(result);
+		finished.notify_all();
+	}
+}
+
+VtHashResult VtHasher::hash(const Job& job, VtMultiHash& digests, vector<unsigned char>& buffer)
+{
+	steady_clock::time_point started = steady_clock::now();
+	VtHashResult result = {};
+	result.itemID = job.itemID;
+
+	void* item = reader->open(job.itemID);
+	if (item == nullptr) {
+		result.seconds = duration<double>(steady_clock::now() - started).count();
+		return result;
+	}
+
+	digests.reset();
+	long long offset = 0;
+	// a cancelled run does not wait for the end of large items
+	bool cancelled = false;
+	while (job.size < 0 || offset < job.size) {
+		if (stopping) {
+			cancelled = true;
+			break;
+		}
+		unsigned wanted = (unsigned)buffer.size();
+		if (job.size >= 0) {
+			wanted = (unsigned)min<long long>(wanted, job.size - offset);
+		}
+		unsigned read = reader->read(item, offset, buffer.data(), wanted);
+		if (read == 0) {
+			break;
+		}
+		digests.update(buffer.data(), read);
+		offset += read;
+	}
+	reader->close(item);
+
+	// an item shorter than announced is a read error, not a digest to look up
+	result.ok = !cancelled && (job.size < 0 || offset == job.size);
+	result.bytes = offset;
+	digests.final(result.digests);
+	result.seconds = duration<double>(steady_clock::now() - started).count();
+	return result;
+}
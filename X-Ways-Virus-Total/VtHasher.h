@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - background hashing
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// When the volume snapshot has no hash for an item, XWF_GetHashValue
+// computes it inside the call, one item at a time on one core. The items are
+// handed over to a pool of worker threads instead : each one opens the items
+// on its own handle, reads them by large chunks and computes their digests in
+// one pass (VtMultiHash) while X-Ways goes on with the next items and the
+// lookups of the items already hashed run in the background.
+// The results are collected from the X-Ways thread, like the responses of
+// VtEngine : the workers never call anything else than the reader.
+
+#pragma once
+#include "VtHash.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define VT_HASHER_CHUNK			(1 << 20) // bytes read at once
+#define VT_HASHER_MAX_THREADS	64
+
+// How the workers read the items : XWF_OpenItem / XWF_Read / XWF_Close in
+// X-Ways. Called from several threads at once, each item on its own handle.
+class VtItemReader {
+public:
+	virtual ~VtItemReader() {}
+
+	// nullptr if the item cannot be opened
+	virtual void* open(long itemID) = 0;
+
+	// Bytes read at offset, 0 at the end of the item or on error
+	virtual unsigned read(void* item, long long offset, unsigned char* buffer, unsigned size) = 0;
+
+	virtual void close(void* item) = 0;
+};
+
+struct VtHashResult {
+	long itemID;
+	bool ok;			// false if the item could not be opened, was cut short or the hasher stopped
+	long long bytes;	// bytes hashed
+	double seconds;		// open, read and hash
+	VtDigests digests;
+};
+
+class VtHasher {
+public:
+	VtHasher();
+	~VtHasher();
+
+	// threads : workers, types : VtHashType flags of the digests computed
+	bool start(VtItemReader* reader, unsigned threads, unsigned types);
+
+	// Stops the workers, the items not hashed yet are dropped
+	void stop();
+	bool isStarted() const { return !workers.empty(); }
+	unsigned threadCount() const { return (unsigned)workers.size(); }
+
+	// size : bytes expected, -1 = read up to the end of the item
+	// Ignored when the hasher is not started
+	void submit(long itemID, long long size);
+
+	// Moves the finished items to out, blocks up to timeout milliseconds
+	// when none is ready. Returns false once nothing is queued or being hashed
+	bool collect(std::vector<VtHashResult>& out, unsigned timeout);
+
+	// Items queued or being hashed
+	size_t pending();
+
+private:
+	struct Job {
+		long itemID;
+		long long size;
+	};
+
+	void run();
+
+	VtHashResult hash(const Job& job, VtMultiHash& digests, std::vector<unsigned char>& buffer);
+
+	VtItemReader* reader;
+	unsigned types;
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;		// new item or stop
+	std::condition_variable finished;	// new result
+	std::deque<Job> queue;
+	std::vector<VtHashResult> done;
+	size_t busy;						// items being hashed
+	std::atomic<bool> stopping;			// also read by the workers between chunks
+};
@@ -0,0 +1,276 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - resume journal
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtJournal.h"
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	const uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+	const uint64_t kFnvPrime = 0x100000001b3ULL;
+
+	uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * kFnvPrime;
+		}
+		return hash;
+	}
+}
+
+VtJournal::VtJournal()
+	:
+#ifdef _WIN32
+	hFile(INVALID_HANDLE_VALUE),
+#else
+	fd(-1),
+#endif
+	replayedCount(0)
+{
+}
+
+VtJournal::~VtJournal()
+{
+	close();
+}
+
+bool VtJournal::isOpen() const
+{
+#ifdef _WIN32
+	return hFile != INVALID_HANDLE_VALUE;
+#else
+	return fd >= 0;
+#endif
+}
+
+uint32_t VtJournal::checksum(const VtJournalRecord& record)
+{
+	uint64_t hash = fnv1a(kFnvOffset, &record, offsetof(VtJournalRecord, checksum));
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint64_t VtJournal::volumeId(const wstring& name, int64_t size)
+{
+	uint64_t hash = kFnvOffset;
+	for (wchar_t c : name) {
+		uint16_t unit = (uint16_t)c;
+		hash = fnv1a(hash, &unit, sizeof(unit));
+	}
+	return fnv1a(hash, &size, sizeof(size));
+}
+
+string VtJournal::pathFor(const string& prefix, uint64_t volumeId)
+{
+	char id[17];
+	snprintf(id, sizeof(id), "%016llx", (unsigned long long)volumeId);
+	return prefix + "-" + id + ".vtj";
+}
+
+bool VtJournal::open(const string& journalPath, uint64_t volumeId)
+{
+	close();
+	path = journalPath;
+
+#ifdef _WIN32
+	hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#else
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+#endif
+	if (!isOpen()) {
+		return false;
+	}
+
+	// anything unreadable : the journal of another volume, another version,
+	// a header torn on creation. The items are looked up again.
+	if (!readBack(volumeId) && !start(volumeId)) {
+		close();
+		return false;
+	}
+	lastSync = steady_clock::now();
+	return true;
+}
+
+// Reads the records back, the file is cut after the last intact one and
+// left positioned there for the next appends
+bool VtJournal::readBack(uint64_t volumeId)
+{
+	records.clear();
+	replayedCount = 0;
+
+	VtJournalHeader header = {};
+	vector<char> content;
+#ifdef _WIN32
+	LARGE_INTEGER size = {};
+	GetFileSizeEx(hFile, &size);
+	content.resize((size_t)size.QuadPart);
+	DWORD read = 0;
+	if (!content.empty() && (!ReadFile(hFile, content.data(), (DWORD)content.size(), &read, NULL) || read != content.size())) {
+		return false;
+	}
+#else
+	struct stat st = {};
+	fstat(fd, &st);
+	content.resize((size_t)st.st_size);
+	if (!content.empty() && pread(fd, content.data(), content.size(), 0) != (ssize_t)content.size()) {
+		return false;
+	}
+#endif
+	if (content.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, content.data(), sizeof(header));
+	if (header.magic != VT_JOURNAL_MAGIC || header.version != VT_JOURNAL_VERSION || header.volumeId != volumeId) {
+		return false;
+	}
+
+	// the last record of an item wins, items are only journaled once per run
+	size_t end = sizeof(header);
+	while (end + sizeof(VtJournalRecord) <= content.size()) {
+		VtJournalRecord record;
+		memcpy(&record, content.data() + end, sizeof(record));
+		if (record.checksum != checksum(record)) {
+			break;
+		}
+		records[record.itemID] = record;
+		replayedCount++;
+		end += sizeof(record);
+	}
+
+#ifdef _WIN32
+	LARGE_INTEGER position = {};
+	position.QuadPart = (LONGLONG)end;
+	return SetFilePointerEx(hFile, position, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+#else
+	return ftruncate(fd, (off_t)end) == 0 && lseek(fd, (off_t)end, SEEK_SET) == (off_t)end;
+#endif
+}
+
+// Empties the file and writes a new header
+bool VtJournal::start(uint64_t volumeId)
+{
+	records.clear();
+	replayedCount = 0;
+
+	VtJournalHeader header = {};
+	header.magic = VT_JOURNAL_MAGIC;
+	header.version = VT_JOURNAL_VERSION;
+	header.volumeId = volumeId;
+
+#ifdef _WIN32
+	LARGE_INTEGER start = {};
+	DWORD written = 0;
+	return SetFilePointerEx(hFile, start, NULL, FILE_BEGIN) && SetEndOfFile(hFile)
+		&& WriteFile(hFile, &header, sizeof(header), &written, NULL) && written == sizeof(header)
+		&& FlushFileBuffers(hFile);
+#else
+	return ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0
+		&& write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+		&& fsync(fd) == 0;
+#endif
+}
+
+void VtJournal::close()
+{
+	if (isOpen()) {
+		sync();
+#ifdef _WIN32
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+#else
+		::close(fd);
+		fd = -1;
+#endif
+	}
+	records.clear();
+	buffer.clear();
+	replayedCount = 0;
+}
+
+bool VtJournal::lookup(long itemID, const unsigned char* digest, VtJournalRecord& record) const
+{
+	auto found = records.find((int32_t)itemID);
+	if (found == records.end() || memcmp(found->second.digest, digest, VT_JOURNAL_DIGEST_SIZE) != 0) {
+		return false;
+	}
+	record = found->second;
+	return true;
+}
+
+void VtJournal::append(long itemID, const unsigned char* digest, int responseCode,
+	int positives, int total, int64_t scanDate)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	VtJournalRecord record = {};
+	record.itemID = (int32_t)itemID;
+	memcpy(record.digest, digest, VT_JOURNAL_DIGEST_SIZE);
+	record.responseCode = (int8_t)responseCode;
+	record.positives = (uint16_t)positives;
+	record.total = (uint16_t)total;
+	record.scanDate = scanDate;
+	record.checksum = checksum(record);
+	buffer.push_back(record);
+
+	if (buffer.size() >= VT_JOURNAL_SYNC_RECORDS) {
+		sync();
+	}
+}
+
+void VtJournal::tick()
+{
+	if (!buffer.empty() && steady_clock::now() - lastSync >= milliseconds(VT_JOURNAL_SYNC_MS)) {
+		sync();
+	}
+}
+
+bool VtJournal::sync()
+{
+	lastSync = steady_clock::now();
+	if (buffer.empty() || !isOpen()) {
+		return true;
+	}
+
+	size_t bytes = buffer.size() * sizeof(VtJournalRecord);
+#ifdef _WIN32
+	DWORD written = 0;
+	bool ok = WriteFile(hFile, buffer.data(), (DWORD)bytes, &written, NULL) && written == bytes
+		&& FlushFileBuffers(hFile);
+#else
+	bool ok = write(fd, buffer.data(), bytes) == (ssize_t)bytes && fsync(fd) == 0;
+#endif
+	buffer.clear();
+	return ok;
+}
+
+void VtJournal::discard()
+{
+	if (!isOpen()) {
+		return;
+	}
+	buffer.clear();
+	close();
+#ifdef _WIN32
+	DeleteFileA(path.c_str());
+#else
+	unlink(path.c_str());
+#endif
+}
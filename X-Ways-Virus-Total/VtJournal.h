@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - resume journal
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Every verdict received from VirusTotal is appended to a journal kept per
+// volume (<journal>-<volume id>.vtj). When a run is interrupted (X-Ways
+// closed, crash, power cut), the next run on the same volume reads the
+// journal back and gives the items already looked up their verdict without
+// sending anything. The journal is deleted once a run completes.
+// The file is a header followed by fixed-size records, each one with its own
+// checksum : a record torn by the interruption is cut off when the journal is
+// opened again. The records are buffered and written by groups, each group
+// flushed to the disk (FlushFileBuffers / fsync) : an interruption loses at
+// most the last group, whose items are simply looked up again.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+#define VT_JOURNAL_MAGIC		0x4A4A5456 // "VTJJ"
+#define VT_JOURNAL_VERSION		1
+#define VT_JOURNAL_DIGEST_SIZE	20 // SHA-1
+#define VT_JOURNAL_SYNC_RECORDS	256 // records buffered before a flush to disk
+#define VT_JOURNAL_SYNC_MS		2000
+
+#pragma pack(push)
+#pragma pack(1)
+struct VtJournalHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t volumeId;	// VtJournal::volumeId of the volume
+	uint8_t reserved[48];
+};
+
+struct VtJournalRecord {
+	int32_t itemID;
+	uint8_t digest[VT_JOURNAL_DIGEST_SIZE];	// hash sent, the record is ignored if the item changed
+	int8_t responseCode;	// VirusTotal response_code (1 = known file, 0 = unknown)
+	uint8_t reserved;
+	uint16_t positives;
+	uint16_t total;
+	uint16_t reserved2;
+	int64_t scanDate;		// VirusTotal scan_date, seconds since 1970 (UTC)
+	uint32_t reserved3;
+	uint32_t checksum;		// FNV-1a of the bytes above
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VtJournalHeader) == 64, "VtJournalHeader must stay 64 bytes");
+static_assert(sizeof(VtJournalRecord) == 48, "VtJournalRecord must stay 48 bytes");
+
+class VtJournal {
+public:
+	VtJournal();
+	~VtJournal();
+
+	// Opens the journal of a volume, or creates it, and reads its records back
+	// A journal written for another volume is started again
+	bool open(const std::string& path, uint64_t volumeId);
+
+	// Writes and flushes the buffered records
+	void close();
+	bool isOpen() const;
+
+	// Records read back when the journal was opened
+	size_t replayed() const { return replayedCount; }
+
+	// Verdict of an earlier run for this item, unless its hash changed since
+	bool lookup(long itemID, const unsigned char* digest, VtJournalRecord& record) const;
+
+	// Adds the verdict of an item, flushed with the next group
+	void append(long itemID, const unsigned char* digest, int responseCode,
+		int positives, int total, int64_t scanDate);
+
+	// Flushes the buffered records once VT_JOURNAL_SYNC_MS have passed
+	void tick();
+
+	// Writes the buffered records and waits until they are on the disk
+	bool sync();
+
+	// Closes and deletes the journal, once every item got its verdict
+	void discard();
+
+	// Identity of a volume : its name as shown by X-Ways and its size
+	static uint64_t volumeId(const std::wstring& name, int64_t size);
+
+	// <prefix>-<volume id in hex>.vtj
+	static std::string pathFor(const std::string& prefix, uint64_t volumeId);
+
+private:
+	static uint32_t checksum(const VtJournalRecord& record);
+
+	bool readBack(uint64_t volumeId);
+	bool start(uint64_t volumeId);
+
+	std::string path;
+#ifdef _WIN32
+	void* hFile;
+#else
+	int fd;
+#endif
+	std::unordered_map<int32_t, VtJournalRecord> records; // by item
+	size_t replayedCount;
+	std::vector<VtJournalRecord> buffer;
+	std::chrono::steady_clock::time_point lastSync;
+};
@@ -0,0 +1,309 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - JSON scanner
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtJson.h"
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	int hexDigit(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// 4 hex digits of a \u escape, -1 if malformed
+	long readCodeUnit(const char* p, const char* end)
+	{
+		if (end - p < 4) {
+			return -1;
+		}
+		long unit = 0;
+		for (int i = 0; i < 4; i++) {
+			int digit = hexDigit(p[i]);
+			if (digit < 0) {
+				return -1;
+			}
+			unit = unit * 16 + digit;
+		}
+		return unit;
+	}
+
+	void appendUtf8(string& out, unsigned long cp)
+	{
+		if (cp < 0x80) {
+			out += (char)cp;
+		}
+		else if (cp < 0x800) {
+			out += (char)(0xC0 | (cp >> 6));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000) {
+			out += (char)(0xE0 | (cp >> 12));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else {
+			out += (char)(0xF0 | (cp >> 18));
+			out += (char)(0x80 | ((cp >> 12) & 0x3F));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+	}
+}
+
+bool VtJsonSpan::equals(const char* text) const
+{
+	return strlen(text) == size && memcmp(data, text, size) == 0;
+}
+
+VtJsonScanner::VtJsonScanner(const char* data, size_t size)
+	: cur(data), end(data + size), error(false), first(true)
+{
+}
+
+bool VtJsonScanner::fail()
+{
+	error = true;
+	cur = end;
+	return false;
+}
+
+char VtJsonScanner::peek()
+{
+	while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')) {
+		cur++;
+	}
+	return cur < end ? *cur : '\0';
+}
+
+bool VtJsonScanner::expect(char c)
+{
+	if (peek() != c) {
+		return fail();
+	}
+	cur++;
+	return true;
+}
+
+bool VtJsonScanner::literal(const char* text)
+{
+	size_t len = strlen(text);
+	if ((size_t)(end - cur) < len || memcmp(cur, text, len) != 0) {
+		return fail();
+	}
+	cur += len;
+	first = false;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Containers
+
+bool VtJsonScanner::beginObject()
+{
+	first = true;
+	return expect('{');
+}
+
+bool VtJsonScanner::beginArray()
+{
+	first = true;
+	return expect('[');
+}
+
+// Consumes the closing bracket, the container then counts as a value read
+bool VtJsonScanner::containerEnd(char close)
+{
+	char c = peek();
+	if (c == close) {
+		cur++;
+		first = false;
+		return true;
+	}
+	if (c == '\0' || (!first && !expect(','))) {
+		fail();
+		return true;
+	}
+	first = false;
+	return false;
+}
+
+bool VtJsonScanner::nextKey(VtJsonSpan& key)
+{
+	if (error || containerEnd('}')) {
+		return false;
+	}
+	return readString(key) && expect(':');
+}
+
+bool VtJsonScanner::nextElement()
+{
+	return !error && !containerEnd(']');
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Values
+
+bool VtJsonScanner::readString(VtJsonSpan& raw)
+{
+	if (!expect('"')) {
+		return false;
+	}
+
+	const char* start = cur;
+	while (cur < end && *cur != '"') {
+		if (*cur == '\\') {
+			cur++;
+		}
+		cur++;
+	}
+	if (cur >= end) {
+		return fail();
+	}
+
+	raw.data = start;
+	raw.size = cur - start;
+	cur++;
+	first = false;
+	return true;
+}
+
+bool VtJsonScanner::readInt(long long& value)
+{
+	char c = peek();
+	bool negative = c == '-';
+	if (negative) {
+		cur++;
+	}
+	if (cur >= end || *cur < '0' || *cur > '9') {
+		return fail();
+	}
+
+	value = 0;
+	while (cur < end && *cur >= '0' && *cur <= '9') {
+		value = value * 10 + (*cur - '0');
+		cur++;
+	}
+	if (negative) {
+		value = -value;
+	}
+
+	// fraction and exponent are not needed
+	while (cur < end && (*cur == '.' || *cur == 'e' || *cur == 'E' || *cur == '+' || *cur == '-'
+		|| (*cur >= '0' && *cur <= '9'))) {
+		cur++;
+	}
+	first = false;
+	return true;
+}
+
+bool VtJsonScanner::readBool(bool& value)
+{
+	value = peek() == 't';
+	return literal(value ? "true" : "false");
+}
+
+bool VtJsonScanner::readNull()
+{
+	return peek() == 'n' && literal("null");
+}
+
+bool VtJsonScanner::skipValue()
+{
+	char c = peek();
+	if (c == '"') {
+		VtJsonSpan ignored;
+		return readString(ignored);
+	}
+	if (c == 't' || c == 'f') {
+		bool ignored;
+		return readBool(ignored);
+	}
+	if (c == 'n') {
+		return readNull();
+	}
+	if (c != '{' && c != '[') {
+		long long ignored;
+		return readInt(ignored);
+	}
+
+	// containers : only the brackets and the strings matter
+	int depth = 0;
+	do {
+		c = peek();
+		if (c == '"') {
+			VtJsonSpan ignored;
+			if (!readString(ignored)) {
+				return false;
+			}
+			continue;
+		}
+		if (c == '\0') {
+			return fail();
+		}
+		if (c == '{' || c == '[') {
+			depth++;
+		}
+		else if (c == '}' || c == ']') {
+			depth--;
+		}
+		cur++;
+	} while (depth > 0);
+
+	first = false;
+	return true;
+}
+
+string VtJsonScanner::unescape(const VtJsonSpan& raw)
+{
+	string out;
+	out.reserve(raw.size);
+
+	const char* p = raw.data;
+	const char* stop = raw.data + raw.size;
+	while (p < stop) {
+		if (*p != '\\' || p + 1 >= stop) {
+			out += *p++;
+			continue;
+		}
+
+		char escape = p[1];
+		p += 2;
+		switch (escape) {
+		case 'b': out += '\b'; break;
+		case 'f': out += '\f'; break;
+		case 'n': out += '\n'; break;
+		case 'r': out += '\r'; break;
+		case 't': out += '\t'; break;
+		case 'u': {
+			long unit = readCodeUnit(p, stop);
+			if (unit < 0) {
+				out += '?';
+				break;
+			}
+			p += 4;
+
+			unsigned long cp = (unsigned long)unit;
+			// surrogate pair
+			if (unit >= 0xD800 && unit <= 0xDBFF && stop - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+				long low = readCodeUnit(p + 2, stop);
+				if (low >= 0xDC00 && low <= 0xDFFF) {
+					cp = 0x10000 + (((unsigned long)unit - 0xD800) << 10) + ((unsigned long)low - 0xDC00);
+					p += 6;
+				}
+			}
+			appendUtf8(out, cp);
+			break;
+		}
+		default: out += escape; break; // \" \\ \/
+		}
+	}
+	return out;
+}
@@ -0,0 +1,60 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - JSON scanner
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Pull scanner working in place on the response buffer : no DOM is built,
+// values are handed out as spans of the buffer and the fields that are not
+// needed (per-engine scans...) are skipped without being decoded.
+
+#pragma once
+#include <string>
+#include <cstddef>
+
+// Part of the scanned buffer
+struct VtJsonSpan {
+	const char* data;
+	size_t size;
+
+	bool equals(const char* text) const;
+};
+
+class VtJsonScanner {
+public:
+	VtJsonScanner(const char* data, size_t size);
+
+	// Position in the buffer, used to cut a value out of it
+	const char* position() const { return cur; }
+	bool failed() const { return error; }
+
+	// Next significant character, '\0' at the end of the buffer
+	char peek();
+
+	// Object / array walking
+	//   beginObject(); while (nextKey(key)) { ...read or skip the value... }
+	//   beginArray(); while (nextElement()) { ...read or skip the element... }
+	bool beginObject();
+	bool nextKey(VtJsonSpan& key);
+	bool beginArray();
+	bool nextElement();
+
+	// Values, skipValue() steps over any value, nested ones included
+	bool readString(VtJsonSpan& raw);	// raw content between the quotes, escapes kept
+	bool readInt(long long& value);		// integral part of a number
+	bool readBool(bool& value);
+	bool readNull();
+	bool skipValue();
+
+	// Decodes the escapes of a string span (\n, \", \uXXXX...) into UTF-8
+	static std::string unescape(const VtJsonSpan& raw);
+
+private:
+	bool fail();
+	bool expect(char c);
+	bool literal(const char* text);
+	bool containerEnd(char close);
+
+	const char* cur;
+	const char* end;
+	bool error;
+	bool first;	// no comma expected before the next key / element
+};
@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - API key pool
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtKeyPool.h"
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+
+VtKeyPool::VtKeyPool()
+{
+}
+
+void VtKeyPool::add(const string& name, const string& apiKey, bool publicKey,
+	int perMinute, int perDay, int perMonth, const string& quotaFile)
+{
+	unique_ptr<Key> key(new Key());
+	key->name = name;
+	key->apiKey = apiKey;
+	key->publicKey = publicKey;
+	key->state = VT_KEY_ACTIVE;
+	key->backoffs = 0;
+	key->sent = 0;
+	key->refused = 0;
+	key->scheduler.configure(perMinute, perDay, perMonth);
+	key->scheduler.load(quotaFile);
+
+	lock_guard<mutex> guard(lock);
+	keys.push_back(move(key));
+}
+
+void VtKeyPool::clear()
+{
+	lock_guard<mutex> guard(lock);
+	keys.clear();
+}
+
+size_t VtKeyPool::size()
+{
+	lock_guard<mutex> guard(lock);
+	return keys.size();
+}
+
+size_t VtKeyPool::available()
+{
+	lock_guard<mutex> guard(lock);
+	size_t count = 0;
+	for (const unique_ptr<Key>& key : keys) {
+		count += key->state == VT_KEY_ACTIVE;
+	}
+	return count;
+}
+
+VtGrant VtKeyPool::reserve(size_t& chosen, unsigned& waitMs)
+{
+	lock_guard<mutex> guard(lock);
+	waitMs = 0;
+
+	// usable keys, the one with the most tokens left first
+	vector<pair<int, size_t>> candidates;
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (keys[i]->state == VT_KEY_ACTIVE) {
+			candidates.push_back(make_pair(keys[i]->scheduler.remaining(), i));
+		}
+	}
+	stable_sort(candidates.begin(), candidates.end(),
+		[](const pair<int, size_t>& a, const pair<int, size_t>& b) { return a.first > b.first; });
+
+	unsigned shortest = UINT_MAX;
+	for (const pair<int, size_t>& candidate : candidates) {
+		Key& key = *keys[candidate.second];
+		unsigned keyWait = 0;
+		VtGrant grant = key.scheduler.reserve(keyWait);
+		if (grant == VT_GRANTED) {
+			key.sent++;
+			chosen = candidate.second;
+			return VT_GRANTED;
+		}
+		if (grant == VT_WAIT) {
+			shortest = min(shortest, keyWait);
+		}
+		else {
+			key.state = VT_KEY_EXHAUSTED;
+		}
+	}
+
+	if (shortest == UINT_MAX) {
+		return VT_EXHAUSTED;
+	}
+	waitMs = shortest;
+	return VT_WAIT;
+}
+
+string VtKeyPool::apiKey(size_t key)
+{
+	lock_guard<mutex> guard(lock);
+	return key < keys.size() ? keys[key]->apiKey : string();
+}
+
+string VtKeyPool::name(size_t key)
+{
+	lock_guard<mutex> guard(lock);
+	return key < keys.size() ? keys[key]->name : string();
+}
+
+void VtKeyPool::answered(size_t key)
+{
+	lock_guard<mutex> guard(lock);
+	if (key < keys.size()) {
+		keys[key]->backoffs = 0;
+	}
+}
+
+// Several refusals in a row mean the quota is used up on VirusTotal's side
+void VtKeyPool::refused(size_t key)
+{
+	lock_guard<mutex> guard(lock);
+	if (key >= keys.size()) {
+		return;
+	}
+	Key& refusedKey = *keys[key];
+	refusedKey.refused++;
+	refusedKey.scheduler.backoff();
+	if (++refusedKey.backoffs >= VT_MAX_BACKOFF && refusedKey.state == VT_KEY_ACTIVE) {
+		refusedKey.state = VT_KEY_EXHAUSTED;
+	}
+}
+
+void VtKeyPool::denied(size_t key)
+{
+	lock_guard<mutex> guard(lock);
+	if (key < keys.size()) {
+		keys[key]->state = VT_KEY_DENIED;
+	}
+}
+
+void VtKeyPool::save()
+{
+	lock_guard<mutex> guard(lock);
+	for (const unique_ptr<Key>& key : keys) {
+		key->scheduler.save();
+	}
+}
+
+vector<VtKeyUsage> VtKeyPool::usage()
+{
+	lock_guard<mutex> guard(lock);
+	vector<VtKeyUsage> usages;
+	for (const unique_ptr<Key>& key : keys) {
+		VtKeyUsage usage;
+		usage.name = key->name;
+		usage.publicKey = key->publicKey;
+		usage.state = key->state;
+		usage.sent = key->sent;
+		usage.refused = key->refused;
+		usage.usedToday = key->scheduler.usedToday();
+		usage.perDay = key->scheduler.perDay();
+		usage.usedThisMonth = key->scheduler.usedThisMonth();
+		usage.perMonth = key->scheduler.perMonth();
+		usages.push_back(usage);
+	}
+	return usages;
+}
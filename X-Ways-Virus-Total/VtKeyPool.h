@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - API key pool
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Several VirusTotal keys used side by side, each one with its own quotas
+// (a VtScheduler and its quota file). Every request goes to the key with the
+// most tokens left, so four public keys give four times the throughput.
+// A key refused with HTTP 403 is dropped for the rest of the run, a key
+// refused with HTTP 204 too many times in a row is left alone until the next
+// run, the other keys carry on.
+
+#pragma once
+#include "VtScheduler.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+// Consecutive HTTP 204 answers before a key is considered used up
+#define VT_MAX_BACKOFF	5
+
+enum VtKeyState {
+	VT_KEY_ACTIVE,
+	VT_KEY_EXHAUSTED,	// quota used up, locally or on VirusTotal's side
+	VT_KEY_DENIED		// HTTP 403, invalid or revoked key
+};
+
+// Usage of a key, for the end of run report
+struct VtKeyUsage {
+	std::string name;
+	bool publicKey;
+	VtKeyState state;
+	size_t sent;		// requests sent during the run
+	size_t refused;		// HTTP 204 answers
+	int usedToday;
+	int perDay;
+	int usedThisMonth;
+	int perMonth;
+};
+
+class VtKeyPool {
+public:
+	VtKeyPool();
+
+	// Adds a key, its day / month usage is read from quotaFile
+	void add(const std::string& name, const std::string& apiKey, bool publicKey,
+		int perMinute, int perDay, int perMonth, const std::string& quotaFile);
+	void clear();
+	size_t size();
+
+	// Keys still usable
+	size_t available();
+
+	// Picks the key with the most tokens left and reserves one request on it
+	// VT_WAIT : every usable key is at its minute quota, waitMs receives the
+	// shortest delay ; VT_EXHAUSTED : no usable key left
+	VtGrant reserve(size_t& key, unsigned& waitMs);
+
+	std::string apiKey(size_t key);
+	std::string name(size_t key);
+
+	// Outcome of a request sent with a key
+	void answered(size_t key);
+	void refused(size_t key);	// HTTP 204 : the key pauses for one minute
+	void denied(size_t key);	// HTTP 403 : the key is dropped
+
+	// Saves the day / month usage of every key
+	void save();
+
+	std::vector<VtKeyUsage> usage();
+
+private:
+	struct Key {
+		std::string name;
+		std::string apiKey;
+		bool publicKey;
+		VtKeyState state;
+		int backoffs;	// consecutive HTTP 204
+		size_t sent;
+		size_t refused;
+		VtScheduler scheduler;
+	};
+
+	std::mutex lock;
+	std::vector<std::unique_ptr<Key>> keys;
+};
@@ -0,0 +1,175 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - known-hash index
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtKnownIndex.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+VtKnownIndex::VtKnownIndex()
+	: view(nullptr), viewSize(0),
+#ifdef _WIN32
+	hFile(INVALID_HANDLE_VALUE), hMapping(NULL),
+#endif
+	header(nullptr), buckets(nullptr), fingerprints(nullptr)
+{
+}
+
+VtKnownIndex::~VtKnownIndex()
+{
+	close();
+}
+
+uint64_t VtKnownIndex::fingerprint(const unsigned char* digest)
+{
+	uint64_t fp = 0;
+	for (int i = 0; i < 8; i++) {
+		fp = (fp << 8) | digest[i];
+	}
+	return fp;
+}
+
+uint32_t VtKnownIndex::bucketBitsFor(uint64_t count)
+{
+	uint32_t bits = 8;
+	while (bits < 24 && (count >> bits) > 16) {
+		bits++;
+	}
+	return bits;
+}
+
+// Bucket table padded to 8 bytes so that the fingerprints stay aligned
+uint64_t VtKnownIndex::tableSize(uint32_t bucketBits)
+{
+	uint64_t bytes = ((1ULL << bucketBits) + 1) * sizeof(uint32_t);
+	return (bytes + 7) & ~7ULL;
+}
+
+bool VtKnownIndex::open(const string& path)
+{
+	close();
+
+#ifdef _WIN32
+	hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size = {};
+	GetFileSizeEx(hFile, &size);
+	viewSize = (uint64_t)size.QuadPart;
+	if (viewSize >= sizeof(VtKnownHeader)) {
+		hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping != NULL) {
+			view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		}
+	}
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st = {};
+	fstat(fd, &st);
+	viewSize = (uint64_t)st.st_size;
+	if (viewSize >= sizeof(VtKnownHeader)) {
+		view = mmap(nullptr, (size_t)viewSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (view == MAP_FAILED) {
+			view = nullptr;
+		}
+	}
+	::close(fd);
+#endif
+
+	if (view == nullptr) {
+		close();
+		return false;
+	}
+
+	// the sizes must add up before anything is read past the header
+	const VtKnownHeader* h = (const VtKnownHeader*)view;
+	uint64_t bucketCount = h->bucketBits >= 1 && h->bucketBits <= 28 ? (1ULL << h->bucketBits) + 1 : 0;
+	uint64_t filterSize = h->version >= 2 && h->filterBlocks <= UINT32_MAX ? h->filterBlocks * VT_BLOOM_BLOCK_BITS / 8 : 0;
+	if (h->magic != VT_KNOWN_MAGIC || h->version < 1 || h->version > VT_KNOWN_VERSION || bucketCount == 0
+		|| h->count > UINT32_MAX
+		|| (filterSize > 0 && (h->filterHashes < 1 || h->filterHashes > 16))
+		|| viewSize != sizeof(VtKnownHeader) + filterSize + tableSize(h->bucketBits) + h->count * sizeof(uint64_t)) {
+		close();
+		return false;
+	}
+
+	// bucket bounds must stay within the fingerprints
+	const uint32_t* table = (const uint32_t*)((const char*)view + sizeof(VtKnownHeader) + filterSize);
+	bool ordered = table[0] == 0 && table[bucketCount - 1] == h->count;
+	for (uint64_t i = 1; ordered && i < bucketCount; i++) {
+		ordered = table[i - 1] <= table[i];
+	}
+	if (!ordered) {
+		close();
+		return false;
+	}
+
+	header = h;
+	bloom.attach((const uint64_t*)(h + 1), filterSize > 0 ? h->filterBlocks : 0, h->filterHashes);
+	buckets = table;
+	fingerprints = (const uint64_t*)((const char*)buckets + tableSize(h->bucketBits));
+	return true;
+}
+
+void VtKnownIndex::close()
+{
+#ifdef _WIN32
+	if (view != nullptr) {
+		UnmapViewOfFile(view);
+	}
+	if (hMapping != NULL) {
+		CloseHandle(hMapping);
+		hMapping = NULL;
+	}
+	if (hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (view != nullptr) {
+		munmap(view, (size_t)viewSize);
+	}
+#endif
+	view = nullptr;
+	viewSize = 0;
+	header = nullptr;
+	bloom.attach(nullptr, 0, VT_BLOOM_HASHES);
+	buckets = nullptr;
+	fingerprints = nullptr;
+}
+
+bool VtKnownIndex::contains(const unsigned char* digest) const
+{
+	if (header == nullptr) {
+		return false;
+	}
+
+	uint64_t fp = fingerprint(digest);
+	if (!bloom.mayContain(fp)) {
+		return false;
+	}
+
+	uint64_t bucket = fp >> (64 - header->bucketBits);
+
+	const uint64_t* first = fingerprints + buckets[bucket];
+	const uint64_t* last = fingerprints + buckets[bucket + 1];
+	return binary_search(first, last, fp);
+}
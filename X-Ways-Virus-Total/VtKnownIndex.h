@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - known-hash index
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Read-only index of known files (NSRL, hash sets...) built offline with
+// tools/vtknown. The file is memory-mapped as is, nothing is parsed :
+// - a header
+// - an optional blocked Bloom filter of the fingerprints (VtBloom), read
+//   first so that most unknown files never touch the rest of the file
+// - a bucket table : for each value of the top bits of the fingerprint, the
+//   position of its first fingerprint (one more entry closes the last bucket),
+//   padded to a multiple of 8 bytes
+// - the fingerprints, sorted : first 8 bytes of the SHA-1 read as a
+//   big-endian number, stored as little-endian 64-bit integers
+// A lookup is a bucket read followed by a binary search among a few dozen
+// fingerprints. An unknown file matches by chance with a probability of
+// count / 2^64, about 3e-12 for 50M entries.
+
+#pragma once
+#include <string>
+#include <cstdint>
+#include "VtBloom.h"
+
+#define VT_KNOWN_MAGIC		0x484B5456 // "VTKH"
+#define VT_KNOWN_VERSION	2 // 1 : same layout without filter
+
+#pragma pack(push)
+#pragma pack(1)
+struct VtKnownHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t count;			// fingerprints
+	uint32_t bucketBits;	// top bits of the fingerprint used as bucket number
+	uint32_t filterHashes;	// bits set per key in the filter
+	uint64_t filterBlocks;	// 64-byte blocks of the filter, 0 = no filter
+	uint8_t reserved[32];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VtKnownHeader) == 64, "VtKnownHeader must stay 64 bytes");
+
+class VtKnownIndex {
+public:
+	VtKnownIndex();
+	~VtKnownIndex();
+
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return header != nullptr; }
+	uint64_t count() const { return header ? header->count : 0; }
+
+	// true if the SHA-1 is in the index
+	bool contains(const unsigned char* digest) const;
+
+	// Prefilter of contains(), not attached when the index has none
+	const VtBloom& filter() const { return bloom; }
+
+	// First 8 bytes of a SHA-1 as a number, the order of the index
+	static uint64_t fingerprint(const unsigned char* digest);
+
+	// Bucket bits suited to a number of fingerprints (about 16 per bucket)
+	static uint32_t bucketBitsFor(uint64_t count);
+
+	// Bytes of the bucket table, padding included
+	static uint64_t tableSize(uint32_t bucketBits);
+
+private:
+	void* view;
+	uint64_t viewSize;
+#ifdef _WIN32
+	void* hFile;
+	void* hMapping;
+#endif
+
+	const VtKnownHeader* header;
+	VtBloom bloom;
+	const uint32_t* buckets;
+	const uint64_t* fingerprints;
+};
@@ -0,0 +1,213 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - messages
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtLog.h"
+#include <cwchar>
+
+using namespace std;
+using namespace std::chrono;
+
+///////////////////////////////////////////////////////////////////////////////
+// VtLog
+
+VtLog::VtLog()
+	: sink(nullptr), threshold(VT_LOG_INFO), progressInterval(seconds(0))
+{
+}
+
+bool VtLog::allowed(VtLogLevel level, const wchar_t* label)
+{
+	if (!enabled(level)) {
+		return false;
+	}
+
+	steady_clock::time_point now = steady_clock::now();
+
+	// a handful of call sites : compared by address, the label is a literal
+	Limit* limit = nullptr;
+	for (Limit& known : limits) {
+		if (known.label == label) {
+			limit = &known;
+			break;
+		}
+	}
+	if (limit == nullptr) {
+		Limit added = { label, level, now, 0, 0 };
+		limits.push_back(added);
+		limit = &limits.back();
+	}
+
+	if (now - limit->windowStart >= milliseconds(VT_LOG_WINDOW_MS)) {
+		report(*limit);
+		limit->windowStart = now;
+		limit->shown = 0;
+	}
+
+	if (limit->shown < VT_LOG_BURST) {
+		limit->shown++;
+		return true;
+	}
+	limit->suppressed++;
+	return false;
+}
+
+void VtLog::write(VtLogLevel level, const wchar_t* message)
+{
+	if (enabled(level)) {
+		sink(message);
+	}
+}
+
+bool VtLog::progressDue()
+{
+	if (progressInterval == steady_clock::duration::zero() || !enabled(VT_LOG_INFO)) {
+		return false;
+	}
+	steady_clock::time_point now = steady_clock::now();
+	if (now < nextProgress) {
+		return false;
+	}
+	nextProgress = now + progressInterval;
+	return true;
+}
+
+void VtLog::restart()
+{
+	limits.clear();
+	nextProgress = steady_clock::now() + progressInterval;
+}
+
+void VtLog::flush()
+{
+	for (Limit& limit : limits) {
+		report(limit);
+	}
+}
+
+void VtLog::report(Limit& limit)
+{
+	if (limit.suppressed == 0) {
+		return;
+	}
+	VtLogLine(*this, limit.level) << (limit.level <= VT_LOG_WARNING ? L"[!] " : L"[+] ")
+		<< limit.suppressed << L" more message(s) not shown : " << limit.label;
+	limit.suppressed = 0;
+}
+
+bool VtLog::parseLevel(const string& name, VtLogLevel& level)
+{
+	if (name == "error") {
+		level = VT_LOG_ERROR;
+	}
+	else if (name == "warning") {
+		level = VT_LOG_WARNING;
+	}
+	else if (name == "info") {
+		level = VT_LOG_INFO;
+	}
+	else if (name == "verbose") {
+		level = VT_LOG_VERBOSE;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtLogLine
+
+VtLogLine::VtLogLine(VtLog& output, VtLogLevel lineLevel)
+	: log(output), level(lineLevel), precision(-1), used(0)
+{
+	buffer[0] = L'\0';
+}
+
+VtLogLine::~VtLogLine()
+{
+	log.write(level, buffer);
+}
+
+// Cut at VT_LOG_LINE - 1 characters, always terminated
+void VtLogLine::append(const wchar_t* text, size_t length)
+{
+	size_t room = VT_LOG_LINE - 1 - used;
+	if (length > room) {
+		length = room;
+	}
+	wmemcpy(buffer + used, text, length);
+	used += length;
+	buffer[used] = L'\0';
+}
+
+VtLogLine& VtLogLine::operator<<(const wchar_t* text)
+{
+	if (text != nullptr) {
+		append(text, wcslen(text));
+	}
+	return *this;
+}
+
+VtLogLine& VtLogLine::operator<<(const wstring& text)
+{
+	append(text.c_str(), text.size());
+	return *this;
+}
+
+VtLogLine& VtLogLine::operator<<(const char* text)
+{
+	if (text == nullptr) {
+		return *this;
+	}
+	while (*text != '\0' && used < VT_LOG_LINE - 1) {
+		buffer[used++] = (wchar_t)(unsigned char)*text++;
+	}
+	buffer[used] = L'\0';
+	return *this;
+}
+
+VtLogLine& VtLogLine::operator<<(const string& text)
+{
+	return *this << text.c_str();
+}
+
+VtLogLine& VtLogLine::operator<<(wchar_t c)
+{
+	append(&c, 1);
+	return *this;
+}
+
+VtLogLine& VtLogLine::operator<<(long long n)
+{
+	if (n < 0) {
+		append(L"-", 1);
+		return *this << (0ULL - (unsigned long long)n);
+	}
+	return *this << (unsigned long long)n;
+}
+
+VtLogLine& VtLogLine::operator<<(unsigned long long n)
+{
+	wchar_t digits[24];
+	size_t i = sizeof(digits) / sizeof(digits[0]);
+	do {
+		digits[--i] = (wchar_t)(L'0' + n % 10);
+		n /= 10;
+	} while (n > 0);
+	append(digits + i, sizeof(digits) / sizeof(digits[0]) - i);
+	return *this;
+}
+
+VtLogLine& VtLogLine::operator<<(double x)
+{
+	wchar_t number[64];
+	int length = precision >= 0
+		? swprintf(number, 64, L"%.*f", precision, x)
+		: swprintf(number, 64, L"%g", x);
+	if (length > 0) {
+		append(number, (size_t)length);
+	}
+	return *this;
+}
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - messages
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Every message goes through a VtLog : its level decides what reaches the
+// output, by default the settings, the warnings and a progress line every
+// few seconds instead of one or more lines per item, which slowed X-Ways
+// down more than the lookups on large volumes. The per-item lines are kept
+// at the verbose level, to follow a run item by item.
+// A line is built in a buffer on the stack, with no allocation, and only
+// when its level is shown : VT_LOG skips the whole expression otherwise.
+// The messages of the same call site that may repeat for many items (read
+// errors, requests given up...) are limited with VT_LOG_LIMITED : a few per
+// minute, the others are counted and reported as one line.
+// Used by one thread at a time : X-Vt only logs under its run lock. The
+// output is a plain function so that the same code runs outside of X-Ways.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+
+#define VT_LOG_LINE			512		// characters of a line, longer ones are cut
+#define VT_LOG_BURST		5		// lines of a limited call site per window
+#define VT_LOG_WINDOW_MS	60000	// then the others are counted up to the next window
+
+enum VtLogLevel {
+	VT_LOG_ERROR,		// the run cannot go on
+	VT_LOG_WARNING,		// items or hashes left out, settings ignored
+	VT_LOG_INFO,		// settings, progress and summaries
+	VT_LOG_VERBOSE		// one or more lines per item
+};
+
+// Where the lines go : XWF_OutputMessage in X-Ways
+typedef void (*VtLogSink)(const wchar_t* message);
+
+class VtLog {
+public:
+	VtLog();
+
+	void setSink(VtLogSink output) { sink = output; }
+	void setLevel(VtLogLevel level) { threshold = level; }
+	VtLogLevel level() const { return threshold; }
+
+	bool enabled(VtLogLevel level) const { return sink != nullptr && level <= threshold; }
+
+	// false once the call site identified by label (a string literal) had
+	// VT_LOG_BURST lines in the current window, the line is counted instead
+	bool allowed(VtLogLevel level, const wchar_t* label);
+
+	void write(VtLogLevel level, const wchar_t* message);
+
+	// seconds between two progress lines, 0 = none
+	void setProgressInterval(unsigned seconds) { progressInterval = std::chrono::seconds(seconds); }
+
+	// true once per interval, when the progress line is due
+	bool progressDue();
+
+	// New run : counters of the limited call sites and progress clock
+	void restart();
+
+	// Reports the lines counted instead of shown
+	void flush();
+
+	// error, warning, info or verbose
+	static bool parseLevel(const std::string& name, VtLogLevel& level);
+
+private:
+	struct Limit {
+		const wchar_t* label;
+		VtLogLevel level;
+		std::chrono::steady_clock::time_point windowStart;
+		unsigned shown;
+		unsigned long long suppressed;
+	};
+
+	void report(Limit& limit);
+
+	VtLogSink sink;
+	VtLogLevel threshold;
+	std::vector<Limit> limits;
+	std::chrono::steady_clock::duration progressInterval;
+	std::chrono::steady_clock::time_point nextProgress;
+};
+
+// One line, written when it goes out of scope
+class VtLogLine {
+public:
+	VtLogLine(VtLog& log, VtLogLevel level);
+	~VtLogLine();
+
+	VtLogLine& operator<<(const wchar_t* text);
+	VtLogLine& operator<<(const std::wstring& text);
+	VtLogLine& operator<<(const char* text);			// ASCII, as the settings
+	VtLogLine& operator<<(const std::string& text);
+	VtLogLine& operator<<(wchar_t c);
+	VtLogLine& operator<<(int n) { return *this << (long long)n; }
+	VtLogLine& operator<<(long n) { return *this << (long long)n; }
+	VtLogLine& operator<<(long long n);
+	VtLogLine& operator<<(unsigned n) { return *this << (unsigned long long)n; }
+	VtLogLine& operator<<(unsigned long n) { return *this << (unsigned long long)n; }
+	VtLogLine& operator<<(unsigned long long n);
+	VtLogLine& operator<<(double x);
+
+	// decimals of the numbers that follow, -1 = 6 significant digits
+	VtLogLine& fixed(int decimals) { precision = decimals; return *this; }
+
+private:
+	VtLogLine(const VtLogLine&);
+	VtLogLine& operator=(const VtLogLine&);
+
+	void append(const wchar_t* text, size_t length);
+
+	VtLog& log;
+	VtLogLevel level;
+	int precision;
+	size_t used;
+	wchar_t buffer[VT_LOG_LINE];
+};
+
+// VT_LOG(gLog, VT_LOG_VERBOSE) << L"[+] Queued hash of : " << name;
+// nothing after VT_LOG is evaluated when the level is not shown
+#define VT_LOG(log, level) \
+	if (!(log).enabled(level)) {} else VtLogLine(log, (level))
+
+// Same, limited to VT_LOG_BURST lines per minute for the call site : label
+// is a string literal telling what the lines counted instead were about
+#define VT_LOG_LIMITED(log, level, label) \
+	if (!(log).allowed((level), label)) {} else VtLogLine(log, (level))
@@ -0,0 +1,211 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - file/report requests
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtLookup.h"
+#include <curl/curl.h>
+#include "VtJson.h"
+
+using namespace std;
+
+namespace
+{
+	std::size_t callback(
+		const char* in,
+		std::size_t size,
+		std::size_t num,
+		std::string* out)
+	{
+		const std::size_t totalBytes(size * num);
+		out->append(in, totalBytes);
+		return totalBytes;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	//Callback function for response header  -- x-api-message -- Curl
+	static std::size_t header_callback(char* buffer, std::size_t size, std::size_t nitems, void* userdata) {
+		std::string header(buffer, size * nitems);
+		std::size_t colon_pos = header.find(':');
+		if (colon_pos != std::string::npos) {
+			std::string header_name = header.substr(0, colon_pos);
+			std::string header_value = header.substr(colon_pos + 1);
+			// Trim leading and trailing white space from header value
+			header_value = header_value.erase(0, header_value.find_first_not_of(" \t\r\n"));
+			header_value = header_value.erase(header_value.find_last_not_of(" \t\r\n") + 1);
+			if (header_name == "X-Api-Message") {
+				*static_cast<std::string*>(userdata) = header_value;
+			}
+		}
+		return nitems * size;
+	}
+
+	bool isNumber(char c)
+	{
+		return c == '-' || (c >= '0' && c <= '9');
+	}
+
+	// "scans" : { "<engine>": { "detected": true, "version": ..., "result": "...", ... }, ... }
+	bool readScans(VtJsonScanner& json, const vector<string>& engines, VtVerdict& verdict)
+	{
+		if (json.peek() != '{') {
+			return json.skipValue();
+		}
+
+		VtJsonSpan name;
+		json.beginObject();
+		while (json.nextKey(name)) {
+			bool wanted = false;
+			for (const string& engine : engines) {
+				wanted = wanted || name.equals(engine.c_str());
+			}
+			if (!wanted || json.peek() != '{') {
+				json.skipValue();
+				continue;
+			}
+
+			VtEngineResult result;
+			result.engine = VtJsonScanner::unescape(name);
+			result.detected = false;
+
+			VtJsonSpan key;
+			json.beginObject();
+			while (json.nextKey(key)) {
+				VtJsonSpan value;
+				if (key.equals("detected") && json.peek() != 'n') {
+					json.readBool(result.detected);
+				}
+				else if (key.equals("result") && json.peek() == '"') {
+					json.readString(value);
+					result.result = VtJsonScanner::unescape(value);
+				}
+				else {
+					json.skipValue();
+				}
+			}
+			verdict.engines.push_back(result);
+		}
+		return !json.failed();
+	}
+
+	bool readReport(VtJsonScanner& json, const vector<string>& engines, VtVerdict& verdict)
+	{
+		verdict.responseCode = 0;
+		verdict.positives = 0;
+		verdict.total = 0;
+
+		json.peek();
+		verdict.raw = json.position();
+
+		VtJsonSpan key;
+		if (!json.beginObject()) {
+			return false;
+		}
+		while (json.nextKey(key)) {
+			VtJsonSpan text;
+			long long number = 0;
+			char next = json.peek();
+
+			if (key.equals("response_code") && isNumber(next)) {
+				json.readInt(number);
+				verdict.responseCode = (int)number;
+			}
+			else if (key.equals("positives") && isNumber(next)) {
+				json.readInt(number);
+				verdict.positives = (int)number;
+			}
+			else if (key.equals("total") && isNumber(next)) {
+				json.readInt(number);
+				verdict.total = (int)number;
+			}
+			else if (key.equals("resource") && next == '"') {
+				json.readString(text);
+				verdict.resource = VtJsonScanner::unescape(text);
+			}
+			else if (key.equals("scan_date") && next == '"') {
+				json.readString(text);
+				verdict.scanDate = VtJsonScanner::unescape(text);
+			}
+			else if (key.equals("permalink") && next == '"') {
+				json.readString(text);
+				verdict.permalink = VtJsonScanner::unescape(text);
+			}
+			else if (key.equals("scans") && !engines.empty()) {
+				readScans(json, engines, verdict);
+			}
+			else {
+				json.skipValue();
+			}
+		}
+
+		verdict.rawSize = json.position() - verdict.raw;
+		return !json.failed();
+	}
+}
+
+string vtReportUrl(const string& apiUrl, const string& apiKey, const vector<string>& resources)
+{
+	string url = apiUrl + "file/report?apikey=";
+	url += apiKey;
+	url += "&resource=";
+	for (size_t i = 0; i < resources.size(); i++) {
+		if (i > 0) {
+			url += "%2C"; // ','
+		}
+		url += resources[i];
+	}
+	return url;
+}
+
+void vtSetupRequest(void* curl, const string& url, string* body, string* apiMessage,
+	long connectTimeout, long timeout)
+{
+	/***************************************************/
+	/* /!\ DON'T FORGET THE .c_str() AFTER URL     /!\ */
+	/***************************************************/
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+
+	// accept ssl
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+
+	// Hook up data handling function.
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, callback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+
+	//--- Case of HTTP 204 : maximum queries reached
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, apiMessage);
+
+	// a server that stops answering must not hold the run : the request
+	// fails and goes through the retry policy of the network errors
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+}
+
+bool vtParseReports(const string& body, const vector<string>& engines, vector<VtVerdict>& verdicts)
+{
+	VtJsonScanner json(body.data(), body.size());
+
+	if (json.peek() == '[') {
+		json.beginArray();
+		while (json.nextElement()) {
+			verdicts.push_back(VtVerdict());
+			if (!readReport(json, engines, verdicts.back())) {
+				return false;
+			}
+		}
+	}
+	else if (json.peek() == '{') {
+		verdicts.push_back(VtVerdict());
+		if (!readReport(json, engines, verdicts.back())) {
+			return false;
+		}
+	}
+	else {
+		return false;
+	}
+
+	// nothing but blanks after the response
+	return !json.failed() && json.peek() == '\0';
+}
@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - file/report requests
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// The v2 file/report endpoint accepts several comma-separated resources :
+// up to 4 with a public key, up to 25 with a paid key.
+// A single resource is answered with a JSON object, several with an array.
+// The responses are scanned in place (see VtJson.h), the full reports with
+// the results of every engine are never loaded into a DOM.
+
+#pragma once
+#include <string>
+#include <vector>
+
+#define VT_API_URL			"https://www.virustotal.com/vtapi/v2/"
+#define VT_BATCH_PUBLIC		4
+#define VT_BATCH_PAID		25
+#define VT_CONNECT_TIMEOUT	15	// seconds, default of connecttimeout
+#define VT_REQUEST_TIMEOUT	120	// seconds, default of requesttimeout
+
+// Result of one antivirus engine, only for the engines asked for
+struct VtEngineResult {
+	std::string engine;
+	bool detected;
+	std::string result;		// name of the detection, empty if none
+};
+
+// One report of a file/report response
+struct VtVerdict {
+	std::string resource;	// hash sent, as echoed by VirusTotal
+	int responseCode;		// 1 = known file, 0 = unknown, -2 = queued for analysis
+	int positives;
+	int total;
+	std::string scanDate;
+	std::string permalink;
+	std::vector<VtEngineResult> engines;
+	const char* raw;		// JSON of this report only, inside the response body
+	size_t rawSize;
+};
+
+// Builds the file/report URL for one or several resources
+// apiUrl : VT_API_URL, or a local stand-in (see tools/vtmock)
+std::string vtReportUrl(const std::string& apiUrl, const std::string& apiKey,
+	const std::vector<std::string>& resources);
+
+// Sets up a GET request on a curl easy handle, the response is appended to body
+// apiMessage receives the X-Api-Message header, set by VirusTotal on errors
+// connectTimeout, timeout : seconds to connect and for the whole request, a
+// stalled request ends with CURLE_OPERATION_TIMEDOUT like a network error
+void vtSetupRequest(void* curl, const std::string& url, std::string* body, std::string* apiMessage,
+	long connectTimeout, long timeout);
+
+// Extracts the fields used from a file/report response, one verdict per report
+// The per-engine scans are skipped except for the engines listed (exact names,
+// e.g. "Microsoft"). raw points into body, which must outlive the verdicts.
+bool vtParseReports(const std::string& body, const std::vector<std::string>& engines,
+	std::vector<VtVerdict>& verdicts);
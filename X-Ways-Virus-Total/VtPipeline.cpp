@@ -0,0 +1,562 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - lookup pipeline
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtPipeline.h"
+#include <cctype>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	// VirusTotal echoes the resource in the case it prefers
+	bool sameResource(const string& a, const string& b)
+	{
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); i++) {
+			if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+VtPipeline::VtPipeline()
+	: config(nullptr), log(nullptr), timings(nullptr), host(nullptr), batchSize(VT_BATCH_PUBLIC),
+	submitted(0), answeredCount(0), skippedCount(0), cachedCount(0), knownCount(0), journalCount(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// open / close
+
+bool VtPipeline::open(const VtConfig& settings, VtLog& output, VtTimings& stageTimings)
+{
+	config = &settings;
+	log = &output;
+	timings = &stageTimings;
+
+	// HTTP client, kept until close()
+	bool ready = client.init();
+	if (!ready) {
+		VT_LOG(*log, VT_LOG_ERROR) << L"[!] Unable to initialize curl";
+	}
+
+	// Verdict cache : an empty cachefile disables it
+	if (!config->cacheFile.empty()) {
+		if (cache.open(config->cacheFile, config->cacheTtl, config->unknownTtl)) {
+			VT_LOG(*log, VT_LOG_INFO) << L"[+] Verdict cache : " << cache.count() << L" entries";
+			if (cache.reclaimed() > 0) {
+				VT_LOG(*log, VT_LOG_INFO) << L"[+] Verdict cache compacted : " << cache.reclaimed() / 1048576 << L" MB of old reports reclaimed";
+			}
+		}
+		else if (cache.isForeign()) {
+			VT_LOG(*log, VT_LOG_WARNING) << L"[!] " << config->cacheFile << L" is not a verdict cache, delete it to start a new one"
+				<< L" ; every hash will be queried";
+		}
+		else {
+			VT_LOG(*log, VT_LOG_WARNING) << L"[!] Unable to open the verdict cache, every hash will be queried";
+		}
+	}
+
+	// Known-hash index built with tools/vtknown : mapped, not loaded
+	if (!config->knownFile.empty()) {
+		if (knownIndex.open(config->knownFile)) {
+			VT_LOG(*log, VT_LOG_INFO) << L"[+] Known-hash index : " << knownIndex.count() << L" entries";
+
+			// the filter answers most unknown files without reading the index itself
+			const VtBloom& filter = knownIndex.filter();
+			if (filter.isAttached()) {
+				VT_LOG(*log, VT_LOG_INFO) << L"[+] Known-hash filter : " << filter.sizeBytes() / 1024 << L" KB, "
+					<< filter.hashCount() << L" hashes per key, "
+					<< VtBloom::falsePositiveRate(knownIndex.count(), filter.blockCount(), filter.hashCount()) * 100
+					<< L" % false positives";
+			}
+			else {
+				VT_LOG(*log, VT_LOG_WARNING) << L"[!] Known-hash index without filter (built with --bits 0 or by an older vtknown)";
+			}
+		}
+		else {
+			VT_LOG(*log, VT_LOG_WARNING) << L"[!] Unable to open the known-hash index, known files will be queried";
+		}
+	}
+	return ready;
+}
+
+void VtPipeline::close()
+{
+	engine.stop();
+	archive.close();
+	runJournal.close();
+	cache.close();
+	knownIndex.close();
+	client.cleanup();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run
+
+bool VtPipeline::start(VtPipelineHost* runHost)
+{
+	host = runHost;
+	clearRun();
+	batchSize = config->batchSize;
+
+	if (!config->archiveFile.empty()) {
+		archive.close();
+		archive.clear();
+		archive.open(config->archiveFile, ios::app | ios::binary);
+		if (!archive) {
+			VT_LOG(*log, VT_LOG_WARNING) << L"[!] Unable to open the archive file, the raw reports will not be kept";
+		}
+	}
+
+	// one scheduler per key, requests go to the key with the most tokens left
+	keys.clear();
+	for (const VtKeyConfig& key : config->keys) {
+		keys.add(key.name, key.apiKey, key.publicKey, key.perMinute, key.perDay, key.perMonth, key.quotaFile);
+	}
+	vector<VtKeyUsage> usages = keys.usage();
+	for (size_t i = 0; i < usages.size(); i++) {
+		const VtKeyConfig& key = config->keys[i];
+		VT_LOG(*log, VT_LOG_INFO) << L"[+] Key [" << key.name << L"] : " << (key.publicKey ? L"public" : L"paid")
+			<< L", quota " << key.perMinute << L"/min, " << key.perDay << L"/day, " << key.perMonth
+			<< L"/month (0 = no limit), used today : " << usages[i].usedToday;
+	}
+
+	if (!engine.start(&client, config->apiUrl, &keys, config->maxInFlight, config->connectTimeout, config->requestTimeout)) {
+		VT_LOG(*log, VT_LOG_ERROR) << L"[!] Unable to start the lookup engine";
+		archive.close();
+		return false;
+	}
+
+	// connect while the host prepares the first items
+	client.warmUp(config->apiUrl);
+	return true;
+}
+
+void VtPipeline::clearRun()
+{
+	pending.clear();
+	duplicateItems.clear();
+	runIndex.clear();
+	verdicts.clear();
+	waiting.clear();
+	submitted = 0;
+	answeredCount = 0;
+	skippedCount = 0;
+	cachedCount = 0;
+	knownCount = 0;
+	journalCount = 0;
+}
+
+void VtPipeline::finish(bool complete)
+{
+	if (cachedCount > 0) {
+		VT_LOG(*log, VT_LOG_INFO) << L"[+] " << cachedCount << L" verdict(s) from the cache, not sent";
+	}
+
+	if (knownCount > 0) {
+		VT_LOG(*log, VT_LOG_INFO) << L"[+] " << knownCount << L" known file(s) not sent";
+	}
+
+	if (journalCount > 0) {
+		VT_LOG(*log, VT_LOG_INFO) << L"[+] " << journalCount << L" item(s) resumed from the journal, not sent";
+	}
+
+	if (!duplicateItems.empty()) {
+		VT_LOG(*log, VT_LOG_INFO) << L"[+] " << pending.size() << L" distinct hash(es) queued, " << duplicateItems.size()
+			<< L" duplicate item(s) not sent";
+	}
+
+	if (skippedCount > 0 || engine.retried() > 0) {
+		VT_LOG(*log, skippedCount > 0 ? VT_LOG_WARNING : VT_LOG_INFO) << (skippedCount > 0 ? L"[!] " : L"[+] ")
+			<< engine.retried() << L" request(s) sent again after an error, " << skippedCount << L" hash(es) not looked up";
+	}
+
+	// an interrupted run leaves its journal to the next one
+	if (complete && skippedCount == 0) {
+		runJournal.discard();
+	}
+	else if (runJournal.isOpen()) {
+		VT_LOG(*log, VT_LOG_WARNING) << L"[!] Run incomplete : the verdicts received are kept in the journal for the next run";
+		runJournal.close();
+	}
+
+	// drop what is left if the run was aborted
+	engine.stop();
+	clearRun();
+	archive.close();
+
+	// usage of each key, a dropped key is worth a look at config.ini
+	keys.save();
+	for (const VtKeyUsage& usage : keys.usage()) {
+		VT_LOG(*log, usage.state == VT_KEY_DENIED ? VT_LOG_WARNING : VT_LOG_INFO)
+			<< (usage.state == VT_KEY_DENIED ? L"[!] Key [" : L"[+] Key [") << usage.name
+			<< L"] : " << usage.sent << L" request(s), " << usage.refused << L" refused (204), used "
+			<< usage.usedToday << L" today, " << usage.usedThisMonth << L" this month"
+			<< (usage.state == VT_KEY_DENIED ? L", access denied (403), dropped"
+				: usage.state == VT_KEY_EXHAUSTED ? L", quota used up" : L"");
+	}
+}
+
+string VtPipeline::hexDigest(const uint8_t* digest, size_t size)
+{
+	static const char digits[] = "0123456789abcdef";
+	string hash(size * 2, '0');
+	for (size_t i = 0; i < size; i++) {
+		hash[2 * i] = digits[digest[i] >> 4];
+		hash[2 * i + 1] = digits[digest[i] & 0x0F];
+	}
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lookup
+
+// Known files, cache, journal, then the queue of the lookups
+// The files and indexes are searched by the key of the digest, VirusTotal
+// gets the digest itself
+void VtPipeline::lookup(long itemID, VtHashType type, const uint8_t* value)
+{
+	VtStageTimer lookupTimer(*timings, VT_STAGE_LOOKUP);
+	string hash = hexDigest(value, vtDigestSize(type));
+	uint8_t digest[VT_DIGEST_KEY_SIZE];
+	vtDigestKey(type, value, digest);
+
+	//////////////////////////////////////////
+	//										//
+	//			Known files					//
+	//										//
+	//////////////////////////////////////////
+
+	if (knownIndex.contains(digest)) {
+		lookupTimer.stop();
+		host->itemKnown(itemID, hash);
+		knownCount++;
+
+		return;
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Verdict cache				//
+	//										//
+	//////////////////////////////////////////
+
+	VtCacheRecord cached;
+	if (cache.lookup(digest, cached)) {
+		VT_LOG(*log, VT_LOG_VERBOSE) << L"[+] Cached verdict for : " << host->itemName(itemID);
+		cachedCount++;
+
+		// unknown files are cached too, they keep the "0/0" score
+		VtVerdict verdict = {};
+		verdict.responseCode = cached.responseCode;
+		verdict.positives = cached.positives;
+		verdict.total = cached.total;
+		verdict.scanDate = VtCache::formatScanDate(cached.scanDate);
+
+		// permalink and engine results come from the report kept with the verdict
+		string raw;
+		vector<VtVerdict> report;
+		if (!config->engines.empty() || config->reportFormat != VT_REPORT_TEXT) {
+			raw = cache.readReport(cached);
+			if (vtParseReports(raw, config->engines, report) && !report.empty()) {
+				verdict.permalink = report[0].permalink;
+				verdict.engines = report[0].engines;
+			}
+		}
+		lookupTimer.stop();
+		host->itemVerdict(itemID, hash, verdict, true);
+
+		return;
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Resume journal				//
+	//										//
+	//////////////////////////////////////////
+
+	// looked up by an interrupted run, the hash did not change since
+	VtJournalRecord journaled;
+	if (runJournal.lookup(itemID, digest, journaled)) {
+		VtVerdict verdict = {};
+		verdict.responseCode = journaled.responseCode;
+		verdict.positives = journaled.positives;
+		verdict.total = journaled.total;
+		verdict.scanDate = VtCache::formatScanDate(journaled.scanDate);
+		lookupTimer.stop();
+		host->itemVerdict(itemID, hash, verdict, true);
+		journalCount++;
+
+		return;
+	}
+
+
+	//////////////////////////////////////////
+	//										//
+	//			Queue						//
+	//										//
+	//////////////////////////////////////////
+
+	// same hash as an item already queued : only the first one is sent
+	bool inserted = false;
+	size_t first = runIndex.insert(digest, pending.size(), inserted);
+	if (!inserted) {
+		PendingItem& original = pending[first];
+		lookupTimer.stop();
+
+		// answered already
+		if (original.verdict >= 0) {
+			VT_LOG(*log, VT_LOG_VERBOSE) << L"[+] Same hash as an answered item : " << host->itemName(itemID);
+			recordAnswer(itemID, original, verdicts[original.verdict]);
+
+			return;
+		}
+
+		DuplicateItem duplicate;
+		duplicate.itemID = itemID;
+		duplicate.next = -1;
+		duplicateItems.push_back(duplicate);
+
+		int dup = (int)duplicateItems.size() - 1;
+		if (original.lastDuplicate < 0) {
+			original.firstDuplicate = dup;
+		}
+		else {
+			duplicateItems[original.lastDuplicate].next = dup;
+		}
+		original.lastDuplicate = dup;
+
+		VT_LOG(*log, VT_LOG_VERBOSE) << L"[+] Same hash as a queued item : " << host->itemName(itemID);
+
+		return;
+	}
+
+	lookupTimer.stop();
+
+	PendingItem item;
+	item.itemID = itemID;
+	memcpy(item.digest, digest, VT_DIGEST_KEY_SIZE);
+	item.hash = hash;
+	{
+		VtStageTimer riskTimer(*timings, VT_STAGE_RISK);
+		item.risk = host->itemRisk(itemID);
+	}
+	item.requeued = false;
+	item.verdict = -1;
+	item.firstDuplicate = -1;
+	item.lastDuplicate = -1;
+	pending.push_back(item);
+	waiting.push(pending.size() - 1, item.risk);
+
+	VT_LOG(*log, VT_LOG_VERBOSE) << L"[+] Queued hash of : " << host->itemName(itemID) << L" (risk " << item.risk << L")";
+
+	submit(false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batches and responses
+
+void VtPipeline::submit(bool all)
+{
+	while (!waiting.empty()
+		&& (all || (waiting.size() >= batchSize && engine.pending() < (size_t)config->maxInFlight))) {
+		VtRequest request;
+		while (!waiting.empty() && request.items.size() < batchSize) {
+			size_t i = waiting.pop();
+			request.items.push_back(i);
+			request.resources.push_back(pending[i].hash);
+		}
+		engine.submit(request);
+		submitted += request.items.size();
+	}
+}
+
+int VtPipeline::poll()
+{
+	int result = 0;
+	vector<VtResponse> responses;
+	engine.collect(responses, 0);
+	for (const VtResponse& response : responses) {
+		result = handleResponse(response);
+		if (result != 0) {
+			break;
+		}
+	}
+	runJournal.tick();
+	return result;
+}
+
+bool VtPipeline::wait(unsigned timeout, int& result)
+{
+	vector<VtResponse> responses;
+	bool more;
+	{
+		VtStageTimer waitTimer(*timings, VT_STAGE_WAIT);
+		more = engine.collect(responses, timeout);
+	}
+	for (const VtResponse& response : responses) {
+		result = handleResponse(response);
+		if (result != 0) {
+			break;
+		}
+	}
+	runJournal.tick();
+	return more;
+}
+
+// Gives an item its verdict and journals it
+void VtPipeline::recordAnswer(long itemID, const PendingItem& item, const VtVerdict& verdict)
+{
+	host->itemVerdict(itemID, item.hash, verdict, false);
+	VtStageTimer journalTimer(*timings, VT_STAGE_JOURNAL);
+	runJournal.append(itemID, item.digest, verdict.responseCode, verdict.positives, verdict.total,
+		VtCache::parseScanDate(verdict.scanDate));
+}
+
+// Sends a hash once more, behind the others, or gives it up if it already was
+bool VtPipeline::requeue(size_t index)
+{
+	PendingItem& item = pending[index];
+	if (item.requeued) {
+		skippedCount++;
+		return false;
+	}
+	item.requeued = true;
+	waiting.push(index, item.risk - VT_REQUEUE_PENALTY);
+	return true;
+}
+
+// Fans the reports of a batch out to its items, VirusTotal echoes the
+// resource sent, the position in the response is only used as a fallback.
+// A hash missing from the response is sent again once. Returns the hashes
+// answered
+size_t VtPipeline::applyVerdicts(const vector<size_t>& items, const vector<VtVerdict>& received, size_t& requeued)
+{
+	size_t answered = 0;
+	for (size_t n = 0; n < items.size(); n++) {
+		PendingItem& item = pending[items[n]];
+
+		const VtVerdict* verdict = nullptr;
+		for (const VtVerdict& v : received) {
+			if (sameResource(v.resource, item.hash)) {
+				verdict = &v;
+				break;
+			}
+		}
+		if (verdict == nullptr && received.size() == items.size()) {
+			verdict = &received[n];
+		}
+		if (verdict == nullptr) {
+			requeued += requeue(items[n]) ? 1 : 0;
+			continue;
+		}
+		answered++;
+
+		// keep the verdict for the next runs
+		cache.store(item.digest, verdict->responseCode, verdict->positives, verdict->total,
+			VtCache::parseScanDate(verdict->scanDate), verdict->raw, verdict->rawSize);
+
+		recordAnswer(item.itemID, item, *verdict);
+		for (int dup = item.firstDuplicate; dup >= 0; dup = duplicateItems[dup].next) {
+			recordAnswer(duplicateItems[dup].itemID, item, *verdict);
+		}
+
+		// for the items with the same hash still to come
+		item.verdict = (int)verdicts.size();
+		verdicts.push_back(*verdict);
+		verdicts.back().raw = nullptr;
+		verdicts.back().rawSize = 0;
+	}
+	return answered;
+}
+
+// Checks the HTTP code of a response and applies its reports
+// Returns -1 when the whole run must be aborted
+int VtPipeline::handleResponse(const VtResponse& response)
+{
+	long httpCode = response.httpCode;
+	if (response.sent) {
+		timings->addSeconds(VT_STAGE_HTTP, response.seconds);
+	}
+
+	// dropped by the engine once the quota is used up, the run goes on
+	if (!response.sent) {
+		skippedCount += response.request.items.size();
+		VT_LOG_LIMITED(*log, VT_LOG_WARNING, L"hashes not sent") << L"[!] " << response.request.resources.size()
+			<< L" hash(es) not sent : " << response.error;
+		return 0;
+	}
+
+	// a refused key is dropped by the engine, 403 only comes back once no key is left :
+	// nothing more can be looked up
+	if (httpCode == 403) {
+		VT_LOG(*log, VT_LOG_ERROR) << L"[!] Error : Access denied on every key. ";
+		VT_LOG(*log, VT_LOG_ERROR) << L"[!] Check API keys in config.ini ";
+		return -1;
+	}
+
+	// network and server errors were already retried by the engine,
+	// only these hashes are given up, the run goes on
+	if (httpCode != 200) {
+		skippedCount += response.request.items.size();
+		if (httpCode == 0) {
+			VT_LOG_LIMITED(*log, VT_LOG_WARNING, L"connection problems") << L"[!] Problem connecting ! " << response.error
+				<< L" (" << response.request.resources.size() << L" hash(es) skipped after " << response.attempts << L" attempt(s))";
+		}
+		else {
+			VT_LOG_LIMITED(*log, VT_LOG_WARNING, L"bad response codes") << L"[!] Bad Response Code! : " << httpCode
+				<< L" (" << response.request.resources.size() << L" hash(es) skipped after " << response.attempts << L" attempt(s))";
+		}
+		return 0;
+	}
+
+
+	//////////////////////////////////////////
+	//										//
+	//			Parsing Report VT			//
+	//										//
+	//////////////////////////////////////////
+
+	// truncated or garbled answer : the hashes wait once more, behind the others
+	vector<VtVerdict> received;
+	bool parsed;
+	{
+		VtStageTimer parseTimer(*timings, VT_STAGE_PARSE);
+		parsed = vtParseReports(response.body, config->engines, received);
+	}
+	if (!parsed) {
+		size_t requeued = 0;
+		for (size_t i : response.request.items) {
+			requeued += requeue(i) ? 1 : 0;
+		}
+		VT_LOG_LIMITED(*log, VT_LOG_WARNING, L"unreadable responses") << L"[!] Failled to parse JSON response, "
+			<< requeued << L" hash(es) queued again";
+		return 0;
+	}
+
+	// one report per line, as sent by VirusTotal
+	if (archive.is_open()) {
+		VtStageTimer fileTimer(*timings, VT_STAGE_REPORT_FILE);
+		for (const VtVerdict& verdict : received) {
+			archive.write(verdict.raw, verdict.rawSize);
+			archive << "\n";
+		}
+	}
+
+	size_t requeued = 0;
+	answeredCount += applyVerdicts(response.request.items, received, requeued);
+	VT_LOG(*log, VT_LOG_VERBOSE) << L"[+] Response : OK ! (" << answeredCount << L"/" << pending.size() << L")";
+	if (requeued > 0) {
+		VT_LOG_LIMITED(*log, VT_LOG_WARNING, L"incomplete responses") << L"[!] " << requeued
+			<< L" hash(es) missing from a response, queued again";
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - lookup pipeline
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// What happens to a hash once its item has one, whoever runs it : X-Vt.cpp
+// inside X-Ways, tools/vtscan on Linux. A hash goes through the known-hash
+// index, the verdict cache and the resume journal, then waits in a queue,
+// one entry per distinct hash, and leaves by batches, the riskiest first,
+// on the connections of the lookup engine. The responses are parsed, cached,
+// journaled and fanned out to every item with that hash.
+// The host only knows about its items : their name and risk score, what to
+// do with a verdict (VtPipelineHost). Nothing here calls X-Ways or Windows.
+// Used by one thread at a time : the host calls lookup(), poll() and
+// wait() under its own lock, the host callbacks come from these calls.
+
+#pragma once
+#include "VtConfig.h"
+#include "VtLookup.h"
+#include "VtHash.h"
+#include "VtClient.h"
+#include "VtEngine.h"
+#include "VtKeyPool.h"
+#include "VtCache.h"
+#include "VtKnownIndex.h"
+#include "VtJournal.h"
+#include "VtHashIndex.h"
+#include "VtPriority.h"
+#include "VtLog.h"
+#include "VtTiming.h"
+#include <string>
+#include <vector>
+#include <fstream>
+
+// risk taken off the hashes queued again after an unreadable answer
+#define VT_REQUEUE_PENALTY	1000
+
+// The items of the host, called back from lookup(), poll() and wait()
+class VtPipelineHost {
+public:
+	virtual ~VtPipelineHost() {}
+
+	// Name of an item, for the messages
+	virtual const wchar_t* itemName(long itemID) = 0;
+
+	// vtRiskScore of an item, asked once per distinct hash
+	virtual int itemRisk(long itemID) = 0;
+
+	// Item found in the known-hash index, never sent
+	virtual void itemKnown(long itemID, const std::string& hash) = 0;
+
+	// Verdict of an item : from the cache, the journal or VirusTotal
+	virtual void itemVerdict(long itemID, const std::string& hash, const VtVerdict& verdict, bool cached) = 0;
+};
+
+class VtPipeline {
+public:
+	VtPipeline();
+
+	// Opens the verdict cache and the known-hash index of config, kept from
+	// one run to the next. False if curl cannot be initialized, a cache or
+	// an index that cannot be opened is only reported
+	bool open(const VtConfig& config, VtLog& log, VtTimings& timings);
+
+	// Stops the engine and closes the files
+	void close();
+
+	// Resume journal of the run, opened by the host (one per volume)
+	VtJournal& journal() { return runJournal; }
+
+	// New run : keys and their quotas, lookup engine, archive file
+	// False if the engine cannot be started
+	bool start(VtPipelineHost* host);
+
+	// Looks a digest up, or queues it for a batch
+	void lookup(long itemID, VtHashType type, const uint8_t* digest);
+
+	// Applies the responses already received, without waiting
+	// Returns -1 when the whole run must be aborted
+	int poll();
+
+	// Hands the riskiest waiting hashes over to the engine : full batches
+	// while it has a free connection, everything when all is true
+	void submit(bool all);
+
+	// Applies the responses received within timeout milliseconds
+	// result becomes -1 when the whole run must be aborted
+	// Returns false once nothing is queued or in flight
+	bool wait(unsigned timeout, int& result);
+
+	// End of the run : summary lines, usage of the keys, the journal is
+	// deleted if the run is complete and every hash was looked up, what is
+	// left is dropped
+	void finish(bool complete);
+
+	// Totals of the run
+	size_t queued() const { return pending.size(); }
+	size_t answered() const { return answeredCount; }
+	size_t cached() const { return cachedCount; }
+	size_t known() const { return knownCount; }
+	size_t journaled() const { return journalCount; }
+	size_t duplicates() const { return duplicateItems.size(); }
+	size_t skipped() const { return skippedCount; }
+	size_t inFlight() { return engine.pending(); }
+
+	// Lowercase hexadecimal digest, as sent to VirusTotal
+	static std::string hexDigest(const uint8_t* digest, size_t size);
+
+private:
+	// one per distinct hash, the other items with the same hash are chained
+	// in duplicateItems and get the same verdict, the items coming after the
+	// verdict get it at once
+	struct PendingItem {
+		long itemID;
+		uint8_t digest[VT_DIGEST_KEY_SIZE];	// vtDigestKey
+		std::string hash;
+		int risk;			// vtRiskScore of the first item
+		bool requeued;		// already sent again after an unreadable or incomplete answer
+		int verdict;		// index in verdicts once answered, -1 before
+		int firstDuplicate;	// index in duplicateItems, -1 = none
+		int lastDuplicate;
+	};
+	struct DuplicateItem {
+		long itemID;
+		int next;			// -1 = end of the list
+	};
+
+	void recordAnswer(long itemID, const PendingItem& item, const VtVerdict& verdict);
+	bool requeue(size_t index);
+	size_t applyVerdicts(const std::vector<size_t>& items, const std::vector<VtVerdict>& received, size_t& requeued);
+	int handleResponse(const VtResponse& response);
+	void clearRun();
+
+	const VtConfig* config;
+	VtLog* log;
+	VtTimings* timings;
+	VtPipelineHost* host;
+
+	// kept from one run to the next
+	VtClient client;
+	VtEngine engine;
+	VtKeyPool keys;
+	VtCache cache;
+	VtKnownIndex knownIndex;
+	VtJournal runJournal;
+
+	// the run
+	std::vector<PendingItem> pending;
+	std::vector<DuplicateItem> duplicateItems;
+	VtHashIndex runIndex;				// digest -> index in pending
+	std::vector<VtVerdict> verdicts;	// verdicts received, without their raw report
+	VtPriorityQueue waiting;			// pending items not handed over yet
+	std::ofstream archive;				// raw reports, only when an archivefile is set
+	size_t batchSize;
+	size_t submitted;
+	size_t answeredCount;
+	size_t skippedCount;
+	size_t cachedCount;
+	size_t knownCount;
+	size_t journalCount;
+};
@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - risk-based lookup order
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtPriority.h"
+#include <algorithm>
+#include <cwctype>
+
+using namespace std;
+
+namespace
+{
+	struct Weight {
+		const wchar_t* pattern;
+		int score;
+	};
+
+	// Extensions, the riskiest first
+	const Weight kExtensions[] = {
+		// run as is
+		{ L"exe", 40 }, { L"dll", 40 }, { L"scr", 40 }, { L"sys", 35 }, { L"com", 35 }, { L"pif", 35 },
+		{ L"cpl", 35 }, { L"ocx", 30 }, { L"msi", 30 }, { L"efi", 30 },
+		// scripts and shortcuts
+		{ L"ps1", 35 }, { L"psm1", 30 }, { L"vbs", 35 }, { L"vbe", 35 }, { L"js", 30 }, { L"jse", 35 },
+		{ L"wsf", 35 }, { L"hta", 35 }, { L"bat", 30 }, { L"cmd", 30 }, { L"lnk", 25 }, { L"jar", 30 },
+		// documents able to carry macros or exploits
+		{ L"docm", 30 }, { L"xlsm", 30 }, { L"pptm", 30 }, { L"doc", 20 }, { L"xls", 20 }, { L"ppt", 15 },
+		{ L"rtf", 20 }, { L"pdf", 15 }, { L"chm", 25 },
+		// containers often used for delivery
+		{ L"iso", 20 }, { L"img", 15 }, { L"zip", 10 }, { L"rar", 10 }, { L"7z", 10 }, { L"cab", 10 },
+	};
+
+	// Words of longer type descriptions
+	const Weight kTypes[] = {
+		{ L"executable", 40 }, { L"script", 30 }, { L"shortcut", 25 }, { L"macro", 30 },
+	};
+
+	// Folders where malware is dropped or made persistent
+	const Weight kFolders[] = {
+		{ L"\\start menu\\programs\\startup\\", 30 }, { L"\\windows\\tasks\\", 25 },
+		{ L"\\system32\\tasks\\", 25 }, { L"\\temp\\", 25 }, { L"\\tmp\\", 20 },
+		{ L"\\downloads\\", 20 }, { L"\\content.outlook\\", 20 }, { L"\\inetcache\\", 15 },
+		{ L"\\temporary internet files\\", 15 }, { L"\\$recycle.bin\\", 10 },
+		{ L"\\appdata\\", 10 }, { L"\\programdata\\", 10 }, { L"\\users\\public\\", 10 },
+	};
+
+	int extensionWeight(const wstring& ext)
+	{
+		for (const Weight& weight : kExtensions) {
+			if (ext == weight.pattern) {
+				return weight.score;
+			}
+		}
+		return 0;
+	}
+
+	wstring lowercase(const wstring& text)
+	{
+		wstring lower(text);
+		transform(lower.begin(), lower.end(), lower.begin(), [](wchar_t c) { return (wchar_t)towlower(c); });
+		return lower;
+	}
+
+	// Best weight whose pattern is found in text
+	template <size_t N>
+	int bestMatch(const wstring& text, const Weight (&weights)[N])
+	{
+		int best = 0;
+		for (const Weight& weight : weights) {
+			if (weight.score > best && text.find(weight.pattern) != wstring::npos) {
+				best = weight.score;
+			}
+		}
+		return best;
+	}
+}
+
+int vtRiskScore(const VtItemTraits& item)
+{
+	int score = 0;
+
+	// extension and detected type, whichever is the riskiest
+	wstring name = lowercase(item.name);
+	size_t dot = name.find_last_of(L'.');
+	int extension = dot != wstring::npos ? extensionWeight(name.substr(dot + 1)) : 0;
+	wstring type = lowercase(item.type);
+	score += max(extension, max(extensionWeight(type), bestMatch(type, kTypes)));
+
+	// a signature that contradicts the extension is a classic disguise
+	if (item.typeStatus == VT_TYPE_MISMATCH) {
+		score += 30;
+	}
+
+	// most malware is between a few KB and a few dozen MB
+	if (item.size >= 4 * 1024 && item.size <= 32 * 1024 * 1024) {
+		score += 10;
+	}
+	else if (item.size > 256 * 1024 * 1024) {
+		score -= 20;
+	}
+
+	score += bestMatch(lowercase(item.path), kFolders);
+
+	if (item.flags & VT_ITEM_NOTABLE) {
+		score += 40;
+	}
+	if (item.flags & VT_ITEM_IRRELEVANT) {
+		score -= 40;
+	}
+	if (item.flags & VT_ITEM_INCONSISTENT) {
+		score += 10;
+	}
+	if (item.flags & VT_ITEM_TAGGED) {
+		score += 15;
+	}
+
+	// hidden or system file
+	if (item.attributes & 0x06) {
+		score += 10;
+	}
+	if (item.deleted) {
+		score += 5;
+	}
+
+	return score;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtPriorityQueue
+
+VtPriorityQueue::VtPriorityQueue()
+	: arrivals(0)
+{
+}
+
+// Heap order : lower score, then later arrival, comes last
+bool VtPriorityQueue::lower(const Entry& a, const Entry& b)
+{
+	if (a.score != b.score) {
+		return a.score < b.score;
+	}
+	return a.order > b.order;
+}
+
+void VtPriorityQueue::push(size_t item, int score)
+{
+	Entry entry;
+	entry.score = score;
+	entry.order = arrivals++;
+	entry.item = item;
+	heap.push_back(entry);
+	push_heap(heap.begin(), heap.end(), lower);
+}
+
+size_t VtPriorityQueue::pop()
+{
+	pop_heap(heap.begin(), heap.end(), lower);
+	size_t item = heap.back().item;
+	heap.pop_back();
+	return item;
+}
+
+void VtPriorityQueue::clear()
+{
+	heap.clear();
+	arrivals = 0;
+}
@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - risk-based lookup order
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// With a public key only a few thousand hashes can be looked up a day : the
+// queued items get a risk score and the riskiest are sent first, so that the
+// lookups that matter are done by the time the quota runs out.
+// The score only uses what X-Ways already knows about the item (extension,
+// detected type, size, folder, flags), nothing is read from the file.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// XWF_GetItemInformation(XWF_ITEM_INFO_FLAGS) bits used by the score
+#define VT_ITEM_TAGGED			0x00000020
+#define VT_ITEM_IRRELEVANT		0x00200000 // hash set category
+#define VT_ITEM_NOTABLE			0x00400000 // hash set category
+#define VT_ITEM_INCONSISTENT	0x08000000 // file format consistency not OK
+
+// XWF_GetItemType return value when the signature does not match the extension
+#define VT_TYPE_MISMATCH		6
+
+// What the score is computed from, filled by the caller from the XWF_* functions
+struct VtItemTraits {
+	std::wstring name;		// file name, for the extension
+	std::wstring path;		// parent folders, "\Users\x\Downloads\"
+	std::wstring type;		// type detected from the signature, e.g. "exe"
+	long typeStatus;		// XWF_GetItemType return value
+	long long size;
+	long long flags;		// XWF_ITEM_INFO_FLAGS
+	long long attributes;	// Windows attributes (hidden, system)
+	bool deleted;
+};
+
+// Higher is riskier, 0 for a plain file
+int vtRiskScore(const VtItemTraits& item);
+
+// Pending items by decreasing score, in arrival order for the same score
+class VtPriorityQueue {
+public:
+	VtPriorityQueue();
+
+	void push(size_t item, int score);
+	size_t pop();
+	bool empty() const { return heap.empty(); }
+	size_t size() const { return heap.size(); }
+	void clear();
+
+private:
+	struct Entry {
+		int score;
+		uint64_t order;
+		size_t item;
+	};
+	static bool lower(const Entry& a, const Entry& b);
+
+	std::vector<Entry> heap;
+	uint64_t arrivals;
+};
@@ -0,0 +1,307 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - report file
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtReport.h"
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	// Item names are UTF-16, the report is UTF-8
+	string toUtf8(const wstring& in)
+	{
+		string out;
+		out.reserve(in.size());
+		for (size_t i = 0; i < in.size(); i++) {
+			unsigned long cp = (unsigned long)in[i];
+			if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < in.size()
+				&& in[i + 1] >= 0xDC00 && in[i + 1] <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + ((unsigned long)in[i + 1] - 0xDC00);
+				i++;
+			}
+
+			if (cp < 0x80) {
+				out += (char)cp;
+			}
+			else if (cp < 0x800) {
+				out += (char)(0xC0 | (cp >> 6));
+				out += (char)(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				out += (char)(0xE0 | (cp >> 12));
+				out += (char)(0x80 | ((cp >> 6) & 0x3F));
+				out += (char)(0x80 | (cp & 0x3F));
+			}
+			else {
+				out += (char)(0xF0 | (cp >> 18));
+				out += (char)(0x80 | ((cp >> 12) & 0x3F));
+				out += (char)(0x80 | ((cp >> 6) & 0x3F));
+				out += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+		return out;
+	}
+
+	// RFC 4180 : fields with separators, quotes or line breaks are quoted
+	void appendCsv(string& out, const string& field)
+	{
+		if (field.find_first_of(",\"\r\n") == string::npos) {
+			out += field;
+			return;
+		}
+		out += '"';
+		for (char c : field) {
+			if (c == '"') {
+				out += '"';
+			}
+			out += c;
+		}
+		out += '"';
+	}
+
+	void appendJson(string& out, const string& text)
+	{
+		out += '"';
+		for (char c : text) {
+			switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char escape[8];
+					snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+					out += escape;
+				}
+				else {
+					out += c;
+				}
+			}
+		}
+		out += '"';
+	}
+
+	string score(const VtVerdict& verdict)
+	{
+		if (verdict.responseCode != 1) {
+			return "0/0";
+		}
+		return to_string(verdict.positives) + "/" + to_string(verdict.total);
+	}
+
+	// The hash sent is the one of the volume snapshot : its type by its
+	// length, as in writeText, named like the --types of the tools
+	const char* hashType(const string& hash)
+	{
+		return hash.size() == 32 ? "md5" : (hash.size() == 64 ? "sha256" : "sha1");
+	}
+}
+
+VtReport::VtReport()
+	: console(false), format(VT_REPORT_TEXT)
+{
+}
+
+VtReport::~VtReport()
+{
+	close();
+}
+
+bool VtReport::parseFormat(const string& name, VtReportFormat& format)
+{
+	if (name == "text") {
+		format = VT_REPORT_TEXT;
+	}
+	else if (name == "csv") {
+		format = VT_REPORT_CSV;
+	}
+	else if (name == "jsonl") {
+		format = VT_REPORT_JSONL;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+bool VtReport::open(const string& path, VtReportFormat reportFormat)
+{
+	close();
+
+	console = path == "-";
+	if (!console) {
+		file.clear();
+		file.open(path, ios::app | ios::binary);
+		if (!file) {
+			return false;
+		}
+	}
+
+	format = reportFormat;
+	buffer.reserve(VT_REPORT_BUFFER + 4096);
+	lastFlush = steady_clock::now();
+
+	// new CSV file : column names first
+	if (!console) {
+		file.seekp(0, ios::end);
+	}
+	if (format == VT_REPORT_CSV && (console || file.tellp() == streampos(0))) {
+		buffer += "item_id,name,hash,hash_type,size,known,positives,total,scan_date,permalink,engines,cached\n";
+	}
+	return true;
+}
+
+void VtReport::close()
+{
+	if (!isOpen()) {
+		return;
+	}
+	flush();
+	if (file.is_open()) {
+		file.close();
+	}
+	console = false;
+	buffer.clear();
+}
+
+void VtReport::flush()
+{
+	if (!buffer.empty() && isOpen()) {
+		ostream& out = console ? cout : file;
+		out.write(buffer.data(), buffer.size());
+		out.flush();
+	}
+	buffer.clear();
+	lastFlush = steady_clock::now();
+}
+
+void VtReport::write(long itemID, const wstring& name, long long size,
+	const string& hash, const VtVerdict& verdict, bool cached)
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	string utf8Name = toUtf8(name);
+	switch (format) {
+	case VT_REPORT_CSV:
+		writeCsv(itemID, utf8Name, size, hash, verdict, cached);
+		break;
+	case VT_REPORT_JSONL:
+		writeJson(itemID, utf8Name, size, hash, verdict, cached);
+		break;
+	default:
+		writeText(utf8Name, size, hash, verdict);
+		break;
+	}
+
+	if (buffer.size() >= VT_REPORT_BUFFER
+		|| steady_clock::now() - lastFlush >= milliseconds(VT_REPORT_FLUSH_MS)) {
+		flush();
+	}
+}
+
+void VtReport::writeKnown(long itemID, const wstring& name, long long size, const string& hash)
+{
+	if (!isOpen() || format != VT_REPORT_JSONL) {
+		return;
+	}
+
+	buffer += "{\"item_id\":" + to_string(itemID) + ",\"name\":";
+	appendJson(buffer, toUtf8(name));
+	buffer += ",\"hash\":";
+	appendJson(buffer, hash);
+	buffer += ",\"hash_type\":\"" + string(hashType(hash)) + "\"";
+	buffer += ",\"size\":" + to_string(size) + ",\"known_index\":true}\n";
+
+	if (buffer.size() >= VT_REPORT_BUFFER
+		|| steady_clock::now() - lastFlush >= milliseconds(VT_REPORT_FLUSH_MS)) {
+		flush();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Formats
+
+void VtReport::writeText(const string& name, long long size, const string& hash, const VtVerdict& verdict)
+{
+	buffer += "[+] " + name + "\n\n";
+	const char* type = hash.size() == 32 ? "MD5" : (hash.size() == 64 ? "SHA256" : "SHA1");
+	buffer += ">> Hash " + string(type) + " of :\n" + hash + "\n";
+	buffer += ">> Score VirusTotal:\n" + score(verdict) + "\n";
+	buffer += ">> Bytes Size:\n" + to_string(size) + " Bytes\n";
+
+	// engines listed in config.ini
+	if (!verdict.engines.empty()) {
+		buffer += ">> Engines:\n";
+		for (const VtEngineResult& engine : verdict.engines) {
+			buffer += engine.engine + " : " + (engine.detected ? engine.result : "-") + "\n";
+		}
+	}
+	buffer += "\n";
+}
+
+void VtReport::writeCsv(long itemID, const string& name, long long size,
+	const string& hash, const VtVerdict& verdict, bool cached)
+{
+	buffer += to_string(itemID) + ",";
+	appendCsv(buffer, name);
+	buffer += "," + hash + "," + hashType(hash) + "," + to_string(size) + ",";
+	buffer += verdict.responseCode == 1 ? "1," : "0,";
+	buffer += to_string(verdict.positives) + "," + to_string(verdict.total) + ",";
+	appendCsv(buffer, verdict.scanDate);
+	buffer += ",";
+	appendCsv(buffer, verdict.permalink);
+	buffer += ",";
+
+	// Engine=result;Engine=result, detections only
+	string engines;
+	for (const VtEngineResult& engine : verdict.engines) {
+		if (engine.detected) {
+			engines += (engines.empty() ? "" : ";") + engine.engine + "=" + engine.result;
+		}
+	}
+	appendCsv(buffer, engines);
+	buffer += cached ? ",1\n" : ",0\n";
+}
+
+void VtReport::writeJson(long itemID, const string& name, long long size,
+	const string& hash, const VtVerdict& verdict, bool cached)
+{
+	buffer += "{\"item_id\":" + to_string(itemID) + ",\"name\":";
+	appendJson(buffer, name);
+	buffer += ",\"hash\":";
+	appendJson(buffer, hash);
+	buffer += ",\"hash_type\":\"" + string(hashType(hash)) + "\"";
+	buffer += ",\"size\":" + to_string(size);
+	buffer += verdict.responseCode == 1 ? ",\"known\":true" : ",\"known\":false";
+	buffer += ",\"positives\":" + to_string(verdict.positives) + ",\"total\":" + to_string(verdict.total);
+	buffer += ",\"scan_date\":";
+	appendJson(buffer, verdict.scanDate);
+	buffer += ",\"permalink\":";
+	appendJson(buffer, verdict.permalink);
+
+	buffer += ",\"engines\":{";
+	for (size_t i = 0; i < verdict.engines.size(); i++) {
+		const VtEngineResult& engine = verdict.engines[i];
+		if (i > 0) {
+			buffer += ",";
+		}
+		appendJson(buffer, engine.engine);
+		buffer += ":";
+		if (engine.detected) {
+			appendJson(buffer, engine.result);
+		}
+		else {
+			buffer += "null";
+		}
+	}
+	buffer += cached ? "},\"cached\":true}\n" : "},\"cached\":false}\n";
+}
@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - report file
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// The report file is opened once per run, the entries are built in memory
+// and written by large blocks : when the buffer is full, every few seconds
+// and when the run ends. Three formats :
+// - text  : the historical free-text report
+// - csv   : one line per item, with a header line when the file is created
+// - jsonl : one JSON object per item (JSON Lines)
+// "-" writes to the standard output (tools/vtscan).
+
+#pragma once
+#include "VtLookup.h"
+#include <string>
+#include <fstream>
+#include <chrono>
+
+#define VT_REPORT_BUFFER	(1 << 20) // bytes kept before writing
+#define VT_REPORT_FLUSH_MS	5000
+
+enum VtReportFormat {
+	VT_REPORT_TEXT,
+	VT_REPORT_CSV,
+	VT_REPORT_JSONL
+};
+
+class VtReport {
+public:
+	VtReport();
+	~VtReport();
+
+	// Appends to the file, "-" for the standard output, false if it cannot be opened
+	bool open(const std::string& path, VtReportFormat format);
+	void close();
+	bool isOpen() const { return file.is_open() || console; }
+
+	// Adds the verdict of an item, unknown files (response_code != 1) get a 0/0 score
+	void write(long itemID, const std::wstring& name, long long size,
+		const std::string& hash, const VtVerdict& verdict, bool cached);
+
+	// Adds an item of the known-hash index, not sent : jsonl only, with
+	// "known_index":true instead of the verdict
+	void writeKnown(long itemID, const std::wstring& name, long long size, const std::string& hash);
+
+	// Writes the buffered entries
+	void flush();
+
+	// "text", "csv" or "jsonl"
+	static bool parseFormat(const std::string& name, VtReportFormat& format);
+
+private:
+	void writeText(const std::string& name, long long size, const std::string& hash, const VtVerdict& verdict);
+	void writeCsv(long itemID, const std::string& name, long long size,
+		const std::string& hash, const VtVerdict& verdict, bool cached);
+	void writeJson(long itemID, const std::string& name, long long size,
+		const std::string& hash, const VtVerdict& verdict, bool cached);
+
+	std::ofstream file;
+	bool console;			// standard output instead of file
+	VtReportFormat format;
+	std::string buffer;
+	std::chrono::steady_clock::time_point lastFlush;
+};
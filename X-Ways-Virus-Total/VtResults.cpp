@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - item updates
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtResults.h"
+#include <algorithm>
+#include <cwchar>
+
+using namespace std;
+
+VtResultStore::VtResultStore()
+	: commentCount(0), tableCount(0)
+{
+}
+
+void VtResultStore::addScore(long itemID, int responseCode, int positives, int total, bool reported)
+{
+	VtItemResult result;
+	result.itemID = itemID;
+	result.kind = (unsigned char)(responseCode == 1 ? VT_RESULT_SCORE : VT_RESULT_NOT_FOUND);
+	result.positives = responseCode == 1 ? positives : 0;
+	result.total = responseCode == 1 ? total : 0;
+	result.reported = reported;
+	results.push_back(result);
+}
+
+void VtResultStore::addKnown(long itemID)
+{
+	VtItemResult result = {};
+	result.itemID = itemID;
+	result.kind = VT_RESULT_KNOWN;
+	results.push_back(result);
+}
+
+size_t VtResultStore::apply(VtResultTarget& target)
+{
+	// item order : X-Ways reads and writes its item list sequentially,
+	// stable so that the last result of an item stays last
+	stable_sort(results.begin(), results.end(),
+		[](const VtItemResult& a, const VtItemResult& b) { return a.itemID < b.itemID; });
+
+	size_t written = 0;
+	wchar_t comment[VT_RESULTS_COMMENT];
+	for (size_t i = 0; i < results.size(); i++) {
+		if (i + 1 < results.size() && results[i + 1].itemID == results[i].itemID) {
+			continue;
+		}
+		const VtItemResult& result = results[i];
+		formatComment(result, comment, VT_RESULTS_COMMENT);
+		target.addComment(result.itemID, comment);
+		commentCount++;
+		if (result.reported) {
+			target.addToReportTable(result.itemID);
+			tableCount++;
+		}
+		written++;
+	}
+
+	// the capacity is kept for the next checkpoint
+	results.clear();
+	return written;
+}
+
+void VtResultStore::clear()
+{
+	results.clear();
+	commentCount = 0;
+	tableCount = 0;
+}
+
+void VtResultStore::formatComment(const VtItemResult& result, wchar_t* comment, size_t size)
+{
+	if (size == 0) {
+		return;
+	}
+	switch (result.kind) {
+	case VT_RESULT_SCORE:
+		swprintf(comment, size, L"%d/%d", result.positives, result.total);
+		break;
+	case VT_RESULT_NOT_FOUND:
+		// unknown files keep the "0/0" score
+		swprintf(comment, size, L"0/0");
+		break;
+	default:
+		swprintf(comment, size, L"Known file (hash set), not sent to VirusTotal");
+		break;
+	}
+	comment[size - 1] = L'\0';
+}
@@ -0,0 +1,75 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - item updates
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// The comment and the report table entry of an item are not written when its
+// verdict arrives, between two items and two network reads : the verdicts
+// are staged in a compact list and written in one loop, by checkpoints of
+// VT_RESULTS_CHECKPOINT items and at the end of the run, sorted by item and
+// with one update per item. An item gets its comment and its report table
+// entry in the same pass, a run stopped in the middle never leaves one
+// without the other ; the verdicts staged but not written are in the
+// journal, the next run writes them.
+// Written through VtResultTarget : XWF_AddComment / XWF_AddToReportTable in
+// X-Ways.
+
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#define VT_RESULTS_CHECKPOINT	4096	// items staged before they are written
+#define VT_RESULTS_COMMENT		64		// characters of a comment
+
+enum VtResultKind {
+	VT_RESULT_SCORE,		// "positives/total"
+	VT_RESULT_NOT_FOUND,	// unknown to VirusTotal, "0/0"
+	VT_RESULT_KNOWN			// known-hash index, not sent
+};
+
+struct VtItemResult {
+	long itemID;
+	int positives;
+	int total;
+	unsigned char kind;		// VtResultKind
+	bool reported;			// goes to the report table
+};
+
+// Where the updates go, called from the thread calling apply()
+class VtResultTarget {
+public:
+	virtual ~VtResultTarget() {}
+
+	virtual void addToReportTable(long itemID) = 0;
+	virtual void addComment(long itemID, wchar_t* comment) = 0;
+};
+
+class VtResultStore {
+public:
+	VtResultStore();
+
+	// responseCode : 1 = found by VirusTotal
+	void addScore(long itemID, int responseCode, int positives, int total, bool reported);
+	void addKnown(long itemID);
+
+	size_t pending() const { return results.size(); }
+	bool checkpointDue() const { return results.size() >= VT_RESULTS_CHECKPOINT; }
+
+	// Writes the staged items, the last result of an item wins
+	// Returns the items written
+	size_t apply(VtResultTarget& target);
+
+	// Drops the staged items and the totals, new run
+	void clear();
+
+	// Totals since clear()
+	size_t commented() const { return commentCount; }
+	size_t tableEntries() const { return tableCount; }
+
+	// Comment of an item, always terminated
+	static void formatComment(const VtItemResult& result, wchar_t* comment, size_t size);
+
+private:
+	std::vector<VtItemResult> results;
+	size_t commentCount;
+	size_t tableCount;
+};
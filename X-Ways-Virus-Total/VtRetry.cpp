@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - retry policies
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtRetry.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	// Indexed by VtErrorClass
+	const VtRetryPolicy kPolicies[] = {
+		{ 1, 0, 0, false },				// none
+		{ 5, 1000, 30000, true },		// network
+		{ 3, 1000, 30000, true },		// timeout : each send already waited requesttimeout
+		{ 5, 2000, 60000, true },		// server
+		{ 0, 0, 0, false },				// quota : paced and ended by the key pool
+		{ 0, 0, 0, false },				// denied : the next key is tried
+		{ 1, 0, 0, false },				// request
+	};
+}
+
+VtErrorClass vtErrorClass(long httpCode, bool timedOut)
+{
+	if (httpCode == 200) {
+		return VT_ERROR_NONE;
+	}
+	if (httpCode == 0) {
+		return timedOut ? VT_ERROR_TIMEOUT : VT_ERROR_NETWORK;
+	}
+	if (httpCode == 204) {
+		return VT_ERROR_QUOTA;
+	}
+	if (httpCode == 403) {
+		return VT_ERROR_DENIED;
+	}
+	if (httpCode == 429 || (httpCode >= 500 && httpCode <= 599)) {
+		return VT_ERROR_SERVER;
+	}
+	return VT_ERROR_REQUEST;
+}
+
+const VtRetryPolicy& vtRetryPolicy(VtErrorClass error)
+{
+	return kPolicies[error];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtRetryBudget
+
+VtRetryBudget::VtRetryBudget()
+	: successes(0), spent(0)
+{
+}
+
+void VtRetryBudget::reset()
+{
+	successes = 0;
+	spent = 0;
+}
+
+void VtRetryBudget::succeeded()
+{
+	successes++;
+}
+
+bool VtRetryBudget::withdraw()
+{
+	if (spent >= VT_RETRY_MIN_BUDGET + successes / VT_RETRY_RATIO) {
+		return false;
+	}
+	spent++;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtBackoff
+
+VtBackoff::VtBackoff()
+	: rng(random_device()())
+{
+}
+
+unsigned VtBackoff::delayMs(const VtRetryPolicy& policy, unsigned attempt)
+{
+	if (policy.baseMs == 0) {
+		return 0;
+	}
+
+	// base * 2^(attempt - 1), capped, then a random delay below it
+	unsigned long long bound = policy.baseMs;
+	for (unsigned i = 1; i < attempt && bound < policy.maxMs; i++) {
+		bound *= 2;
+	}
+	bound = min<unsigned long long>(bound, policy.maxMs);
+	return uniform_int_distribution<unsigned>(0, (unsigned)bound)(rng);
+}
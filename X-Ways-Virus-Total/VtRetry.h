@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - retry policies
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// A failed request is sorted into an error class, each class has its own
+// policy : how many sends, and the exponential backoff between them. The
+// delay is drawn at random below the exponential bound ("full jitter") so
+// that requests failed together do not come back together.
+// A retry budget shared by the whole run caps the retries to a share of the
+// requests : when VirusTotal is down the run gives up quickly instead of
+// hammering it.
+
+#pragma once
+#include <random>
+
+enum VtErrorClass {
+	VT_ERROR_NONE,		// HTTP 200
+	VT_ERROR_NETWORK,	// no HTTP answer : DNS, connection, TLS
+	VT_ERROR_TIMEOUT,	// connecttimeout or requesttimeout reached, the server stalls
+	VT_ERROR_SERVER,	// HTTP 5xx and 429, VirusTotal is struggling
+	VT_ERROR_QUOTA,		// HTTP 204, handled by the key pool
+	VT_ERROR_DENIED,	// HTTP 403, the key is dropped
+	VT_ERROR_REQUEST	// any other status, sending it again changes nothing
+};
+
+struct VtRetryPolicy {
+	unsigned maxAttempts;	// sends, the first one included, 0 = no limit
+	unsigned baseMs;		// bound of the first backoff, doubled each time
+	unsigned maxMs;			// bound of any backoff
+	bool budgeted;			// retry taken from the run budget
+};
+
+// Retries always allowed, then one per VT_RETRY_RATIO successful requests
+#define VT_RETRY_MIN_BUDGET	20
+#define VT_RETRY_RATIO		5
+
+// timedOut : the transfer ended with CURLE_OPERATION_TIMEDOUT, httpCode is 0
+VtErrorClass vtErrorClass(long httpCode, bool timedOut);
+
+const VtRetryPolicy& vtRetryPolicy(VtErrorClass error);
+
+class VtRetryBudget {
+public:
+	VtRetryBudget();
+
+	void reset();
+
+	// A request answered on its first send
+	void succeeded();
+
+	// Takes one retry, false when the budget is spent
+	bool withdraw();
+
+	unsigned retries() const { return spent; }
+
+private:
+	unsigned successes;
+	unsigned spent;
+};
+
+// Backoff before the send number attempt + 1, attempt >= 1
+class VtBackoff {
+public:
+	VtBackoff();
+
+	unsigned delayMs(const VtRetryPolicy& policy, unsigned attempt);
+
+private:
+	std::mt19937 rng;
+};
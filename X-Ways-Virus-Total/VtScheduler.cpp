@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - quota scheduler
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtScheduler.h"
+#include <ctime>
+#include <fstream>
+#include <climits>
+#include <algorithm>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	// Current UTC day (yyyymmdd) and month (yyyymm)
+	void utcWindows(int& day, int& month)
+	{
+		struct tm t = {};
+		time_t now = time(nullptr);
+#ifdef _WIN32
+		gmtime_s(&t, &now);
+#else
+		gmtime_r(&now, &t);
+#endif
+
+		month = (t.tm_year + 1900) * 100 + t.tm_mon + 1;
+		day = month * 100 + t.tm_mday;
+	}
+}
+
+VtScheduler::VtScheduler()
+	: minuteLimit(0), dayLimit(0), monthLimit(0), day(0), dayUsed(0), month(0), monthUsed(0)
+{
+}
+
+void VtScheduler::configure(int perMinute, int perDay, int perMonth)
+{
+	lock_guard<mutex> guard(lock);
+	minuteLimit = perMinute;
+	dayLimit = perDay;
+	monthLimit = perMonth;
+	spent.clear();
+	pausedUntil = steady_clock::time_point();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Quota file : "<yyyymmdd> <used> <yyyymm> <used>"
+
+bool VtScheduler::load(const string& quotaPath)
+{
+	lock_guard<mutex> guard(lock);
+	path = quotaPath;
+	day = dayUsed = month = monthUsed = 0;
+
+	ifstream quotaFile(path);
+	if (quotaFile) {
+		quotaFile >> day >> dayUsed >> month >> monthUsed;
+	}
+	rollWindows();
+	return (bool)quotaFile;
+}
+
+bool VtScheduler::save()
+{
+	lock_guard<mutex> guard(lock);
+	if (path.empty()) {
+		return false;
+	}
+
+	rollWindows();
+	ofstream quotaFile(path, ios::trunc);
+	quotaFile << day << " " << dayUsed << " " << month << " " << monthUsed << "\n";
+	return quotaFile.good();
+}
+
+// Starts new day / month windows when the calendar moved on
+void VtScheduler::rollWindows()
+{
+	int today, thisMonth;
+	utcWindows(today, thisMonth);
+
+	if (day != today) {
+		day = today;
+		dayUsed = 0;
+	}
+	if (month != thisMonth) {
+		month = thisMonth;
+		monthUsed = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buckets
+
+VtGrant VtScheduler::reserve(unsigned& waitMs)
+{
+	lock_guard<mutex> guard(lock);
+	waitMs = 0;
+
+	rollWindows();
+	if ((dayLimit > 0 && dayUsed >= dayLimit) || (monthLimit > 0 && monthUsed >= monthLimit)) {
+		return VT_EXHAUSTED;
+	}
+
+	steady_clock::time_point now = steady_clock::now();
+	if (now < pausedUntil) {
+		waitMs = (unsigned)duration_cast<milliseconds>(pausedUntil - now).count() + 1;
+		return VT_WAIT;
+	}
+
+	if (minuteLimit > 0) {
+		// tokens spent more than a minute ago are back
+		while (!spent.empty() && now - spent.front() >= minutes(1)) {
+			spent.pop_front();
+		}
+
+		if ((int)spent.size() >= minuteLimit) {
+			waitMs = (unsigned)duration_cast<milliseconds>(spent.front() + minutes(1) - now).count() + 1;
+			return VT_WAIT;
+		}
+		spent.push_back(now);
+	}
+
+	dayUsed++;
+	monthUsed++;
+	return VT_GRANTED;
+}
+
+void VtScheduler::backoff()
+{
+	lock_guard<mutex> guard(lock);
+	steady_clock::time_point now = steady_clock::now();
+
+	pausedUntil = now + minutes(1);
+	if (minuteLimit > 0) {
+		spent.assign(minuteLimit, now);
+	}
+}
+
+int VtScheduler::remaining()
+{
+	lock_guard<mutex> guard(lock);
+	rollWindows();
+
+	steady_clock::time_point now = steady_clock::now();
+	if (now < pausedUntil) {
+		return 0;
+	}
+
+	int left = INT_MAX;
+	if (minuteLimit > 0) {
+		while (!spent.empty() && now - spent.front() >= minutes(1)) {
+			spent.pop_front();
+		}
+		left = min(left, minuteLimit - (int)spent.size());
+	}
+	if (dayLimit > 0) {
+		left = min(left, dayLimit - dayUsed);
+	}
+	if (monthLimit > 0) {
+		left = min(left, monthLimit - monthUsed);
+	}
+	return max(left, 0);
+}
+
+int VtScheduler::usedToday()
+{
+	lock_guard<mutex> guard(lock);
+	rollWindows();
+	return dayUsed;
+}
+
+int VtScheduler::usedThisMonth()
+{
+	lock_guard<mutex> guard(lock);
+	rollWindows();
+	return monthUsed;
+}
@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - quota scheduler
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Three token buckets, one per VirusTotal quota :
+// - per minute : a token spent comes back exactly one minute later, so no
+//                sliding minute ever sees more requests than the quota
+// - per day / per month : calendar windows (UTC), the usage is saved to
+//                the quota file so the caps hold across runs
+// A request is only sent once a token has been reserved in every bucket.
+
+#pragma once
+#include <string>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+enum VtGrant {
+	VT_GRANTED,		// token reserved, the request can be sent
+	VT_WAIT,		// minute quota used, retry after the returned delay
+	VT_EXHAUSTED	// daily or monthly quota used, nothing more today
+};
+
+class VtScheduler {
+public:
+	VtScheduler();
+
+	// 0 = no limit
+	void configure(int perMinute, int perDay, int perMonth);
+
+	// Day / month usage of the key, kept between runs
+	bool load(const std::string& path);
+	bool save();
+
+	// Reserves one request, waitMs receives the delay when VT_WAIT is returned
+	VtGrant reserve(unsigned& waitMs);
+
+	// HTTP 204 : VirusTotal refused the request, pause for one minute and
+	// spend the whole minute bucket so that it refills from scratch
+	void backoff();
+
+	// Requests that could be sent right now, INT_MAX when nothing limits them
+	int remaining();
+
+	int usedToday();
+	int usedThisMonth();
+	int perDay() const { return dayLimit; }
+	int perMonth() const { return monthLimit; }
+
+private:
+	void rollWindows();
+
+	std::mutex lock;
+	int minuteLimit;
+	int dayLimit;
+	int monthLimit;
+
+	std::deque<std::chrono::steady_clock::time_point> spent; // minute tokens in use
+	std::chrono::steady_clock::time_point pausedUntil;
+
+	std::string path;
+	int day;		// yyyymmdd (UTC) of dayUsed
+	int dayUsed;
+	int month;		// yyyymm (UTC) of monthUsed
+	int monthUsed;
+};
@@ -0,0 +1,233 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - stage timings
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VtTiming.h"
+#include <fstream>
+#include <cstdio>
+#include <ctime>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	const char* kStageNames[VT_STAGE_COUNT] = {
+		"run",
+		"item",
+		"hash",
+		"hasher",
+		"lookup",
+		"risk",
+		"http",
+		"parse",
+		"report table",
+		"report file",
+		"journal",
+		"wait"
+	};
+
+	// Position of the highest bit set, ns > 0
+	int highestBit(uint64_t ns)
+	{
+#ifdef _MSC_VER
+		unsigned long bit = 0;
+		_BitScanReverse64(&bit, ns);
+		return (int)bit;
+#else
+		return 63 - __builtin_clzll(ns);
+#endif
+	}
+
+	// Current UTC time, yyyy-mm-dd hh:mm:ss
+	string utcNow()
+	{
+		struct tm t = {};
+		time_t now = time(nullptr);
+#ifdef _WIN32
+		gmtime_s(&t, &now);
+#else
+		gmtime_r(&now, &t);
+#endif
+		char buf[32];
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+		return buf;
+	}
+
+	// RFC 4180 : fields with separators, quotes or line breaks are quoted
+	string csvField(const string& field)
+	{
+		if (field.find_first_of(",\"\r\n") == string::npos) {
+			return field;
+		}
+		string quoted = "\"";
+		for (char c : field) {
+			if (c == '"') {
+				quoted += '"';
+			}
+			quoted += c;
+		}
+		return quoted + "\"";
+	}
+}
+
+const char* vtStageName(VtStage stage)
+{
+	return stage < VT_STAGE_COUNT ? kStageNames[stage] : "";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtHistogram
+
+VtHistogram::VtHistogram()
+	: buckets(new atomic<uint64_t>[VT_HISTOGRAM_BUCKETS]), samples(0), sum(0), largest(0)
+{
+	clear();
+}
+
+void VtHistogram::clear()
+{
+	for (size_t i = 0; i < VT_HISTOGRAM_BUCKETS; i++) {
+		buckets[i].store(0, memory_order_relaxed);
+	}
+	samples.store(0, memory_order_relaxed);
+	sum.store(0, memory_order_relaxed);
+	largest.store(0, memory_order_relaxed);
+}
+
+// Below 32 ns one bucket per value, then 32 buckets between two powers of two
+size_t VtHistogram::bucketOf(uint64_t ns)
+{
+	const uint64_t exact = 1ULL << VT_HISTOGRAM_SUB_BITS;
+	if (ns < exact) {
+		return (size_t)ns;
+	}
+	int shift = highestBit(ns) - VT_HISTOGRAM_SUB_BITS;
+	size_t sub = (size_t)((ns >> shift) & (exact - 1));
+	return ((size_t)(shift + 1) << VT_HISTOGRAM_SUB_BITS) + sub;
+}
+
+// Middle of the bucket
+uint64_t VtHistogram::valueOf(size_t bucket)
+{
+	const uint64_t exact = 1ULL << VT_HISTOGRAM_SUB_BITS;
+	if (bucket < exact) {
+		return bucket;
+	}
+	int shift = (int)(bucket >> VT_HISTOGRAM_SUB_BITS) - 1;
+	uint64_t low = (exact + (bucket & (exact - 1))) << shift;
+	return low + ((1ULL << shift) >> 1);
+}
+
+// Counters only, no ordering between them : they are read once the threads
+// are done
+void VtHistogram::add(uint64_t ns)
+{
+	buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+	samples.fetch_add(1, memory_order_relaxed);
+	sum.fetch_add(ns, memory_order_relaxed);
+	uint64_t seen = largest.load(memory_order_relaxed);
+	while (ns > seen && !largest.compare_exchange_weak(seen, ns, memory_order_relaxed)) {
+	}
+}
+
+uint64_t VtHistogram::percentile(double p) const
+{
+	uint64_t n = count();
+	uint64_t top = maximum();
+	if (n == 0) {
+		return 0;
+	}
+
+	// nearest rank
+	uint64_t rank = (uint64_t)(p * n + 0.999999);
+	rank = rank < 1 ? 1 : (rank > n ? n : rank);
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < VT_HISTOGRAM_BUCKETS; i++) {
+		seen += buckets[i].load(memory_order_relaxed);
+		if (seen >= rank) {
+			uint64_t value = valueOf(i);
+			return value < top ? value : top;
+		}
+	}
+	return top;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtTimings
+
+void VtTimings::clear()
+{
+	for (VtHistogram& histogram : stages) {
+		histogram.clear();
+	}
+}
+
+void VtTimings::add(VtStage stage, uint64_t ns)
+{
+	if (stage < VT_STAGE_COUNT) {
+		stages[stage].add(ns);
+	}
+}
+
+void VtTimings::addSeconds(VtStage stage, double seconds)
+{
+	add(stage, seconds > 0 ? (uint64_t)(seconds * 1e9) : 0);
+}
+
+bool VtTimings::writeCsv(const string& path, const string& label) const
+{
+	ofstream file(path, ios::app | ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	// new file : column names first
+	file.seekp(0, ios::end);
+	if (file.tellp() == streampos(0)) {
+		file << "date,label,stage,count,total_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+	}
+
+	string date = utcNow();
+	string quotedLabel = csvField(label);
+	for (int i = 0; i < VT_STAGE_COUNT; i++) {
+		const VtHistogram& histogram = stages[i];
+		if (histogram.count() == 0) {
+			continue;
+		}
+		char line[256];
+		snprintf(line, sizeof(line), ",%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+			kStageNames[i], (unsigned long long)histogram.count(),
+			histogram.total() / 1e6, histogram.mean() / 1e6, histogram.percentile(0.50) / 1e6,
+			histogram.percentile(0.95) / 1e6, histogram.percentile(0.99) / 1e6, histogram.maximum() / 1e6);
+		file << date << "," << quotedLabel << line;
+	}
+	return (bool)file;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VtStageTimer
+
+VtStageTimer::VtStageTimer(VtTimings& stageTimings, VtStage timedStage)
+	: timings(stageTimings), stage(timedStage), started(steady_clock::now()), running(true)
+{
+}
+
+VtStageTimer::~VtStageTimer()
+{
+	stop();
+}
+
+void VtStageTimer::stop()
+{
+	if (running) {
+		running = false;
+		timings.add(stage, (uint64_t)duration_cast<nanoseconds>(steady_clock::now() - started).count());
+	}
+}
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - stage timings
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Each stage of the pipeline (hash retrieval, local lookups, HTTP, JSON
+// parsing, report table, files...) is timed with the monotonic clock and its
+// durations go to a histogram : 32 buckets per power of two, so that the
+// percentiles are within 2 % whatever the scale, from nanoseconds to hours,
+// in a fixed amount of memory.
+// The stages nest : "item" is the whole XT_ProcessItemEx call and includes
+// the stages run inside it.
+// Recorded from the threads X-Ways calls XT_ProcessItemEx from : add() only
+// increments atomic counters, the threads never wait for each other. The
+// times measured by the worker threads come back with their results.
+
+#pragma once
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#define VT_HISTOGRAM_SUB_BITS	5 // 32 buckets per power of two
+#define VT_HISTOGRAM_BUCKETS	((64 - VT_HISTOGRAM_SUB_BITS + 1) << VT_HISTOGRAM_SUB_BITS)
+
+enum VtStage {
+	VT_STAGE_RUN,			// XT_Prepare to the end of XT_Finalize
+	VT_STAGE_ITEM,			// XT_ProcessItemEx
+	VT_STAGE_HASH,			// XWF_GetHashValue
+	VT_STAGE_HASHER,		// item hashed by a worker thread (VtHasher)
+	VT_STAGE_LOOKUP,		// known-hash index, cache, journal, duplicates
+	VT_STAGE_RISK,			// risk score of a queued item
+	VT_STAGE_HTTP,			// request on the wire, connection included
+	VT_STAGE_PARSE,			// JSON parsing of a response
+	VT_STAGE_REPORT_TABLE,	// XWF_AddToReportTable and XWF_AddComment
+	VT_STAGE_REPORT_FILE,	// report and archive files
+	VT_STAGE_JOURNAL,		// resume journal, flushes to disk included
+	VT_STAGE_WAIT,			// XT_Finalize waiting for hashes and responses
+	VT_STAGE_COUNT
+};
+
+const char* vtStageName(VtStage stage);
+
+// add() can be called from several threads at once, clear() and the
+// readers run once they are done
+class VtHistogram {
+public:
+	VtHistogram();
+
+	void clear();
+	void add(uint64_t ns);
+
+	uint64_t count() const { return samples.load(std::memory_order_relaxed); }
+	uint64_t total() const { return sum.load(std::memory_order_relaxed); }
+	uint64_t maximum() const { return largest.load(std::memory_order_relaxed); }
+	uint64_t mean() const { return count() ? total() / count() : 0; }
+
+	// Duration under which a share p (0..1) of the samples fall, 0 if none
+	uint64_t percentile(double p) const;
+
+private:
+	static size_t bucketOf(uint64_t ns);
+	static uint64_t valueOf(size_t bucket);
+
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+	std::atomic<uint64_t> samples;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> largest;
+};
+
+class VtTimings {
+public:
+	void clear();
+
+	void add(VtStage stage, uint64_t ns);
+	void addSeconds(VtStage stage, double seconds);
+
+	// Once the threads are done
+	const VtHistogram& stage(VtStage stage) const { return stages[stage]; }
+
+	// Appends one line per timed stage : when, label, stage, count, total,
+	// mean, p50, p95, p99 and max in milliseconds. The column names are
+	// written when the file is created. False if it cannot be written.
+	bool writeCsv(const std::string& path, const std::string& label) const;
+
+private:
+	VtHistogram stages[VT_STAGE_COUNT];
+};
+
+// Times a scope, or up to stop()
+class VtStageTimer {
+public:
+	VtStageTimer(VtTimings& timings, VtStage stage);
+	~VtStageTimer();
+
+	void stop();
+
+private:
+	VtTimings& timings;
+	VtStage stage;
+	std::chrono::steady_clock::time_point started;
+	bool running;
+};
@@ -7,75 +7,403 @@
 // for current documentation
 
 #include "X-Vt.h"
+#include "VtConfig.h"
+#include "VtPipeline.h"
+#include "VtReport.h"
+#include "VtPriority.h"
+#include "VtHasher.h"
+#include "VtTiming.h"
+#include "VtLog.h"
+#include "VtResults.h"
+#include "VtFilter.h"
 #include "../XT_Main/X-Tension.h"
 #include <sstream>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <curl/curl.h>
-#include <json/json.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+#include <mutex>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
 #include <locale>
 #include <codecvt>
-#include <windows.h>
+#endif
 
 //const int XWF_VSPROP_HASHTYPE1 = 20;
 //const int XWF_VSPROP_HASHTYPE2 = 21;
 //const int HASH_SIZE = 20; //size in bystes of SHA-1 hash
-// values used to check the number of iterations
-int numIt = 0;
-int nbItems = 0;
-int nbItemsSet = 0;
-
-// which hash is SHA-1
-int sha = 0;
-int sha1 = 0;
-int shadone = 0;
 
 using namespace std;
+
+// X-Ways calls XT_ProcessItemEx from several threads at once (XT_Init
+// returns XT_INIT_THREADSAFE) : what the run needs is set up by XT_Prepare
+// before the first item, the hashes are read outside of any lock and the
+// rest of the run state (pending items, cache, journal, responses, staged
+// results, messages) is only touched under lock
+struct RunContext {
+	long itemCount;				// items of the volume snapshot
+	VtHashType slotTypes[2];	// hash 1 and 2 of the volume snapshot, 0 = none or not supported
+	int slotOrder[2];			// slots to read, SHA-1 first, then SHA-256, then MD5, 0 = end
+	int hashSlot;				// slot computed when missing (1 or 2), 0 = none
+	VtHashType hashType;		// hash computed when missing, by gHasher or X-Ways
+	atomic<long> processed;		// XT_ProcessItemEx calls of the run
+	atomic<long> filtered;		// items skipped by a [filter] rule
+	atomic<bool> aborted;		// -1 returned once : every thread returns it
+	mutex lock;
+};
+RunContext gRun;
+
+// config.ini, loaded once in XT_Init
+VtConfig gConfig;
+bool gConfigLoaded = false;
+vector<string> gConfigErrors;
+
+// known files, verdicts of previous runs and of an interrupted run, then
+// the lookups : requests run in the background while X-Ways goes through the
+// items, on connections kept open from XT_Init to XT_Done
+VtPipeline gPipeline;
+
+// missing hashes computed in the background, each worker reads the items
+// of the volume on its own handle
+class VolumeReader : public VtItemReader {
+public:
+	HANDLE hVolume = 0;
+
+	void* open(long itemID) override
+	{
+		HANDLE hItem = XWF_OpenItem(hVolume, itemID, 0);
+		return hItem == 0 || hItem == INVALID_HANDLE_VALUE ? nullptr : hItem;
+	}
+
+	unsigned read(void* item, long long offset, unsigned char* buffer, unsigned size) override
+	{
+		return XWF_Read(item, offset, buffer, size);
+	}
+
+	void close(void* item) override
+	{
+		XWF_Close(item);
+	}
+};
+VolumeReader gVolumeReader;
+VtHasher gHasher;
+size_t gHashed = 0; // items hashed by gHasher
+size_t gUnreadable = 0; // items gHasher could not read
+
+// report file, opened for the whole run
+VtReport gReport;
+
+// comments and report table entries, staged and written by checkpoints
+// name of the report table, built once : X-Ways takes a wchar_t*
+wchar_t gReportTableName[] = L"VirusTotal";
+
+class ItemUpdater : public VtResultTarget {
+public:
+	void addToReportTable(long itemID) override
+	{
+		XWF_AddToReportTable(itemID, gReportTableName, 0x01);
+	}
+
+	void addComment(long itemID, wchar_t* comment) override
+	{
+		XWF_AddComment(itemID, comment, 0x01);
+	}
+};
+ItemUpdater gItemUpdater;
+VtResultStore gResults;
+
+// [filter] rules, compiled by XT_Prepare, read by every thread
+VtFilter gFilter;
+
+// What the rules ask about an item : each XWF_* function is called once at
+// most, and only when a condition needs it
+class FilterItem : public VtFilterItem {
+public:
+	explicit FilterItem(LONG itemID) : nItemID(itemID), known(0) {}
+
+	long long size() override
+	{
+		if (!(known & KNOWN_SIZE)) {
+			itemSize = XWF_GetItemSize(nItemID);
+			known |= KNOWN_SIZE;
+		}
+		return itemSize;
+	}
+
+	long long flags() override
+	{
+		if (!(known & KNOWN_FLAGS)) {
+			BOOL success = FALSE;
+			itemFlags = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_FLAGS, &success);
+			known |= KNOWN_FLAGS;
+		}
+		return itemFlags;
+	}
+
+	bool deleted() override
+	{
+		if (!(known & KNOWN_DELETED)) {
+			BOOL success = FALSE;
+			itemDeleted = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, &success) != 0;
+			known |= KNOWN_DELETED;
+		}
+		return itemDeleted;
+	}
+
+	const wchar_t* name() override
+	{
+		if (!(known & KNOWN_NAME)) {
+			itemName = XWF_GetItemName(nItemID);
+			known |= KNOWN_NAME;
+		}
+		return itemName;
+	}
+
+	const wchar_t* type() override
+	{
+		if (!(known & KNOWN_TYPE)) {
+			itemType[0] = L'\0';
+			XWF_GetItemType(nItemID, itemType, 64);
+			itemType[63] = L'\0';
+			known |= KNOWN_TYPE;
+		}
+		return itemType;
+	}
+
+	const wchar_t* hashSets() override
+	{
+		if (!(known & KNOWN_HASHSETS)) {
+			itemHashSets[0] = L'\0';
+			if (XWF_GetHashSetAssocs != nullptr) {
+				XWF_GetHashSetAssocs(nItemID, itemHashSets, 1024);
+			}
+			itemHashSets[1023] = L'\0';
+			known |= KNOWN_HASHSETS;
+		}
+		return itemHashSets;
+	}
+
+private:
+	enum {
+		KNOWN_SIZE = 0x01,
+		KNOWN_FLAGS = 0x02,
+		KNOWN_DELETED = 0x04,
+		KNOWN_NAME = 0x08,
+		KNOWN_TYPE = 0x10,
+		KNOWN_HASHSETS = 0x20
+	};
+
+	LONG nItemID;
+	unsigned known;
+	long long itemSize;
+	long long itemFlags;
+	bool itemDeleted;
+	const wchar_t* itemName;
+	wchar_t itemType[64];
+	wchar_t itemHashSets[1024];
+};
+
+// messages, per item only at the verbose level
+VtLog gLog;
+
+// time spent in each stage of the run, displayed by XT_Finalize
+VtTimings gTimings;
+std::chrono::steady_clock::time_point gRunStart;
+wstring gVolumeName; // label of the run in the timing file
+
 namespace
 {
-	std::size_t callback(
-		const char* in,
-		std::size_t size,
-		std::size_t num,
-		std::string* out)
+	// gLog output
+	void outputMessage(const wchar_t* message)
 	{
-		const std::size_t totalBytes(size * num);
-		out->append(in, totalBytes);
-		return totalBytes;
-	}
-
-	//////////////////////////////////////////////////////////////////////////////
-	//Callback function for response header  -- x-api-message -- Curl
-	static std::size_t header_callback(char* buffer, std::size_t size, std::size_t nitems, void* userdata) {
-		std::string header(buffer, size * nitems);
-		std::size_t colon_pos = header.find(':');
-		if (colon_pos != std::string::npos) {
-			std::string header_name = header.substr(0, colon_pos);
-			std::string header_value = header.substr(colon_pos + 1);
-			// Trim leading and trailing white space from header value
-			header_value = header_value.erase(0, header_value.find_first_not_of(" \t\r\n"));
-			header_value = header_value.erase(header_value.find_last_not_of(" \t\r\n") + 1);
-			if (header_name == "X-Api-Message") {
-				*static_cast<std::string*>(userdata) = header_value;
+		XWF_OutputMessage(message, 0);
+	}
+
+	// config.ini is looked for next to the DLL, then in the current directory
+	string configPath()
+	{
+#ifdef _WIN32
+		HMODULE hModule = NULL;
+		char dllPath[MAX_PATH];
+		if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+				(LPCSTR)&XT_Init, &hModule) &&
+			GetModuleFileNameA(hModule, dllPath, MAX_PATH) > 0) {
+
+			string path(dllPath);
+			path = path.substr(0, path.find_last_of("\\/") + 1) + VT_CONFIG_FILE;
+			if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
+				return path;
+			}
+		}
+		return string(".\\") + VT_CONFIG_FILE;
+#else
+		// shared object loaded by tools/xwsim
+		Dl_info info;
+		if (dladdr((void*)&XT_Init, &info) != 0 && info.dli_fname != nullptr) {
+			string path(info.dli_fname);
+			path = path.substr(0, path.find_last_of('/') + 1) + VT_CONFIG_FILE;
+			if (access(path.c_str(), R_OK) == 0) {
+				return path;
 			}
 		}
-		return nitems * size;
+		return string("./") + VT_CONFIG_FILE;
+#endif
 	}
 
-	// Function to check if the result is SHA-1 or not and return the hash string
-	string checkHash(int result, int shatest) {
-		if (result == 8) {
-			sha1++;
-			sha = shatest;
-			return "SHA-1";
+	// Hash type of the volume snapshot, 0 if VirusTotal does not know it
+	VtHashType hashTypeOf(INT64 type)
+	{
+		switch (type) {
+		case XWF_HASHTYPE_MD5:
+			return VT_HASH_MD5;
+		case XWF_HASHTYPE_SHA1:
+			return VT_HASH_SHA1;
+		case XWF_HASHTYPE_SHA256:
+			return VT_HASH_SHA256;
+		}
+		return (VtHashType)0;
+	}
+
+	// Hash type of the volume snapshot, as displayed
+	string hashTypeName(INT64 type)
+	{
+		VtHashType known = hashTypeOf(type);
+		if (known != 0) {
+			return vtHashName(known);
+		}
+		return type == 0 ? "None" : "Type " + to_string(type) + " (not supported)";
+	}
+
+	// What X-Ways knows about an item, for its risk score
+	VtItemTraits itemTraits(LONG nItemID)
+	{
+		VtItemTraits traits;
+		traits.name = XWF_GetItemName(nItemID);
+		traits.size = XWF_GetItemSize(nItemID);
+
+		// type detected from the signature, e.g. "exe" for a renamed executable
+		wchar_t type[64] = {};
+		traits.typeStatus = XWF_GetItemType(nItemID, type, 64);
+		traits.type = type;
+
+		BOOL success = FALSE;
+		traits.flags = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_FLAGS, &success);
+		traits.attributes = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_ATTR, &success);
+		traits.deleted = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, &success) != 0;
+
+		// folders up to the root, depth bounded in case of a loop
+		wstring path = L"\\";
+		LONG parent = XWF_GetItemParent(nItemID);
+		for (int depth = 0; parent >= 0 && depth < 64; depth++) {
+			path = L"\\" + wstring(XWF_GetItemName(parent)) + path;
+			parent = XWF_GetItemParent(parent);
+		}
+		traits.path = path;
+		return traits;
+	}
+
+	// Stages the comment and report table entry of an item, writes the report file
+	void recordScore(LONG nItemID, const string& hash, const VtVerdict& verdict, bool cached)
+	{
+		bool reported = verdict.positives >= gConfig.minScore;
+		gResults.addScore(nItemID, verdict.responseCode, verdict.positives, verdict.total, reported);
+
+		if (verdict.responseCode != 1) {
+			VT_LOG(gLog, VT_LOG_VERBOSE) << L"[!] No Score for this file : " << XWF_GetItemName(nItemID);
 		}
 		else {
-			return "Not SHA-1";
+			VT_LOG(gLog, VT_LOG_VERBOSE) << L"[+] VirusTotal Score : " << verdict.positives << L"/" << verdict.total
+				<< L" : " << XWF_GetItemName(nItemID) << (reported ? L", added to report table" : L"");
 		}
+
+		//////////////////////////////////////////
+		//										//
+		//			Report file		            //
+		//										//
+		//////////////////////////////////////////
+
+		// buffered, written by blocks
+		VtStageTimer fileTimer(gTimings, VT_STAGE_REPORT_FILE);
+		gReport.write(nItemID, XWF_GetItemName(nItemID), XWF_GetItemSize(nItemID), hash, verdict, cached);
 	}
 
+	// Writes the comments and report table entries staged so far
+	void applyResults()
+	{
+		VtStageTimer tableTimer(gTimings, VT_STAGE_REPORT_TABLE);
+		gResults.apply(gItemUpdater);
+	}
+
+	// The items of the volume, as the pipeline sees them
+	class ItemHost : public VtPipelineHost {
+	public:
+		const wchar_t* itemName(long itemID) override
+		{
+			return XWF_GetItemName(itemID);
+		}
+
+		int itemRisk(long itemID) override
+		{
+			return vtRiskScore(itemTraits(itemID));
+		}
+
+		void itemKnown(long itemID, const string& hash) override
+		{
+			gResults.addKnown(itemID);
+		}
+
+		void itemVerdict(long itemID, const string& hash, const VtVerdict& verdict, bool cached) override
+		{
+			recordScore(itemID, hash, verdict, cached);
+		}
+	};
+	ItemHost gItemHost;
+
+	// Looks up the items hashed by gHasher since the previous call, their hash
+	// is stored in the volume snapshot when it has a slot of that type
+	// Returns false once nothing is left to hash
+	bool drainHashes(unsigned timeout)
+	{
+		vector<VtHashResult> results;
+		bool more = gHasher.collect(results, timeout);
+		for (const VtHashResult& result : results) {
+			gTimings.addSeconds(VT_STAGE_HASHER, result.seconds);
+			if (!result.ok) {
+				gUnreadable++;
+				VT_LOG_LIMITED(gLog, VT_LOG_WARNING, L"items unable to read") << L"[!] Unable to read, not looked up : "
+					<< XWF_GetItemName(result.itemID);
+				continue;
+			}
+
+			BYTE digest[VT_SHA256_SIZE];
+			memcpy(digest, result.digests.of(gRun.hashType), vtDigestSize(gRun.hashType));
+			if (gRun.hashSlot > 0 && XWF_SetHashValue != nullptr) {
+				XWF_SetHashValue(result.itemID, digest, gRun.hashSlot);
+			}
+			gHashed++;
+			gPipeline.lookup(result.itemID, gRun.hashType, digest);
+		}
+		return more;
+	}
+
+	// Where the run stands, every few seconds instead of lines per item
+	void logProgress()
+	{
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - gRunStart).count();
+		long processed = gRun.processed;
+		VT_LOG(gLog, VT_LOG_INFO).fixed(1) << L"[+] Progress : " << processed << L"/" << gRun.itemCount << L" items, "
+			<< gPipeline.queued() << L" hash(es) queued, " << gPipeline.answered() << L" answered, " << gPipeline.cached()
+			<< L" cached, " << gPipeline.known() << L" known, " << (long)gRun.filtered << L" filtered, " << gHasher.pending() << L" being hashed, "
+			<< (elapsed > 0 ? processed / elapsed : 0.0) << L" items/s";
+	}
 }
 
 
@@ -85,9 +413,39 @@ LONG __stdcall XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd,
 	void* lpReserved)
 {
 	XT_RetrieveFunctionPointers();
-	XWF_OutputMessage(L"> VirusTotal Hash X-Tension", 0);
+	gLog.setSink(outputMessage);
+	VT_LOG(gLog, VT_LOG_INFO) << L"> VirusTotal Hash X-Tension";
+
+	// Settings, checked once for all the runs
+	string path = configPath();
+	gConfigErrors.clear();
+	gConfigLoaded = vtLoadConfig(path, gConfig, gConfigErrors);
+	if (!gConfigLoaded) {
+		VT_LOG(gLog, VT_LOG_ERROR) << L"[!] Invalid configuration : " << path;
+		for (const string& error : gConfigErrors) {
+			VT_LOG(gLog, VT_LOG_ERROR) << L"[!] " << error;
+		}
+		return XT_INIT_THREADSAFE;
+	}
+
+	// per-item messages only when asked for, a progress line otherwise
+	gLog.setLevel(gConfig.logLevel);
+	gLog.setProgressInterval(gConfig.progress);
 
-	return 1;
+	// HTTP client, verdict cache and known-hash index, kept until XT_Done
+	gPipeline.open(gConfig, gLog, gTimings);
+
+	return XT_INIT_THREADSAFE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// XT_Done
+LONG __stdcall XT_Done(void* lpReserved)
+{
+	gHasher.stop();
+	gPipeline.close();
+	gReport.close();
+	return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -95,7 +453,7 @@ LONG __stdcall XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd,
 LONG __stdcall XT_About(HANDLE hParentWnd, void* lpReserved) {
 
 	const wchar_t* constMessage =	L"VirusTotal X-Tension For X-Ways\n\n"
-									L"Gets Score of a given file sending it's SHA-1 hash.\n"
+									L"Gets Score of a given file sending it's SHA-1, SHA-256 or MD5 hash.\n"
 									L"No files are sent.\n\n"
 									L"Rewritten and enhanced by :\n"
 									L"Patrice C. (SDLC/Formation)\n"
@@ -106,7 +464,12 @@ LONG __stdcall XT_About(HANDLE hParentWnd, void* lpReserved) {
 	const wchar_t* constTitle = L"About VirusTotal X-Tension";
 	wchar_t* title= const_cast<wchar_t*>(constTitle);
 
+#ifdef _WIN32
 	MessageBox(NULL, message, title, MB_OK);
+#else
+	XWF_OutputMessage(title, 0);
+	XWF_OutputMessage(message, 0);
+#endif
 	
 	return 0;
 }
@@ -116,382 +479,355 @@ LONG __stdcall XT_Prepare(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, void*
 
 	// Only run when refining the volume snapshot or when invoked via the directory browser context menu
 	if (nOpType == XT_ACTION_RUN || nOpType == XT_ACTION_RVS || nOpType == XT_ACTION_DBC) {
-		return XT_PREPARE_CALLPI;
-	}
-
-	return 0;
-}
+		// config.ini was checked in XT_Init, nothing can be looked up without a valid key
+		if (!gConfigLoaded) {
+			VT_LOG(gLog, VT_LOG_ERROR) << L"[!] Check config.ini :";
+			for (const string& error : gConfigErrors) {
+				VT_LOG(gLog, VT_LOG_ERROR) << L"[!] " << error;
+			}
+			return -1;
+		}
 
-///////////////////////////////////////////////////////////////////////////////
-// XT_ProcessItemEx
-// 1) retrieve item name
-// 2) retrieve hash value
-// 3) convert hashBuf into string stream
-// 4) send request to VirusTotal
-// 5) retrieve and parse response from VirusTotal
-// 5) add information in report file
-LONG __stdcall XT_ProcessItemEx(LONG nItemID, HANDLE hItem, void* lpReserved)
-{
-	//////////////////////////////////////////
-	//										//
-	//		         Setup                  //
-	//										//
-	//////////////////////////////////////////
-	
+		// new run
+		gRun.itemCount = 0;
+		gRun.slotTypes[0] = gRun.slotTypes[1] = (VtHashType)0;
+		gRun.slotOrder[0] = gRun.slotOrder[1] = 0;
+		gRun.hashSlot = 0;
+		gRun.hashType = VT_HASH_SHA1;
+		gRun.processed = 0;
+		gRun.filtered = 0;
+		gRun.aborted = false;
+		gHashed = 0;
+		gUnreadable = 0;
+		gResults.clear();
+		gTimings.clear();
+		gRunStart = std::chrono::steady_clock::now();
+		gLog.restart();
+
+		// -- Hash Types -- : any hash VirusTotal knows is looked up as it is,
+		// whichever X-Ways computed for the volume snapshot
+		int hashType = 0;
+		INT64 hash1 = XWF_GetVSProp(XWF_VSPROP_HASHTYPE1, &hashType);
+		INT64 hash2 = XWF_GetVSProp(XWF_VSPROP_HASHTYPE2, &hashType);
+		gRun.slotTypes[0] = hashTypeOf(hash1);
+		gRun.slotTypes[1] = hashTypeOf(hash2);
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] Hash Types : hash1 : " << hashTypeName(hash1) << L", hash2 : " << hashTypeName(hash2);
+
+		// SHA-1 first : the cache, the journal and the known-hash index were
+		// mostly filled with it
+		const VtHashType preferred[] = { VT_HASH_SHA1, VT_HASH_SHA256, VT_HASH_MD5 };
+		int slots = 0;
+		for (VtHashType type : preferred) {
+			for (int slot = 1; slot <= 2; slot++) {
+				if (gRun.slotTypes[slot - 1] == type) {
+					gRun.slotOrder[slots++] = slot;
+				}
+			}
+		}
+		if (slots > 0) {
+			gRun.hashSlot = gRun.slotOrder[0];
+			gRun.hashType = gRun.slotTypes[gRun.hashSlot - 1];
+		}
 
-	// Parsing INI file : .\config.ini
-	// Getting the API Key and the type of key
+		// nothing to look up : checked before the report, the journal and the
+		// lookup engine are opened
+		bool canHash = gConfig.hashThreads > 0 && hVolume != 0 && XWF_OpenItem != nullptr;
+		if (gRun.hashSlot == 0 && !canHash) {
+			VT_LOG(gLog, VT_LOG_ERROR) << L"No MD5, SHA-1 or SHA-256 hash available";
+			return -1;
+		}
 
-	char iniKey[65];
+		// items skipped before anything is asked about them but what the rules test
+		vector<string> filterErrors;
+		gFilter.compile(gConfig.filterRules, filterErrors);
+		if (gFilter.isActive()) {
+			VT_LOG(gLog, VT_LOG_INFO) << L"[+] Filter : " << gFilter.ruleCount() << L" rule(s)";
+		}
 
-	GetPrivateProfileStringA("config", "apikey", "", iniKey, 65,  ".\\config.ini");
+		if (gReport.open(gConfig.reportFile, gConfig.reportFormat)) {
+			VT_LOG(gLog, VT_LOG_INFO) << L"[+] Report file : " << gConfig.reportFile;
+		}
+		else {
+			VT_LOG(gLog, VT_LOG_WARNING) << L"[!] Unable to open the report file";
+		}
 
-	std::string apiKey(iniKey);
-	
-	// checks the length of the apiKey 
-	// if the length is too small then returns -1 to tell X-Ways to abort process
-	if (apiKey.length() < 64) {
-
-		std::wstring uAK = std::wstring(apiKey.begin(), apiKey.end());
-		const wchar_t* AK = uAK.c_str();
-		std::wstring errAK = L"[!] Bad ApiKey : ";
-		errAK += AK;
-	
-		XWF_OutputMessage(errAK.c_str(), 0);
+		// name of the volume, identifies its journal and its timings
+		gVolumeName.clear();
+		if (hVolume != 0) {
+			wchar_t volumeName[256] = {};
+			XWF_GetVolumeName(hVolume, volumeName, 1);
+			gVolumeName = volumeName;
+		}
 
-		return -1;
-	}
-	
-	int kType = GetPrivateProfileIntA("config", "public", 0, ".\\config.ini");
-	if (kType == 1) {
-		XWF_OutputMessage(L"[+] Using public key", 0);
+		// journal of the volume : verdicts left by an interrupted run
+		VtJournal& journal = gPipeline.journal();
+		journal.close();
+		if (!gConfig.journal.empty() && hVolume != 0) {
+			uint64_t volumeId = VtJournal::volumeId(gVolumeName, XWF_GetSize(hVolume, NULL));
+			string journalPath = VtJournal::pathFor(gConfig.journal, volumeId);
+			if (journal.open(journalPath, volumeId)) {
+				if (journal.replayed() > 0) {
+					VT_LOG(gLog, VT_LOG_INFO) << L"[+] Resuming an interrupted run : " << journal.replayed() << L" verdict(s) in "
+						<< journalPath;
+				}
+			}
+			else {
+				VT_LOG(gLog, VT_LOG_WARNING) << L"[!] Unable to open the resume journal, an interrupted run will start over";
+			}
+		}
 
-	}
-	else {
-		XWF_OutputMessage(L"[+] Using paid key.", 0);
-	}
+		// keys and their quotas, lookup engine, connection opened in the background.
+		// Without it the run stops here : XT_Finalize is not called and the
+		// journal is kept as it is for the next run
+		if (!gPipeline.start(&gItemHost)) {
+			journal.close();
+			gReport.close();
+			return -1;
+		}
 
-	// Nb Items -- For X-Ways 20.3 SR3 and later
-	if (nbItemsSet == 0) {
-		nbItems = XWF_GetItemCount((LPVOID)1);
-		std::string nbI = "[+] Items : ";
-		nbI += std::to_string(nbItems);
-		std::wstring items = std::wstring(nbI.begin(), nbI.end());
-		XWF_OutputMessage(items.c_str(), 0);
-		nbItemsSet++;
-	}
-	
+		// hashes missing from the volume snapshot, computed while the lookups
+		// run, of the type of the preferred slot
+		gHasher.stop();
+		gVolumeReader.hVolume = hVolume;
+		if (canHash && gHasher.start(&gVolumeReader, gConfig.hashThreads, gRun.hashType)) {
+			VT_LOG(gLog, VT_LOG_INFO) << L"[+] Missing hashes computed by " << gHasher.threadCount() << L" thread(s), "
+				<< vtHashName(gRun.hashType) << (VtMultiHash::hardwareSha() && gRun.hashType != VT_HASH_MD5 ? L", SHA-NI" : L"");
+		}
+		if (gRun.hashSlot == 0) {
+			VT_LOG(gLog, VT_LOG_INFO) << L"[+] No MD5, SHA-1 or SHA-256 hash in the volume snapshot, computed by the X-Tension";
+		}
 
-	// Hash types detection
+		// Nb Items -- For X-Ways 20.3 SR3 and later
+		gRun.itemCount = (long)XWF_GetItemCount((LPVOID)1);
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] Items : " << gRun.itemCount;
 
-	// -- Hash Types --
-	int hashType = 0;
-	
-	if (shadone < 1) {
-		// First hash
-		string hash1 = checkHash(XWF_GetVSProp(XWF_VSPROP_HASHTYPE1, &hashType),  1);
+		return XT_PREPARE_CALLPI;
+	}
 
-		// Second hash
-		string hash2 = checkHash(XWF_GetVSProp(XWF_VSPROP_HASHTYPE2, &hashType),  2);
+	return 0;
+}
 
-		shadone++;
+// What XWF_GetHashValue reads at the start of its buffer : the DWORD flag,
+// then the handle of the item right after it, unaligned on x64
+#pragma pack(push, 1)
+struct HashRequest {
+	DWORD flag;
+	HANDLE item;
+};
+#pragma pack(pop)
+static_assert(offsetof(HashRequest, item) == sizeof(DWORD), "XWF_GetHashValue expects the handle at offset 4");
+static_assert(sizeof(HashRequest) <= VT_SHA256_SIZE, "the hash value buffer holds the request");
 
-		// Output
-		std::wostringstream output;
-		output << L"[+] Hash Types : hash1 : " << std::wstring(hash1.begin(), hash1.end()) << L", hash2 : " << std::wstring(hash2.begin(), hash2.end());
-		XWF_OutputMessage(output.str().c_str(), 0);
+///////////////////////////////////////////////////////////////////////////////
+// XT_ProcessItemEx
+// Called by several threads at once
+// 0) skip the items a [filter] rule rejects
+// 1) retrieve hash value, without lock : X-Ways may compute it
+// 2) under the run lock, apply the responses received and the items hashed
+//    in the meantime
+// 3) skip the files of the known-hash index, use the cached verdict if any,
+//    or the verdict journaled by an interrupted run
+// 4) otherwise queue the hash with its risk score, full batches of the
+//    riskiest hashes are sent in the background when a connection is free
+//    items whose hash is already queued wait for the verdict of the first one
+// The comments and report table entries are written by checkpoints
+LONG __stdcall XT_ProcessItemEx(LONG nItemID, HANDLE hItem, void* lpReserved)
+{
+	VtStageTimer itemTimer(gTimings, VT_STAGE_ITEM);
 
-		if (sha1 < 1)
-		{
-			XWF_OutputMessage(L"No SHA-1 hash available", 0);
-			return -1;
+	if (gRun.aborted) {
+		return -1;
+	}
+	gRun.processed++;
+
+	// skipped by a [filter] rule : neither hashed nor looked up
+	if (gFilter.isActive()) {
+		FilterItem item(nItemID);
+		int rule = gFilter.match(item);
+		if (rule >= 0) {
+			gRun.filtered++;
+			if (gLog.enabled(VT_LOG_VERBOSE)) {
+				lock_guard<mutex> guard(gRun.lock);
+				VT_LOG(gLog, VT_LOG_VERBOSE) << L"[+] Skipped by [filter] " << gFilter.ruleName(rule) << L" : " << item.name();
+			}
+			return 0;
 		}
-
 	}
 
-	
 	//////////////////////////////////////////
 	//										//
 	//			Item's informations 		//
 	//										//
 	//////////////////////////////////////////
 
-	// Declare name file and add this in wstr
-	wstring name = XWF_GetItemName(nItemID);
-
-	// convert name wstr in string and add this in name string
-	string nameStr(name.begin(), name.end());
-	string nameItm;
-	nameItm = "[+] ";
-	nameItm += nameStr;
-	nameItm += "\n";
-
-	/********************************** SHA1 ******************************/
-	// print in console hash info recording
+	/************************** MD5, SHA-1, SHA-256 ***********************/
 
 	BOOL bResult = FALSE;
-	
-	BYTE* pBuffer = new BYTE[HASH_SIZE + sizeof(DWORD) + sizeof(HANDLE)]; // allocate buffer with room for hash value, DWORD flag, and handle
-
-	// Set the flag to retrieve the hash value and compute it if missing
-	// 
-	*(DWORD*)pBuffer = (sha == 1) ? 0x11 : 0x12;
+	VtHashType digestType = (VtHashType)0;
+
+	// room for the largest hash value, the DWORD flag and the handle are
+	// written at the start of the buffer, the hash value replaces them
+	union {
+		BYTE bytes[VT_SHA256_SIZE];
+		HashRequest call;
+	} buffer;
+
+	// hashes already in the volume snapshot first, whichever slot has one,
+	// without having X-Ways compute any
+	for (int i = 0; i < 2 && gRun.slotOrder[i] != 0 && !bResult; i++) {
+		buffer.call.flag = gRun.slotOrder[i];
+		buffer.call.item = hItem;
+		VtStageTimer hashTimer(gTimings, VT_STAGE_HASH);
+		bResult = XWF_GetHashValue(nItemID, buffer.bytes);
+		if (bResult) {
+			digestType = gRun.slotTypes[gRun.slotOrder[i] - 1];
+		}
+	}
 
-	*(HANDLE*)(pBuffer + sizeof(DWORD)) = hItem; // set handle at buffer offset after DWORD flag
+	// not in the volume snapshot : hashed in the background, looked up once
+	// collected, or by X-Ways in the preferred slot
+	if (!bResult && gHasher.isStarted()) {
+		gHasher.submit(nItemID, XWF_GetItemSize(nItemID));
+	}
+	else if (!bResult && gRun.hashSlot > 0) {
+		buffer.call.flag = 0x10 | gRun.hashSlot;
+		buffer.call.item = hItem;
+		VtStageTimer hashTimer(gTimings, VT_STAGE_HASH);
+		bResult = XWF_GetHashValue(nItemID, buffer.bytes);
+		digestType = gRun.hashType;
+	}
 
-	// Call XWF_GetHashValue to retrieve the hash value and compute it if missing
-	bResult = XWF_GetHashValue(nItemID, pBuffer);
+	lock_guard<mutex> guard(gRun.lock);
 
-	stringstream strStream;
-	strStream << hex;
-	for (int i = 0; i < 20; ++i) {
-		strStream << setw(2) << setfill('0') << (int)pBuffer[i];
+	// verdicts received and items hashed since the previous item
+	if (gPipeline.poll() != 0) {
+		gRun.aborted = true;
+		return -1;
 	}
+	drainHashes(0);
 
-	// free the allocated buffer
-	delete[] pBuffer;
+	// the hash is looked up, or waits for a batch
+	if (bResult) {
+		gPipeline.lookup(nItemID, digestType, buffer.bytes);
+	}
 
-	string hashVal = ">> Hash SHA1 of :\n";
+	if (gResults.checkpointDue()) {
+		applyResults();
+	}
+	if (gLog.progressDue()) {
+		logProgress();
+	}
+	return 0;
+}
 
+///////////////////////////////////////////////////////////////////////////////
+// XT_Finalize
+// 1) look up the items still being hashed as they come
+// 2) send the hashes still waiting, the riskiest first
+// 3) wait for the requests still queued or in flight
+// 4) fan the reports still to come out to the items (cache, report file,
+//    journal)
+// 5) write the comments and report table entries staged since the last
+//    checkpoint
+// 6) delete the journal if every item got its verdict
+LONG __stdcall XT_Finalize(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, void* lpReserved)
+{
+	gPipeline.submit(gHasher.pending() == 0);
 
-	//////////////////////////////////////////
-	//										//
-	//			Communication with VT		//
-	//										//
-	//////////////////////////////////////////
+	if (gHasher.pending() > 0) {
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] Waiting for " << gHasher.pending() << L" item(s) to be hashed";
+	}
 
-	// print init connection
-	XWF_OutputMessage(L"[+] Connecting...", 0);
+	if (gPipeline.inFlight() > 0) {
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] Waiting for " << gPipeline.inFlight() << L" request(s) to VirusTotal";
+	}
 
-	// init curl pointer and result
-	CURL *curl;
-	
-	// init the curl winsock stuff
-	curl_global_init(CURL_GLOBAL_ALL);
-
-	// get a curl handle
-	curl = curl_easy_init();
-	if (curl) {
-
-		wstring sending = L"[+] Sending hash of : ";
-		sending += name;
-
-		XWF_OutputMessage(sending.c_str(), 0);
-
-		// set the URL that is about to receive our POST.
-		string urlScan = "https://www.virustotal.com/vtapi/v2/file/report?apikey=";
-		urlScan += apiKey;
-		urlScan += "&resource=";
-		urlScan += strStream.str();
-		/***************************************************/
-		/* /!\ DON'T FORGET THE .c_str() AFTER URLSCAN /!\ */
-		/***************************************************/
-		curl_easy_setopt(curl, CURLOPT_URL, urlScan.c_str());
-
-		// accept ssl
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-
-		
-		int httpCode(0);
-		std::unique_ptr<std::string> httpData(new std::string());
-
-		// Hook up data handling function.
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, callback);
-
-		// Hook up data container (will be passed as the last parameter to the
-		// callback handling function).  Can be any pointer type, since it will
-		// internally be passed as a void pointer.
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, httpData.get());
-
-		//--- Case of HTTP 204 : maximum queries reached
-		std::string x_api_message;
-		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &x_api_message);
-
-		// Perform the request, res will get the return code
-		curl_easy_perform(curl);
-		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
-		// always cleanup
-		curl_easy_cleanup(curl);
-
-		if (httpCode == 403) {
-			XWF_OutputMessage(L"[!] Error : Access denied. ", 0);
-			XWF_OutputMessage(L"[!] Check API key in config.ini ", 0);
-			return -1;
-		}
+	// aborted by an item (access denied on every key) : nothing more is sent
+	int result = gRun.aborted ? -1 : 0;
+	while (result == 0) {
+		// while items are still hashed only full batches leave
+		bool hashing = drainHashes(gPipeline.inFlight() > 0 ? 0 : 100);
+		gPipeline.submit(!hashing);
 
-		if (httpCode == 204) {
-			std::wstring api_message = std::wstring(x_api_message.begin(), x_api_message.end());
-			const wchar_t* apiMessage = api_message.c_str();
-			
-			XWF_OutputMessage(L"[!] Error : HTTP 204 ", 0);
-			XWF_OutputMessage(apiMessage, 0);
+		bool more = gPipeline.wait(hashing ? 100 : 1000, result);
 
-			return -1;
+		// hashes queued again after an unreadable answer
+		gPipeline.submit(!hashing);
+		if (!hashing && !more && gPipeline.inFlight() == 0) {
+			break;
 		}
 
+		// cancelled : what is left is dropped, the journal is kept
+		if (XWF_ShouldStop()) {
+			break;
+		}
 
-		// check if the response code is 200
-		if (httpCode == 200) {
-			XWF_OutputMessage(L"[+] Response : OK !", 0);
-
-			
-			//////////////////////////////////////////
-			//										//
-			//			Parsing Report VT			//
-			//										//
-			//////////////////////////////////////////
-
-			// Response looks good - done using Curl now.  Try to parse the results
-			// and print them out.
-			Json::Value jsonData;
-			Json::Reader jsonReader;
-
-			// try to record json data
-			if (jsonReader.parse(*httpData, jsonData))
-			{
-				ofstream dataFile("data.json", ios::trunc);
-				dataFile << jsonData;
-				dataFile.close();
-
-				// XWF_OutputMessage(L"[+] Parsing JSON response.", 0);
-				// record total value and positives value if exist
-				string total(jsonData["total"].asString());
-				string positives(jsonData["positives"].asString());
-
-				int posInt(jsonData["positives"].asInt());
-
-				int minscore = GetPrivateProfileIntA("config", "minscore", 0, ".\\config.ini");
-				if (posInt >= minscore) {
-
-					DWORD flagrt = 0x01;
-
-					const wchar_t* constRTName = L"VirusTotal";
-					wchar_t* tableName = const_cast<wchar_t*>(constRTName);
-					
-					XWF_OutputMessage(L"[+] Added to report table.", 0);
-					LONG rtIndex = XWF_AddToReportTable(nItemID, tableName, flagrt);
-				}
-
-				string scoring = ">> Score VirusTotal:\n";
-				wstring wstrScore;
-
-				DWORD flagsCom = 0x01;
-
-				// check if total and positives are empty
-				if (total.empty() && positives.empty()) {
+		if (gResults.checkpointDue()) {
+			applyResults();
+		}
+		if (gLog.progressDue()) {
+			logProgress();
+		}
+	}
 
-					wstrScore = L"0/0";
-					XWF_OutputMessage(L"[!] No Score for this file", 0);
-				
-				}
-				else {
-					// if score exist then add it in var
+	// every verdict received reaches its item, even when the run was cut short
+	applyResults();
 
-					std::wstring wpositives = std::wstring(positives.begin(), positives.end());
-					std::wstring wtotal = std::wstring(total.begin(), total.end());
+	// lines of the run not shown, then its summary
+	gLog.flush();
 
-					wstrScore = wpositives + L"/" + wtotal;
-				}
+	if (gResults.commented() > 0) {
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] " << gResults.commented() << L" item(s) commented, "
+			<< gResults.tableEntries() << L" added to the report table";
+	}
 
+	if (gRun.filtered > 0) {
+		VT_LOG(gLog, VT_LOG_INFO) << L"[+] " << (long)gRun.filtered << L" item(s) skipped by the filter";
+	}
 
-				wchar_t * wcScore = &wstrScore[0];
-
-				XWF_OutputMessage(L"[+] VirusTotal Score:", 0);
-				XWF_OutputMessage(wstrScore.c_str(), 0);
-
-
-				XWF_AddComment(nItemID, wcScore, flagsCom);
-				
-				//////////////////////////////////////////
-				//										//
-				//			Report file		            //
-				//										//
-				//////////////////////////////////////////
-
-				// Size of the file
-				string sizeStr = ">> Bytes Size:\n";
-				string size = to_string(XWF_GetSize(hItem, (LPVOID)1)) + " Bytes";
-
-				// open/create report file in append mode
-				ofstream reportFile("reportXTension.txt", ios::app);
-				// add informations
-				reportFile << nameItm;
-				reportFile << "\n";
-				reportFile << hashVal;
-				reportFile << strStream.str();
-				reportFile << "\n";
-				reportFile << scoring;
-
-				std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-				std::string score = converter.to_bytes(wstrScore);
-				reportFile << score;
-				reportFile << "\n";
-				reportFile << sizeStr;
-				reportFile << size;
-				reportFile << "\n\n";
-				// close file
-				reportFile.close();
-
-				// Clean variables
-				nameStr.clear();
-				hashVal.clear();
-				total.clear();
-				positives.clear();
-				wstrScore.clear();
-				
-				XWF_OutputMessage(L"[+] Informations added to report \"reportXtension.txt\".", 0);
-				// global cleanup
-				curl_global_cleanup();
-
-			}else {
-				XWF_OutputMessage(L"[!] Failled to parse JSON response.", 0);
-				return -1;
-			}
-		}else {
-			// Error with HTTP response code if response code not 200, 204 or 403
-			std::wostringstream resp;
-			resp << "[!] Bad Response Code! : " << httpCode;
-			std::wstring responseStr = resp.str(); // Store the result of resp.str() in a variable
-			const wchar_t* responsec = responseStr.c_str(); // Use the c_str() method on the stored variable
-
-			XWF_OutputMessage(responsec, 0);
-
-			std::wostringstream uResp;
-			std::wstring urlScanW = std::wstring(urlScan.begin(), urlScan.end()); // Convert urlScan to a wstring
-			uResp << "[!] URL : " << urlScanW;
-			std::wstring uResponseStr = uResp.str();
-			const wchar_t* uResponsec = uResponseStr.c_str();
-
-			XWF_OutputMessage(uResponsec, 0);
-			
-			// global cleanup
-			curl_global_cleanup();
-		}
-	}else {
-		XWF_OutputMessage(L"[!] Problem connecting !", 0);
-		// global cleanup
-		curl_global_cleanup();
-		return -1;
+	if (gHashed > 0 || gUnreadable > 0) {
+		VT_LOG(gLog, gUnreadable > 0 ? VT_LOG_WARNING : VT_LOG_INFO) << (gUnreadable > 0 ? L"[!] " : L"[+] ") << gHashed
+			<< L" item(s) hashed by the X-Tension, " << gUnreadable << L" unreadable";
 	}
 
-	// end of function
-	// function reloaded if multiple files selected
-	
-	nbItems--;
-	if (nbItems > 0) {
-		if (kType == 1)	{
-			// Wait 15s between queries if public key
-			XWF_OutputMessage(L"- - 15s delay between queries... (Public API key)", 0);
-			Sleep(15000);
+	// lookups of the run, the journal is deleted if it is complete, usage of the keys
+	gHasher.stop();
+	gPipeline.finish(result == 0 && !XWF_ShouldStop());
+	gReport.close();
+
+	// where the time went : count, total, mean and percentiles of each stage
+	gTimings.add(VT_STAGE_RUN, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - gRunStart).count());
+	VT_LOG(gLog, VT_LOG_INFO) << L"[+] Timings (ms) : count, total, mean, p50, p95, p99";
+	for (int stage = 0; stage < VT_STAGE_COUNT; stage++) {
+		const VtHistogram& histogram = gTimings.stage((VtStage)stage);
+		if (histogram.count() == 0) {
+			continue;
+		}
+		VT_LOG(gLog, VT_LOG_INFO).fixed(3) << L"[+]   " << vtStageName((VtStage)stage) << L" : "
+			<< histogram.count() << L", " << histogram.total() / 1e6 << L", " << histogram.mean() / 1e6 << L", "
+			<< histogram.percentile(0.50) / 1e6 << L", " << histogram.percentile(0.95) / 1e6 << L", "
+			<< histogram.percentile(0.99) / 1e6;
+	}
+	if (!gConfig.timingFile.empty()) {
+		string label;
+#ifdef _WIN32
+		int length = WideCharToMultiByte(CP_UTF8, 0, gVolumeName.c_str(), -1, NULL, 0, NULL, NULL);
+		if (length > 1) {
+			label.resize(length - 1);
+			WideCharToMultiByte(CP_UTF8, 0, gVolumeName.c_str(), -1, &label[0], length, NULL, NULL);
+		}
+#else
+		label = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(gVolumeName);
+#endif
+		if (!gTimings.writeCsv(gConfig.timingFile, label)) {
+			VT_LOG(gLog, VT_LOG_WARNING) << L"[!] Unable to write the timing file";
 		}
-		numIt++;	
 	}
 
-	if (nbItems == 0) {
-		XWF_OutputMessage(L"-- Operation Completed --", 0);
+	if (result == 0) {
+		VT_LOG(gLog, VT_LOG_INFO) << L"-- Operation Completed --";
 	}
 
-	return 0;
+	return result;
 }
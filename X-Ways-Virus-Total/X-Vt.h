@@ -1,5 +1,9 @@
 #pragma once
 #define XWF_VSPROP_HASHTYPE1	20 //First hash
 #define XWF_VSPROP_HASHTYPE2	21 //Second hash
-#define HASH_SIZE	20 //Size in bytes of a SHA-1 hash
-#define XT_PREPARE_CALLPI 0x01
\ No newline at end of file
+#define HASH_SIZE	20 //Size in bytes of the key of a hash (VtHash.h vtDigestKey)
+#define XWF_HASHTYPE_MD5		7 //XWF_GetVSProp(XWF_VSPROP_HASHTYPE1/2)
+#define XWF_HASHTYPE_SHA1		8
+#define XWF_HASHTYPE_SHA256		9
+#define XT_PREPARE_CALLPI 0x01
+#define XT_INIT_THREADSAFE 2 // XT_Init : XT_ProcessItemEx may be called by several threads at once
@@ -4,7 +4,11 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "X-Tension.h"
+#ifdef _WIN32
 #include "BGStringTemplates.h"
+#else
+#include <dlfcn.h>
+#endif
 
 // Please consult
 // http://x-ways.com/forensics/x-tensions/api.html
@@ -53,6 +57,9 @@ fptr_XWF_ShouldStop XWF_ShouldStop;
 fptr_XWF_HideProgress XWF_HideProgress;
 fptr_XWF_ReleaseMem XWF_ReleaseMem;
 
+fptr_XWF_OpenItem XWF_OpenItem;
+fptr_XWF_Close XWF_Close;
+
 fptr_XWF_GetBlock XWF_GetBlock;
 fptr_XWF_SetBlock XWF_SetBlock;
 fptr_XWF_GetCaseProp XWF_GetCaseProp;
@@ -89,7 +96,11 @@ LONG missingFunctionCount;
 
 void* getFunction(HMODULE Hdl, const char* functionName)
 {
+#ifdef _WIN32
 	void* result = GetProcAddress(Hdl, functionName);
+#else
+	void* result = dlsym(Hdl, functionName);
+#endif
 
 	if (result == nullptr) {
 		++missingFunctionCount;
@@ -101,7 +112,12 @@ void* getFunction(HMODULE Hdl, const char* functionName)
 // Retrieves the function pointers into XWF and returns the number of missing functions
 LONG __stdcall XT_RetrieveFunctionPointers()
 {
+#ifdef _WIN32
 	HMODULE Hdl = GetModuleHandle(NULL);
+#else
+	// functions exported by the host executable
+	HMODULE Hdl = RTLD_DEFAULT;
+#endif
 	missingFunctionCount = 0;
 
 	XWF_GetSize = (fptr_XWF_GetSize) getFunction(Hdl, "XWF_GetSize");
@@ -145,6 +161,9 @@ LONG __stdcall XT_RetrieveFunctionPointers()
 	XWF_HideProgress = (fptr_XWF_HideProgress) getFunction(Hdl, "XWF_HideProgress");
 	XWF_ReleaseMem = (fptr_XWF_ReleaseMem) getFunction(Hdl, "XWF_ReleaseMem");
 
+	XWF_OpenItem = (fptr_XWF_OpenItem) getFunction(Hdl, "XWF_OpenItem");
+	XWF_Close = (fptr_XWF_Close) getFunction(Hdl, "XWF_Close");
+
 	XWF_GetBlock = (fptr_XWF_GetBlock) getFunction(Hdl, "XWF_GetBlock");
 	XWF_SetBlock = (fptr_XWF_SetBlock) getFunction(Hdl, "XWF_SetBlock");
 	XWF_GetCaseProp = (fptr_XWF_GetCaseProp) getFunction(Hdl, "XWF_GetCaseProp");
@@ -6,7 +6,41 @@
 #ifndef X_Tension__h
 #define X_Tension__h
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+// Win32 types of the API, for X-Tensions built as shared objects and loaded
+// by a host that exports the XWF_* functions (tools/xwsim on Linux)
+#include <stdint.h>
+#include <wchar.h>
+#define __stdcall
+#define VOID void
+#define TRUE 1
+#define FALSE 0
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef uint16_t WORD;
+typedef uint8_t BYTE;
+typedef uint8_t byte;
+typedef int BOOL;
+typedef int64_t INT64;
+typedef void* HANDLE;
+typedef void* HWND;
+typedef void* HMODULE;
+typedef void* LPVOID;
+typedef void* PVOID;
+typedef LONG* LPLONG;
+typedef LONG* PLONG;
+typedef DWORD* LPDWORD;
+typedef DWORD* PDWORD;
+typedef BOOL* LPBOOL;
+typedef INT64* PINT64;
+typedef wchar_t* LPWSTR;
+typedef char* LPSTR;
+typedef const char* LPCSTR;
+struct FILETIME { DWORD dwLowDateTime; DWORD dwHighDateTime; };
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#endif
 
 // Please consult
 // http://x-ways.com/forensics/x-tensions/api.html
@@ -451,6 +485,11 @@ extern fptr_XWF_Search XWF_Search;
 ///////////////////////////////////////////////////////////////////////////////
 // Functions that X-Ways Forensics or WinHex may call
 
+#ifndef _WIN32
+// looked up by name with dlsym by the host, as listed in the .def file on Windows
+extern "C" {
+#endif
+
 struct CallerInfo {
    byte lang, ServiceRelease;
    WORD version;
@@ -515,4 +554,8 @@ PVOID XT_View(HANDLE hItem, LONG nItemID, HANDLE hVolume, HANDLE hEvidence,
 // free up memory allocated by a previous call e.g. of XT_View
 BOOL XT_ReleaseMem(PVOID lpBuffer);
 
+#ifndef _WIN32
+}
+#endif
+
 #endif
\ No newline at end of file
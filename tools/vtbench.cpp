@@ -0,0 +1,283 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - lookup throughput benchmark (Linux)
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Pushes a synthetic stream of SHA-1 hashes through the lookup pipeline of
+// the X-Tension : in-run deduplication, batches, quota scheduler, lookup
+// engine on the persistent HTTP client, report extraction. Meant to run
+// against tools/vtmock, never against the real API.
+//
+//   vtbench [--url http://127.0.0.1:8080/vtapi/v2/] [--items 10000] [--dup 0.5]
+//           [--batch 4] [--inflight 8] [--perminute 0] [--perday 0] [--permonth 0]
+//           [--keys k1,k2] [--engines Engine0,Engine1] [--seed 1]
+// The quotas apply to each key, run vtmock with the same --keys to test a pool.
+
+#include "VtClient.h"
+#include "VtEngine.h"
+#include "VtHashIndex.h"
+#include "VtLookup.h"
+#include "VtKeyPool.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	struct Options {
+		string url = "http://127.0.0.1:8080/vtapi/v2/";
+		vector<string> keys;
+		size_t items = 10000;
+		double dup = 0.5;	// share of items whose hash was already seen
+		size_t batch = 4;
+		int inFlight = 8;
+		int perMinute = 0;
+		int perDay = 0;
+		int perMonth = 0;
+		vector<string> engines;
+		unsigned seed = 1;
+	};
+
+	// Same as PendingItem in X-Vt.cpp
+	struct PendingHash {
+		string hash;
+		size_t items;	// items sharing the hash
+	};
+
+	// Nearest rank
+	double percentile(vector<double> values, double p)
+	{
+		if (values.empty()) {
+			return 0;
+		}
+		sort(values.begin(), values.end());
+		size_t rank = (size_t)ceil(p / 100.0 * values.size());
+		return values[min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	bool parseArgs(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2) {
+			string arg = argv[i];
+			string value = argv[i + 1];
+			if (arg == "--url") options.url = value;
+			else if (arg == "--key" || arg == "--keys") {
+				size_t start = 0;
+				while (start <= value.size()) {
+					size_t comma = min(value.find(',', start), value.size());
+					if (comma > start) {
+						options.keys.push_back(value.substr(start, comma - start));
+					}
+					start = comma + 1;
+				}
+			}
+			else if (arg == "--items") options.items = strtoul(value.c_str(), nullptr, 10);
+			else if (arg == "--dup") options.dup = atof(value.c_str());
+			else if (arg == "--batch") options.batch = max(1, min(atoi(value.c_str()), VT_BATCH_PAID));
+			else if (arg == "--inflight") options.inFlight = atoi(value.c_str());
+			else if (arg == "--perminute") options.perMinute = atoi(value.c_str());
+			else if (arg == "--perday") options.perDay = atoi(value.c_str());
+			else if (arg == "--permonth") options.perMonth = atoi(value.c_str());
+			else if (arg == "--seed") options.seed = (unsigned)atoi(value.c_str());
+			else if (arg == "--engines") {
+				size_t start = 0;
+				while (start <= value.size()) {
+					size_t comma = min(value.find(',', start), value.size());
+					if (comma > start) {
+						options.engines.push_back(value.substr(start, comma - start));
+					}
+					start = comma + 1;
+				}
+			}
+			else return false;
+		}
+		if (options.url.back() != '/') {
+			options.url += '/';
+		}
+		if (options.keys.empty()) {
+			options.keys.push_back(string(64, 'a'));
+		}
+		return argc % 2 == 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseArgs(argc, argv, options)) {
+		cerr << "usage: vtbench [--url URL] [--items N] [--dup P] [--batch N] [--inflight N]\n"
+			"               [--perminute N] [--perday N] [--permonth N] [--keys K1,K2] [--engines E1,E2] [--seed N]\n";
+		return 1;
+	}
+
+	VtClient client;
+	if (!client.init()) {
+		cerr << "[!] Unable to initialize curl\n";
+		return 1;
+	}
+
+	// usage is not kept between benchmark runs
+	VtKeyPool keys;
+	for (size_t i = 0; i < options.keys.size(); i++) {
+		keys.add("key" + to_string(i + 1), options.keys[i], options.batch <= VT_BATCH_PUBLIC,
+			options.perMinute, options.perDay, options.perMonth, "");
+	}
+
+	VtEngine engine;
+	if (!engine.start(&client, options.url, &keys, options.inFlight, VT_CONNECT_TIMEOUT, VT_REQUEST_TIMEOUT)) {
+		cerr << "[!] Unable to start the lookup engine\n";
+		return 1;
+	}
+	client.warmUp(options.url);
+
+	//////////////////////////////////////////
+	//										//
+	//			Synthetic items				//
+	//										//
+	//////////////////////////////////////////
+
+	mt19937_64 rng(options.seed);
+	uniform_real_distribution<double> draw(0, 1);
+	vector<vector<unsigned char>> seen;
+	seen.reserve(options.items);
+
+	VtHashIndex index;
+	vector<PendingHash> pending;
+	vector<steady_clock::time_point> submitted; // per hash, when its request was submitted
+	size_t sent = 0;
+
+	steady_clock::time_point start = steady_clock::now();
+
+	// what XT_ProcessItemEx does for an item that is not in the verdict cache
+	for (size_t i = 0; i < options.items; i++) {
+		vector<unsigned char> digest(VT_INDEX_KEY_SIZE);
+		if (!seen.empty() && draw(rng) < options.dup) {
+			digest = seen[rng() % seen.size()];
+		}
+		else {
+			for (unsigned char& b : digest) {
+				b = (unsigned char)rng();
+			}
+			seen.push_back(digest);
+		}
+
+		bool inserted = false;
+		size_t first = index.insert(digest.data(), pending.size(), inserted);
+		if (!inserted) {
+			pending[first].items++;
+			continue;
+		}
+
+		static const char hex[] = "0123456789abcdef";
+		PendingHash hash;
+		for (unsigned char b : digest) {
+			hash.hash += hex[b >> 4];
+			hash.hash += hex[b & 0x0F];
+		}
+		hash.items = 1;
+		pending.push_back(hash);
+
+		if (pending.size() - sent >= options.batch) {
+			VtRequest request;
+			for (size_t j = sent; j < pending.size(); j++) {
+				request.items.push_back(j);
+				request.resources.push_back(pending[j].hash);
+			}
+			submitted.resize(pending.size(), steady_clock::now());
+			engine.submit(request);
+			sent = pending.size();
+		}
+	}
+
+	// what XT_Finalize does
+	if (sent < pending.size()) {
+		VtRequest request;
+		for (size_t j = sent; j < pending.size(); j++) {
+			request.items.push_back(j);
+			request.resources.push_back(pending[j].hash);
+		}
+		submitted.resize(pending.size(), steady_clock::now());
+		engine.submit(request);
+		sent = pending.size();
+	}
+
+	vector<double> wire;		// time on the wire per request, ms
+	vector<double> endToEnd;	// submit to collect per request, ms
+	size_t requests = 0, ok = 0, failed = 0, dropped = 0;
+	size_t verdicts = 0, known = 0, detected = 0, itemsAnswered = 0;
+
+	vector<VtResponse> responses;
+	while (engine.collect(responses, 1000)) {
+		steady_clock::time_point now = steady_clock::now();
+		for (const VtResponse& response : responses) {
+			if (!response.sent) {
+				dropped++;
+				continue;
+			}
+			requests++;
+			wire.push_back(response.seconds * 1000.0);
+			endToEnd.push_back(duration<double, milli>(now - submitted[response.request.items.front()]).count());
+
+			vector<VtVerdict> reports;
+			if (response.httpCode != 200 || !vtParseReports(response.body, options.engines, reports)) {
+				failed++;
+				continue;
+			}
+			ok++;
+			for (const VtVerdict& verdict : reports) {
+				verdicts++;
+				known += verdict.responseCode == 1;
+				detected += verdict.positives > 0;
+			}
+			for (size_t j : response.request.items) {
+				itemsAnswered += pending[j].items;
+			}
+		}
+		responses.clear();
+	}
+	double elapsed = duration<double>(steady_clock::now() - start).count();
+	size_t refused = engine.refused();
+	size_t retried = engine.retried();
+	engine.stop();
+	client.cleanup();
+
+	//////////////////////////////////////////
+	//										//
+	//			Results						//
+	//										//
+	//////////////////////////////////////////
+
+	cout << fixed << setprecision(1);
+	cout << "items          : " << options.items << " (" << pending.size() << " distinct hashes)\n";
+	cout << "elapsed        : " << setprecision(3) << elapsed << " s\n" << setprecision(1);
+	cout << "throughput     : " << itemsAnswered / elapsed << " items/s, " << verdicts / elapsed << " lookups/s\n";
+	cout << "requests       : " << requests << " sent, " << ok << " ok, " << failed << " failed, "
+		<< refused << " refused (204), " << retried << " retried, " << dropped << " dropped\n";
+	cout << "verdicts       : " << verdicts << " (" << known << " known, " << detected << " detected)\n";
+	cout << "wire latency   : p50 " << percentile(wire, 50) << " ms, p99 " << percentile(wire, 99) << " ms\n";
+	cout << "request latency: p50 " << percentile(endToEnd, 50) << " ms, p99 " << percentile(endToEnd, 99)
+		<< " ms (queued to collected)\n";
+
+	// share of the per-minute quota of the pool actually used over the run
+	if (options.perMinute > 0) {
+		double allowed = options.perMinute * options.keys.size() * max(1.0, ceil(elapsed / 60.0));
+		cout << "quota          : " << requests + refused << " / " << allowed << " requests allowed ("
+			<< 100.0 * (requests + refused) / allowed << "% of the per-minute quota)\n";
+	}
+	else {
+		cout << "quota          : no per-minute limit\n";
+	}
+	for (const VtKeyUsage& usage : keys.usage()) {
+		cout << "  " << usage.name << "         : " << usage.sent << " requests, " << usage.refused << " refused (204)"
+			<< (usage.state == VT_KEY_DENIED ? ", denied (403)" : usage.state == VT_KEY_EXHAUSTED ? ", used up" : "") << "\n";
+	}
+	return failed > 0 || dropped > 0 ? 2 : 0;
+}
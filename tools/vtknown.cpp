@@ -0,0 +1,321 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - known-hash index builder
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Builds the index read by the X-Tension (knownfile in config.ini) from
+// NSRL RDS NSRLFile.txt files, hash set exports or plain hash lists : for
+// each type of --types (default sha1), the first token of that many
+// hexadecimal characters of each line is taken (32 MD5, 40 SHA-1, 64
+// SHA-256), the other lines (headers...) are ignored. A volume snapshot
+// hashed with MD5 or SHA-256 only needs an index imported with that type.
+// RDS v3 is an SQLite database, export its hash columns first, e.g.
+//   sqlite3 RDS.db "SELECT sha1 FROM FILE" > nsrl.txt
+//
+// The index starts with a blocked Bloom filter of --bits bits per entry
+// (default 10, about 1% of false positives, 0 leaves it out).
+//
+//   vtknown import [--bits N] [--types md5,sha1,sha256] <index> <list>...    ("-" reads stdin)
+//   vtknown check <index> [hash]...                (no hash : lookup speed test)
+
+#include "VtKnownIndex.h"
+#include "VtHash.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	const VtHashType kTypes[] = { VT_HASH_MD5, VT_HASH_SHA1, VT_HASH_SHA256 };
+
+	bool parseDigest(const char* text, size_t size, unsigned char* digest)
+	{
+		for (size_t i = 0; i < size; i++) {
+			int high = hexValue(text[2 * i]);
+			int low = hexValue(text[2 * i + 1]);
+			if (high < 0 || low < 0) {
+				return false;
+			}
+			digest[i] = (unsigned char)(high << 4 | low);
+		}
+		return true;
+	}
+
+	// Key of a hash given on the command line, of any supported type
+	bool parseKey(const string& hash, unsigned char* key)
+	{
+		unsigned char digest[VT_SHA256_SIZE];
+		for (VtHashType type : kTypes) {
+			if (hash.size() == 2 * vtDigestSize(type) && parseDigest(hash.c_str(), vtDigestSize(type), digest)) {
+				vtDigestKey(type, digest, key);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Keys of the first token of each type of types in a line
+	void findDigests(const char* line, size_t size, unsigned types, vector<uint64_t>& fingerprints)
+	{
+		unsigned found = 0;
+		size_t run = 0;
+		for (size_t i = 0; i <= size && found != types; i++) {
+			if (i < size && hexValue(line[i]) >= 0) {
+				run++;
+				continue;
+			}
+			for (VtHashType type : kTypes) {
+				unsigned char digest[VT_SHA256_SIZE];
+				unsigned char key[VT_DIGEST_KEY_SIZE];
+				if ((types & ~found & type) != 0 && run == 2 * vtDigestSize(type)
+					&& parseDigest(line + i - run, vtDigestSize(type), digest)) {
+					vtDigestKey(type, digest, key);
+					fingerprints.push_back(VtKnownIndex::fingerprint(key));
+					found |= type;
+				}
+			}
+			run = 0;
+		}
+	}
+
+	// md5,sha1,sha256
+	bool parseTypes(const string& list, unsigned& types)
+	{
+		types = 0;
+		size_t start = 0;
+		while (start <= list.size()) {
+			size_t comma = list.find(',', start);
+			if (comma == string::npos) {
+				comma = list.size();
+			}
+			string name = list.substr(start, comma - start);
+			if (name == "md5") {
+				types |= VT_HASH_MD5;
+			}
+			else if (name == "sha1") {
+				types |= VT_HASH_SHA1;
+			}
+			else if (name == "sha256") {
+				types |= VT_HASH_SHA256;
+			}
+			else {
+				return false;
+			}
+			start = comma + 1;
+		}
+		return types != 0;
+	}
+
+	// Reads a list by large blocks, lines are cut in place
+	void readList(FILE* in, unsigned types, vector<uint64_t>& fingerprints, size_t& lines)
+	{
+		vector<char> buffer(1 << 22);
+		size_t kept = 0;
+		for (;;) {
+			size_t got = fread(buffer.data() + kept, 1, buffer.size() - kept, in);
+			size_t filled = kept + got;
+			bool last = got == 0;
+
+			size_t start = 0;
+			for (size_t i = 0; i < filled; i++) {
+				if (buffer[i] != '\n') {
+					continue;
+				}
+				findDigests(&buffer[start], i - start, types, fingerprints);
+				lines++;
+				start = i + 1;
+			}
+
+			// last line without line break
+			if (last) {
+				if (start < filled) {
+					findDigests(&buffer[start], filled - start, types, fingerprints);
+					lines++;
+				}
+				return;
+			}
+
+			kept = filled - start;
+			memmove(buffer.data(), buffer.data() + start, kept);
+			if (kept == buffer.size()) {
+				kept = 0; // line longer than the buffer, not a hash list
+			}
+		}
+	}
+
+	int import(const string& path, const vector<string>& lists, double bitsPerKey, unsigned types)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		vector<uint64_t> fingerprints;
+		size_t lines = 0;
+
+		for (const string& list : lists) {
+			FILE* in = list == "-" ? stdin : fopen(list.c_str(), "rb");
+			if (in == nullptr) {
+				cerr << "[!] Unable to read " << list << "\n";
+				return 1;
+			}
+			size_t before = fingerprints.size();
+			readList(in, types, fingerprints, lines);
+			if (in != stdin) {
+				fclose(in);
+			}
+			cerr << "[+] " << list << " : " << fingerprints.size() - before << " hashes\n";
+		}
+
+		sort(fingerprints.begin(), fingerprints.end());
+		fingerprints.erase(unique(fingerprints.begin(), fingerprints.end()), fingerprints.end());
+		if (fingerprints.size() > UINT32_MAX) {
+			cerr << "[!] Too many hashes for one index\n";
+			return 1;
+		}
+
+		VtKnownHeader header = {};
+		header.magic = VT_KNOWN_MAGIC;
+		header.version = VT_KNOWN_VERSION;
+		header.count = fingerprints.size();
+		header.bucketBits = VtKnownIndex::bucketBitsFor(header.count);
+
+		// first fingerprint of each bucket, the padding stays at 0
+		vector<uint32_t> buckets(VtKnownIndex::tableSize(header.bucketBits) / sizeof(uint32_t), 0);
+		size_t bucketCount = ((size_t)1 << header.bucketBits) + 1;
+		size_t pos = 0;
+		for (size_t b = 0; b < bucketCount; b++) {
+			while (pos < fingerprints.size() && (fingerprints[pos] >> (64 - header.bucketBits)) < b) {
+				pos++;
+			}
+			buckets[b] = (uint32_t)pos;
+		}
+		buckets[bucketCount - 1] = (uint32_t)fingerprints.size();
+
+		// k = ln 2 * bits per key, optimal for a classic Bloom filter
+		header.filterBlocks = VtBloom::blocksFor(header.count, bitsPerKey);
+		header.filterHashes = (uint32_t)max(1.0, min(16.0, round(bitsPerKey * 0.69)));
+		vector<uint64_t> filter(header.filterBlocks * VT_BLOOM_BLOCK_BITS / 64, 0);
+		for (size_t i = 0; header.filterBlocks > 0 && i < fingerprints.size(); i++) {
+			VtBloom::add(filter.data(), header.filterBlocks, header.filterHashes, fingerprints[i]);
+		}
+
+		// written next to the index then renamed, a running X-Tension keeps the old one
+		string temp = path + ".tmp";
+		FILE* out = fopen(temp.c_str(), "wb");
+		if (out == nullptr
+			|| fwrite(&header, sizeof(header), 1, out) != 1
+			|| fwrite(filter.data(), sizeof(uint64_t), filter.size(), out) != filter.size()
+			|| fwrite(buckets.data(), sizeof(uint32_t), buckets.size(), out) != buckets.size()
+			|| fwrite(fingerprints.data(), sizeof(uint64_t), fingerprints.size(), out) != fingerprints.size()
+			|| fclose(out) != 0
+			|| rename(temp.c_str(), path.c_str()) != 0) {
+			cerr << "[!] Unable to write " << path << "\n";
+			return 1;
+		}
+
+		double seconds = duration<double>(steady_clock::now() - start).count();
+		cerr << "[+] " << lines << " lines, " << fingerprints.size() << " distinct hashes written to " << path
+			<< " (" << (sizeof(header) + filter.size() * 8 + buckets.size() * 4 + fingerprints.size() * 8) / (1024 * 1024) << " MB, "
+			<< seconds << " s)\n";
+		if (header.filterBlocks > 0) {
+			cerr << "[+] Filter : " << filter.size() * 8 / 1024 << " KB, " << header.filterHashes << " hashes per key, "
+				<< VtBloom::falsePositiveRate(header.count, header.filterBlocks, header.filterHashes) * 100
+				<< " % false positives\n";
+		}
+		return 0;
+	}
+
+	int check(const string& path, const vector<string>& hashes)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		VtKnownIndex index;
+		if (!index.open(path)) {
+			cerr << "[!] " << path << " is not a known-hash index\n";
+			return 1;
+		}
+		double openMs = duration<double, milli>(steady_clock::now() - start).count();
+		cerr << "[+] " << index.count() << " entries, opened in " << openMs << " ms\n";
+		const VtBloom& filter = index.filter();
+		if (filter.isAttached()) {
+			cerr << "[+] Filter : " << filter.sizeBytes() / 1024 << " KB, " << filter.hashCount() << " hashes per key, "
+				<< VtBloom::falsePositiveRate(index.count(), filter.blockCount(), filter.hashCount()) * 100
+				<< " % false positives\n";
+		}
+
+		for (const string& hash : hashes) {
+			unsigned char key[VT_DIGEST_KEY_SIZE];
+			if (!parseKey(hash, key)) {
+				cout << hash << " : not an MD5, SHA-1 or SHA-256\n";
+				continue;
+			}
+			cout << hash << (index.contains(key) ? " : known\n" : " : unknown\n");
+		}
+
+		// lookup speed on random hashes
+		if (hashes.empty()) {
+			const int lookups = 1000000;
+			mt19937_64 rng(1);
+			vector<unsigned char> digests(20 * lookups);
+			for (unsigned char& b : digests) {
+				b = (unsigned char)rng();
+			}
+
+			size_t found = 0;
+			start = steady_clock::now();
+			for (int i = 0; i < lookups; i++) {
+				found += index.contains(&digests[20 * i]);
+			}
+			double ns = duration<double, nano>(steady_clock::now() - start).count() / lookups;
+			cerr << "[+] " << lookups << " random lookups : " << ns << " ns each, " << found << " found\n";
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	string command = argc > 2 ? argv[1] : "";
+	int first = 2;
+	double bitsPerKey = 10;
+	unsigned types = VT_HASH_SHA1;
+	bool valid = true;
+	while (command == "import" && argc > first + 2) {
+		string option = argv[first];
+		if (option == "--bits") {
+			bitsPerKey = atof(argv[first + 1]);
+		}
+		else if (option == "--types") {
+			valid = valid && parseTypes(argv[first + 1], types);
+		}
+		else {
+			break;
+		}
+		first += 2;
+	}
+	vector<string> args(argv + min(argc, first + 1), argv + argc);
+
+	if (command == "import" && valid && !args.empty() && bitsPerKey >= 0 && bitsPerKey <= 64) {
+		return import(argv[first], args, bitsPerKey, types);
+	}
+	if (command == "check") {
+		return check(argv[2], args);
+	}
+
+	cerr << "usage: vtknown import [--bits N] [--types md5,sha1,sha256] <index> <list>...   (\"-\" reads stdin)\n"
+		"       vtknown check <index> [hash]...\n";
+	return 1;
+}
@@ -0,0 +1,473 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - local VirusTotal stand-in (Linux)
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Answers GET <prefix>/file/report?apikey=...&resource=h1%2Ch2... like the
+// v2 API : an object for one resource, an array for several, HTTP 204 once
+// the quota of the key is used up. Reports are derived from the hash so the
+// same hash always gets the same verdict.
+//
+//   vtmock [--port 8080] [--latency fixed:0] [--p204 0] [--p403 0] [--p5xx 0]
+//          [--known 0.5] [--detected 0.2] [--engines 70] [--batch 25]
+//          [--perminute 0] [--perday 0] [--keys k1,k2] [--cert c.pem --key k.pem]
+//
+// Latency : fixed:MS, uniform:MIN:MAX, normal:MEAN:SD, lognormal:MEDIAN:SIGMA
+// or exp:MEAN (milliseconds). Statistics are printed on Ctrl+C.
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	struct Options {
+		int port = 8080;
+		string latency = "fixed:0";
+		double p204 = 0;
+		double p403 = 0;
+		double p5xx = 0;
+		double known = 0.5;		// share of hashes VirusTotal knows
+		double detected = 0.2;	// share of known hashes with positives
+		int engines = 70;
+		size_t batch = 25;		// resources answered per request
+		int perMinute = 0;		// quota per key, 0 = no limit
+		int perDay = 0;
+		vector<string> keys;	// accepted keys, empty = any
+		string cert;
+		string key;
+	};
+
+	Options options;
+	SSL_CTX* tls = nullptr;
+	volatile sig_atomic_t quit = 0;
+
+	// Counters printed on exit
+	atomic<unsigned long> requests(0), resources(0), answered200(0), answered204(0),
+		answered403(0), answered5xx(0), answered404(0);
+
+	//////////////////////////////////////////
+	//										//
+	//			Latency						//
+	//										//
+	//////////////////////////////////////////
+
+	double sampleLatency(mt19937_64& rng)
+	{
+		vector<double> p;
+		string kind = options.latency.substr(0, options.latency.find(':'));
+		stringstream spec(options.latency.substr(kind.size()));
+		string field;
+		while (getline(spec, field, ':')) {
+			if (!field.empty()) {
+				p.push_back(atof(field.c_str()));
+			}
+		}
+		p.resize(2, 0);
+
+		double ms = p[0];
+		if (kind == "uniform") {
+			ms = uniform_real_distribution<double>(p[0], p[1])(rng);
+		}
+		else if (kind == "normal") {
+			ms = normal_distribution<double>(p[0], p[1])(rng);
+		}
+		else if (kind == "lognormal") {
+			ms = lognormal_distribution<double>(log(max(p[0], 0.001)), p[1])(rng);
+		}
+		else if (kind == "exp") {
+			ms = exponential_distribution<double>(1.0 / max(p[0], 0.001))(rng);
+		}
+		return max(ms, 0.0);
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Quota						//
+	//										//
+	//////////////////////////////////////////
+
+	struct KeyUsage {
+		deque<steady_clock::time_point> minute;
+		int day = 0;
+	};
+	mutex quotaLock;
+	map<string, KeyUsage> usage;
+
+	// false when the request goes over the quota of the key
+	bool spend(const string& apiKey)
+	{
+		lock_guard<mutex> guard(quotaLock);
+		KeyUsage& key = usage[apiKey];
+		steady_clock::time_point now = steady_clock::now();
+		while (!key.minute.empty() && now - key.minute.front() >= minutes(1)) {
+			key.minute.pop_front();
+		}
+
+		if ((options.perMinute > 0 && (int)key.minute.size() >= options.perMinute)
+			|| (options.perDay > 0 && key.day >= options.perDay)) {
+			return false;
+		}
+		key.minute.push_back(now);
+		key.day++;
+		return true;
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Reports						//
+	//										//
+	//////////////////////////////////////////
+
+	uint64_t fnv1a(const string& text)
+	{
+		uint64_t h = 1469598103934665603ULL;
+		for (char c : text) {
+			h = (h ^ (unsigned char)c) * 1099511628211ULL;
+		}
+		return h;
+	}
+
+	string report(const string& resource)
+	{
+		uint64_t h = fnv1a(resource);
+		double draw = (double)(h % 1000000) / 1000000.0;
+		if (draw >= options.known) {
+			return "{\"response_code\": 0, \"resource\": \"" + resource +
+				"\", \"verbose_msg\": \"The requested resource is not among the finished, queued or pending scans\"}";
+		}
+
+		int positives = 0;
+		if ((double)((h >> 20) % 1000000) / 1000000.0 < options.detected) {
+			positives = 1 + (int)((h >> 40) % (uint64_t)max(1, options.engines));
+		}
+
+		ostringstream out;
+		out << "{\"scans\": {";
+		for (int i = 0; i < options.engines; i++) {
+			bool hit = i < positives;
+			out << (i ? ", " : "") << "\"Engine" << i << "\": {\"detected\": " << (hit ? "true" : "false")
+				<< ", \"version\": \"1.0." << i << "\", \"result\": "
+				<< (hit ? "\"Trojan.Mock." + to_string(h % 997) + "\"" : string("null"))
+				<< ", \"update\": \"20230501\"}";
+		}
+		out << "}, \"scan_id\": \"" << resource << "-1682935872\", \"sha1\": \"" << resource
+			<< "\", \"resource\": \"" << resource << "\", \"response_code\": 1"
+			<< ", \"scan_date\": \"2023-05-01 10:11:12\""
+			<< ", \"permalink\": \"https://www.virustotal.com/gui/file/" << resource << "/detection\""
+			<< ", \"verbose_msg\": \"Scan finished, information embedded\""
+			<< ", \"total\": " << options.engines << ", \"positives\": " << positives << "}";
+		return out.str();
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			HTTP						//
+	//										//
+	//////////////////////////////////////////
+
+	string queryValue(const string& query, const string& name)
+	{
+		size_t pos = 0;
+		while (pos < query.size()) {
+			size_t amp = query.find('&', pos);
+			string pair = query.substr(pos, amp == string::npos ? string::npos : amp - pos);
+			if (pair.compare(0, name.size() + 1, name + "=") == 0) {
+				return pair.substr(name.size() + 1);
+			}
+			if (amp == string::npos) {
+				break;
+			}
+			pos = amp + 1;
+		}
+		return string();
+	}
+
+	vector<string> splitResources(string list)
+	{
+		size_t pos;
+		while ((pos = list.find("%2C")) != string::npos || (pos = list.find("%2c")) != string::npos) {
+			list.replace(pos, 3, ",");
+		}
+
+		vector<string> out;
+		stringstream in(list);
+		string item;
+		while (getline(in, item, ',')) {
+			if (!item.empty()) {
+				out.push_back(item);
+			}
+		}
+		return out;
+	}
+
+	struct Answer {
+		int code;
+		string status;
+		string body;
+		string apiMessage;
+	};
+
+	Answer handle(const string& method, const string& target, mt19937_64& rng)
+	{
+		requests++;
+		size_t question = target.find('?');
+		string path = target.substr(0, question);
+		string query = question == string::npos ? string() : target.substr(question + 1);
+
+		// warm-up requests of the X-Tension
+		if (method == "HEAD" || path.size() < 12 || path.compare(path.size() - 12, 12, "/file/report") != 0) {
+			if (method == "HEAD") {
+				return Answer{ 200, "OK", "", "" };
+			}
+			answered404++;
+			return Answer{ 404, "Not Found", "", "" };
+		}
+
+		uniform_real_distribution<double> draw(0, 1);
+		string apiKey = queryValue(query, "apikey");
+		bool knownKey = options.keys.empty();
+		for (const string& key : options.keys) {
+			knownKey = knownKey || key == apiKey;
+		}
+		if (!knownKey || draw(rng) < options.p403) {
+			answered403++;
+			return Answer{ 403, "Forbidden", "", "Invalid API key" };
+		}
+		if (draw(rng) < options.p5xx) {
+			answered5xx++;
+			return draw(rng) < 0.5 ? Answer{ 500, "Internal Server Error", "", "" }
+				: Answer{ 503, "Service Unavailable", "", "" };
+		}
+		if (draw(rng) < options.p204 || !spend(apiKey)) {
+			answered204++;
+			return Answer{ 204, "No Content", "", "" };
+		}
+
+		vector<string> list = splitResources(queryValue(query, "resource"));
+		if (list.size() > options.batch) {
+			list.resize(options.batch);
+		}
+		resources += list.size();
+		answered200++;
+
+		string body;
+		if (list.size() == 1) {
+			body = report(list[0]);
+		}
+		else {
+			body = "[";
+			for (size_t i = 0; i < list.size(); i++) {
+				body += (i ? ", " : "") + report(list[i]);
+			}
+			body += "]";
+		}
+		return Answer{ 200, "OK", body, "" };
+	}
+
+	// Plain socket or TLS session
+	struct Connection {
+		int fd;
+		SSL* ssl;
+
+		long receive(char* buf, size_t size) { return ssl ? SSL_read(ssl, buf, (int)size) : recv(fd, buf, size, 0); }
+		bool send(const string& data)
+		{
+			size_t sent = 0;
+			while (sent < data.size()) {
+				long n = ssl ? SSL_write(ssl, data.data() + sent, (int)(data.size() - sent))
+					: ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if (n <= 0) {
+					return false;
+				}
+				sent += n;
+			}
+			return true;
+		}
+	};
+
+	// One thread per connection, requests are answered in order (keep-alive)
+	void serve(int fd, unsigned seed)
+	{
+		mt19937_64 rng(seed);
+		Connection conn{ fd, nullptr };
+		if (tls != nullptr) {
+			conn.ssl = SSL_new(tls);
+			SSL_set_fd(conn.ssl, fd);
+			if (SSL_accept(conn.ssl) <= 0) {
+				SSL_free(conn.ssl);
+				close(fd);
+				return;
+			}
+		}
+
+		string input;
+		char buf[16384];
+		bool open = true;
+		while (open && !quit) {
+			size_t end;
+			while ((end = input.find("\r\n\r\n")) == string::npos) {
+				long n = conn.receive(buf, sizeof(buf));
+				if (n <= 0) {
+					open = false;
+					break;
+				}
+				input.append(buf, n);
+			}
+			if (!open) {
+				break;
+			}
+
+			string head = input.substr(0, end);
+			input.erase(0, end + 4);
+
+			string method, target, version;
+			stringstream line(head.substr(0, head.find("\r\n")));
+			line >> method >> target >> version;
+			bool keepAlive = version == "HTTP/1.1" && head.find("Connection: close") == string::npos;
+
+			Answer answer = handle(method, target, rng);
+
+			// latency of the "remote" side, the connection stays busy meanwhile
+			double ms = sampleLatency(rng);
+			if (ms > 0) {
+				this_thread::sleep_for(microseconds((long long)(ms * 1000)));
+			}
+
+			ostringstream response;
+			response << "HTTP/1.1 " << answer.code << " " << answer.status << "\r\n"
+				<< "Content-Type: application/json\r\n";
+			if (!answer.apiMessage.empty()) {
+				response << "X-Api-Message: " << answer.apiMessage << "\r\n";
+			}
+			if (answer.code != 204) {
+				response << "Content-Length: " << answer.body.size() << "\r\n";
+			}
+			response << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n\r\n";
+			if (method != "HEAD") {
+				response << answer.body;
+			}
+
+			open = conn.send(response.str()) && keepAlive;
+		}
+
+		if (conn.ssl != nullptr) {
+			SSL_shutdown(conn.ssl);
+			SSL_free(conn.ssl);
+		}
+		close(fd);
+	}
+
+	void onSignal(int)
+	{
+		quit = 1;
+	}
+
+	bool parseArgs(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			if (i + 1 >= argc) {
+				return false;
+			}
+			string value = argv[++i];
+			if (arg == "--port") options.port = atoi(value.c_str());
+			else if (arg == "--latency") options.latency = value;
+			else if (arg == "--p204") options.p204 = atof(value.c_str());
+			else if (arg == "--p403") options.p403 = atof(value.c_str());
+			else if (arg == "--p5xx") options.p5xx = atof(value.c_str());
+			else if (arg == "--known") options.known = atof(value.c_str());
+			else if (arg == "--detected") options.detected = atof(value.c_str());
+			else if (arg == "--engines") options.engines = atoi(value.c_str());
+			else if (arg == "--batch") options.batch = (size_t)max(1, atoi(value.c_str()));
+			else if (arg == "--perminute") options.perMinute = atoi(value.c_str());
+			else if (arg == "--perday") options.perDay = atoi(value.c_str());
+			else if (arg == "--keys") options.keys = splitResources(value);
+			else if (arg == "--cert") options.cert = value;
+			else if (arg == "--key") options.key = value;
+			else return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (!parseArgs(argc, argv)) {
+		cerr << "usage: vtmock [--port 8080] [--latency fixed:MS|uniform:MIN:MAX|normal:MEAN:SD|lognormal:MEDIAN:SIGMA|exp:MEAN]\n"
+			"              [--p204 P] [--p403 P] [--p5xx P] [--known P] [--detected P] [--engines N]\n"
+			"              [--batch N] [--perminute N] [--perday N] [--keys k1,k2] [--cert PEM --key PEM]\n";
+		return 1;
+	}
+
+	// HTTPS when a certificate is given
+	if (!options.cert.empty()) {
+		tls = SSL_CTX_new(TLS_server_method());
+		if (tls == nullptr
+			|| SSL_CTX_use_certificate_chain_file(tls, options.cert.c_str()) != 1
+			|| SSL_CTX_use_PrivateKey_file(tls, options.key.c_str(), SSL_FILETYPE_PEM) != 1) {
+			cerr << "[!] Unable to load " << options.cert << " / " << options.key << "\n";
+			ERR_print_errors_fp(stderr);
+			return 1;
+		}
+	}
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t)options.port);
+	if (bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 128) != 0) {
+		cerr << "[!] Unable to listen on port " << options.port << ": " << strerror(errno) << "\n";
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	cerr << "[+] Listening on " << (tls ? "https" : "http") << "://127.0.0.1:" << options.port << "/vtapi/v2/\n";
+
+	unsigned seed = 1;
+	while (!quit) {
+		pollfd pfd = { server, POLLIN, 0 };
+		if (poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+		int fd = accept(server, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		thread(serve, fd, seed++).detach();
+	}
+	close(server);
+
+	cerr << "[+] Requests : " << requests << " (" << resources << " resources)\n"
+		<< "    200 : " << answered200 << ", 204 : " << answered204 << ", 403 : " << answered403
+		<< ", 5xx : " << answered5xx << ", 404 : " << answered404 << "\n";
+	return 0;
+}
@@ -0,0 +1,348 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - hash list scanner (Linux)
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Looks up the hashes of lists exported by other tools (md5sum, sha1sum,
+// sha256sum, hash set exports, CSV...) through the lookup pipeline of the
+// X-Tension (VtPipeline) and with its config.ini : known-hash index, verdict
+// cache, batches by risk, quotas of the keys, retries. The verdicts are
+// written as JSON Lines, the same objects as reportformat=jsonl, the
+// messages and the stage timings go to stderr.
+// The first token of 32, 40 or 64 hexadecimal characters of a line is its
+// hash (MD5, SHA-1, SHA-256), what follows it is the name of the item, as in
+// "hash  name" ; item_id is the position of the hash in the lists, from 0,
+// size is -1. Lines without a hash are ignored.
+//
+//   vtscan [--config config.ini] [--url URL] [--out -] [list]...   (no list or "-" reads stdin)
+// --url overrides apiurl, e.g. to run against tools/vtmock.
+
+#include "VtPipeline.h"
+#include "VtConfig.h"
+#include "VtReport.h"
+#include "VtPriority.h"
+#include "VtTiming.h"
+#include "VtLog.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace
+{
+	struct Options {
+		string config = VT_CONFIG_FILE;
+		string url;
+		string out = "-";
+		vector<string> lists;
+	};
+
+	int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// Names are UTF-8 in the lists, UTF-16/32 in the pipeline and the report
+	wstring fromUtf8(const string& in)
+	{
+		wstring out;
+		out.reserve(in.size());
+		for (size_t i = 0; i < in.size();) {
+			unsigned char c = (unsigned char)in[i];
+			unsigned long cp = c;
+			size_t extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+			if (extra > 0) {
+				cp = c & (0x3F >> extra);
+			}
+			i++;
+			for (size_t n = 0; n < extra && i < in.size(); n++, i++) {
+				cp = (cp << 6) | ((unsigned char)in[i] & 0x3F);
+			}
+			out += (wchar_t)cp;
+		}
+		return out;
+	}
+
+	// gLog sink : UTF-8 on stderr
+	void printMessage(const wchar_t* message)
+	{
+		string line;
+		for (const wchar_t* p = message; *p != L'\0'; p++) {
+			unsigned long cp = (unsigned long)*p;
+			if (cp < 0x80) {
+				line += (char)cp;
+			}
+			else if (cp < 0x800) {
+				line += (char)(0xC0 | (cp >> 6));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				line += (char)(0xE0 | (cp >> 12));
+				line += (char)(0x80 | ((cp >> 6) & 0x3F));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+			else {
+				line += (char)(0xF0 | (cp >> 18));
+				line += (char)(0x80 | ((cp >> 12) & 0x3F));
+				line += (char)(0x80 | ((cp >> 6) & 0x3F));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+		cerr << line << "\n";
+	}
+
+	// First token of 32, 40 or 64 hexadecimal characters of a line, name is
+	// what follows it
+	bool parseLine(const string& line, VtHashType& type, uint8_t* digest, string& name)
+	{
+		size_t run = 0;
+		for (size_t i = 0; i <= line.size(); i++) {
+			if (i < line.size() && hexValue(line[i]) >= 0) {
+				run++;
+				continue;
+			}
+			if (run == 32 || run == 40 || run == 64) {
+				type = run == 32 ? VT_HASH_MD5 : (run == 40 ? VT_HASH_SHA1 : VT_HASH_SHA256);
+				const char* hex = line.c_str() + i - run;
+				for (size_t n = 0; n < run / 2; n++) {
+					digest[n] = (uint8_t)(hexValue(hex[2 * n]) << 4 | hexValue(hex[2 * n + 1]));
+				}
+
+				// "hash  name", "hash *name" (binary mode of sha1sum), "hash,name"
+				size_t first = line.find_first_not_of(" \t*,;", i);
+				size_t last = line.find_last_not_of(" \t\r\n");
+				name = first != string::npos && last != string::npos && last >= first ? line.substr(first, last - first + 1) : "";
+				return true;
+			}
+			run = 0;
+		}
+		return false;
+	}
+
+	// The hashes of the lists, as the pipeline sees them
+	class ScanHost : public VtPipelineHost {
+	public:
+		explicit ScanHost(VtReport& output) : verdicts(0), detected(0), known(0), report(output) {}
+
+		long add(const string& name)
+		{
+			names.push_back(fromUtf8(name));
+			return (long)names.size() - 1;
+		}
+
+		size_t items() const { return names.size(); }
+
+		const wchar_t* itemName(long itemID) override
+		{
+			return names[itemID].c_str();
+		}
+
+		// the extension and the folders of the name, nothing else is known
+		int itemRisk(long itemID) override
+		{
+			VtItemTraits traits = {};
+			wstring path = names[itemID];
+			for (wchar_t& c : path) {
+				if (c == L'/') {
+					c = L'\\';
+				}
+			}
+			size_t slash = path.find_last_of(L'\\');
+			traits.name = slash == wstring::npos ? path : path.substr(slash + 1);
+			traits.path = slash == wstring::npos ? L"\\" : L"\\" + path.substr(0, slash + 1);
+			traits.size = -1;
+			return vtRiskScore(traits);
+		}
+
+		void itemKnown(long itemID, const string& hash) override
+		{
+			known++;
+			report.writeKnown(itemID, names[itemID], -1, hash);
+		}
+
+		void itemVerdict(long itemID, const string& hash, const VtVerdict& verdict, bool cached) override
+		{
+			verdicts++;
+			detected += verdict.positives > 0;
+			report.write(itemID, names[itemID], -1, hash, verdict, cached);
+		}
+
+		size_t verdicts;
+		size_t detected;
+		size_t known;
+
+	private:
+		VtReport& report;
+		vector<wstring> names;
+	};
+
+	bool parseArgs(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+				if (i + 1 >= argc) {
+					return false;
+				}
+				string value = argv[++i];
+				if (arg == "--config") options.config = value;
+				else if (arg == "--url") options.url = value;
+				else if (arg == "--out") options.out = value;
+				else return false;
+			}
+			else {
+				options.lists.push_back(arg);
+			}
+		}
+		if (options.lists.empty()) {
+			options.lists.push_back("-");
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseArgs(argc, argv, options)) {
+		cerr << "usage: vtscan [--config config.ini] [--url URL] [--out -] [list]...   (no list or \"-\" reads stdin)\n";
+		return 1;
+	}
+
+	VtConfig config;
+	vector<string> errors;
+	if (!vtLoadConfig(options.config, config, errors)) {
+		cerr << "[!] Invalid configuration : " << options.config << "\n";
+		for (const string& error : errors) {
+			cerr << "[!] " << error << "\n";
+		}
+		return 1;
+	}
+	if (!options.url.empty()) {
+		config.apiUrl = options.url;
+	}
+
+	VtLog log;
+	log.setSink(printMessage);
+	log.setLevel(config.logLevel);
+	log.setProgressInterval(config.progress);
+
+	VtTimings timings;
+	steady_clock::time_point start = steady_clock::now();
+	VtPipeline pipeline;
+	VtReport report;
+	if (!report.open(options.out, VT_REPORT_JSONL)) {
+		cerr << "[!] Unable to write " << options.out << "\n";
+		return 1;
+	}
+	ScanHost host(report);
+	if (!pipeline.open(config, log, timings) || !pipeline.start(&host)) {
+		return 1;
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Lists						//
+	//										//
+	//////////////////////////////////////////
+
+	int result = 0;
+	string line;
+	string name;
+	uint8_t digest[VT_SHA256_SIZE];
+	for (size_t l = 0; l < options.lists.size() && result == 0; l++) {
+		const string& list = options.lists[l];
+		FILE* in = list == "-" ? stdin : fopen(list.c_str(), "rb");
+		if (in == nullptr) {
+			cerr << "[!] Unable to read " << list << "\n";
+			result = 1;
+			break;
+		}
+
+		char chunk[4096];
+		line.clear();
+		bool more = true;
+		while (more && result == 0) {
+			more = fgets(chunk, sizeof(chunk), in) != nullptr;
+			if (more) {
+				line += chunk;
+				if (line.back() != '\n' && !feof(in)) {
+					continue;
+				}
+			}
+			else if (line.empty()) {
+				break;
+			}
+
+			VtHashType type;
+			if (parseLine(line, type, digest, name)) {
+				long itemID = host.add(name);
+				result = pipeline.poll();
+				if (result == 0) {
+					pipeline.lookup(itemID, type, digest);
+				}
+			}
+			line.clear();
+
+			if (log.progressDue()) {
+				VT_LOG(log, VT_LOG_INFO) << L"[+] Progress : " << host.items() << L" hashes read, " << pipeline.queued()
+					<< L" queued, " << pipeline.answered() << L" answered, " << pipeline.cached() << L" cached, "
+					<< pipeline.known() << L" known";
+			}
+		}
+		if (in != stdin) {
+			fclose(in);
+		}
+	}
+
+	//////////////////////////////////////////
+	//										//
+	//			Last batches				//
+	//										//
+	//////////////////////////////////////////
+
+	pipeline.submit(true);
+	while (result == 0) {
+		bool more = pipeline.wait(1000, result);
+		pipeline.submit(true);
+		if (!more && pipeline.inFlight() == 0) {
+			break;
+		}
+		if (log.progressDue()) {
+			VT_LOG(log, VT_LOG_INFO) << L"[+] Progress : " << pipeline.answered() << L"/" << pipeline.queued()
+				<< L" answered, " << pipeline.inFlight() << L" request(s) in flight";
+		}
+	}
+
+	log.flush();
+	VT_LOG(log, VT_LOG_INFO) << L"[+] " << host.items() << L" hash(es) read, " << host.verdicts << L" verdict(s), "
+		<< host.detected << L" detected, " << host.known << L" known file(s)";
+	pipeline.finish(result == 0);
+	pipeline.close();
+	report.close();
+
+	// where the time went, for profiling on a build box
+	timings.add(VT_STAGE_RUN, (uint64_t)duration_cast<nanoseconds>(steady_clock::now() - start).count());
+	cerr << fixed << setprecision(3) << "[+] Timings (ms) : count, total, mean, p50, p95, p99\n";
+	for (int stage = 0; stage < VT_STAGE_COUNT; stage++) {
+		const VtHistogram& histogram = timings.stage((VtStage)stage);
+		if (histogram.count() == 0) {
+			continue;
+		}
+		cerr << "[+]   " << vtStageName((VtStage)stage) << " : " << histogram.count() << ", "
+			<< histogram.total() / 1e6 << ", " << histogram.mean() / 1e6 << ", " << histogram.percentile(0.50) / 1e6 << ", "
+			<< histogram.percentile(0.95) / 1e6 << ", " << histogram.percentile(0.99) / 1e6 << "\n";
+	}
+	if (!config.timingFile.empty() && !timings.writeCsv(config.timingFile, "vtscan")) {
+		cerr << "[!] Unable to write the timing file\n";
+	}
+	return result == 0 ? 0 : 2;
+}
@@ -0,0 +1,1045 @@
+///////////////////////////////////////////////////////////////////////////////
+// X-Tension using VirusTotal API - simulated X-Ways host (Linux)
+// Copyright 2023 Patrice Couillon
+///////////////////////////////////////////////////////////////////////////////
+// Loads an X-Tension built as a shared object (make X-Vt.so) and runs it the
+// way X-Ways refines a volume snapshot : XT_Init, then for each run
+// XT_Prepare, XT_ProcessItemEx for every item, from several threads when
+// XT_Init says the X-Tension is thread-safe, XT_Finalize, and XT_Done.
+// The XWF_* functions are exported by this executable, XT_RetrieveFunctionPointers
+// finds them with dlsym as it finds those of X-Ways with GetProcAddress. They
+// answer from a synthetic volume snapshot : folders, files with a size drawn
+// from a distribution, duplicate contents, hashes already computed or not.
+// The content of a file is generated from its key, so XWF_Read, the hashes
+// of the snapshot and the hashes set by the X-Tension all agree.
+//
+//   xwsim [--items 100000] [--size lognormal:8192:1.5] [--max-size 16777216] [--dup 0.3]
+//         [--hashed 1] [--hash1 sha1] [--hash2 none] [--threads 1] [--runs 1]
+//         [--folders 200] [--cancel 0] [--seed 1] [--quiet] X-Vt.so
+// --size : fixed:N, uniform:MIN:MAX, lognormal:MEDIAN:SIGMA, exp:MEAN (bytes)
+// --dup : share of the files that are a copy of an earlier file
+// --hashed : share of the files whose hashes the volume snapshot already holds
+// --hash1, --hash2 : md5, sha1, sha256 or none
+// --cancel : XWF_ShouldStop returns TRUE after N items, as if Cancel was pressed
+// Only the XWF_* functions an X-Tension reads items with are exported, the
+// others stay missing as with an older X-Ways.
+
+#include "VtHash.h"
+#include <stdint.h>
+#include <wchar.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <type_traits>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <dlfcn.h>
+
+// the types and XWF_* signatures of the API, in a namespace : the XWF_*
+// pointers it declares must not collide with the XWF_* functions below
+namespace xt
+{
+#include "X-Tension.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+using namespace xt;
+
+// XWF_GetVSProp
+#define XWF_VSPROP_HASHTYPE1	20
+#define XWF_VSPROP_HASHTYPE2	21
+#define XWF_HASHTYPE_MD5		7
+#define XWF_HASHTYPE_SHA1		8
+#define XWF_HASHTYPE_SHA256		9
+
+// XT_Init return value, 1 = not thread-safe
+#define XT_INIT_THREADSAFE		2
+
+// XT_Prepare return value
+#define XT_PREPARE_CALLPI				0x01
+#define XT_PREPARE_TARGETDIRS			0x10
+#define XT_PREPARE_TARGETZEROBYTEFILES	0x20
+
+// XWF_GetItemInformation(XWF_ITEM_INFO_FLAGS)
+#define XWF_ITEM_DIRECTORY		0x01
+#define XWF_ITEM_HASCHILDREN	0x02
+#define XWF_ITEM_TAGGED			0x20
+
+namespace
+{
+	struct Options {
+		size_t items = 100000;
+		string size = "lognormal:8192:1.5";
+		INT64 maxSize = 16 << 20;
+		double dup = 0.3;
+		double hashed = 1.0;
+		int hash1 = XWF_HASHTYPE_SHA1;
+		int hash2 = 0;
+		unsigned threads = 1;
+		unsigned runs = 1;
+		size_t folders = 200;
+		long cancel = 0;
+		unsigned seed = 1;
+		bool quiet = false;
+		string xtension;
+	};
+	Options options;
+
+	//////////////////////////////////////////
+	//										//
+	//			Volume snapshot				//
+	//										//
+	//////////////////////////////////////////
+
+	struct SimItem {
+		wstring name;
+		LONG parent;		// -1 for the root directory
+		INT64 size;
+		size_t content;		// index in gContents, files only
+		bool directory;
+		INT64 flags;
+		INT64 attributes;
+		bool deleted;
+		wstring type;
+		LONG typeStatus;
+		LONG childFiles;
+		wstring comment;
+		vector<size_t> tables;	// index in gTables
+	};
+
+	// what several files with the same content share
+	struct Content {
+		uint64_t key;
+		INT64 size;
+	};
+
+	// what a HANDLE of the host points to
+	struct SimHandle {
+		enum Kind { VOLUME, EVIDENCE, ITEM } kind;
+		LONG itemID;
+	};
+
+	vector<SimItem> gItems;
+	vector<Content> gContents;
+	size_t gFiles = 0;
+	INT64 gVolumeSize = 0;
+	SimHandle gVolume = { SimHandle::VOLUME, -1 };
+	SimHandle gEvidence = { SimHandle::EVIDENCE, -1 };
+
+	// digests of each content, computed once, by the volume build for the
+	// hashes already in the snapshot, on first request for the others
+	unsigned gHashTypes = 0;
+	unique_ptr<once_flag[]> gDigestOnce;
+	vector<VtDigests> gDigests;
+
+	// hash 1 and 2 of each item held by the snapshot : bit 0 and bit 1
+	unique_ptr<atomic<uint8_t>[]> gHashed;
+
+	// handle passed to XT_ProcessItemEx for each item while it runs, the one
+	// XWF_GetHashValue expects at offset 4 of its buffer to compute a hash
+	unique_ptr<atomic<SimHandle*>[]> gProcessing;
+
+	// comments and report tables, written under lock
+	mutex gItemLock;
+	vector<wstring> gTables;
+
+	// what the X-Tension asked for during the run
+	atomic<long> gProcessed(0);
+	atomic<size_t> gHashAsked(0), gHashMissing(0), gHashComputed(0), gHashSet(0), gHashMismatch(0), gHashBadHandle(0);
+	atomic<size_t> gOpened(0), gBytesRead(0), gComments(0), gTableEntries(0), gMessages(0);
+	volatile sig_atomic_t gInterrupted = 0;
+	mutex gOutputLock;
+
+	uint64_t mix(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	// byte n of a content is byte n % 8 of mix(key + n / 8)
+	unsigned readContent(const Content& content, INT64 offset, BYTE* buffer, unsigned size)
+	{
+		if (offset < 0 || offset >= content.size) {
+			return 0;
+		}
+		unsigned count = (unsigned)min<INT64>(size, content.size - offset);
+		uint64_t position = (uint64_t)offset;
+		for (unsigned done = 0; done < count;) {
+			uint64_t word = mix(content.key + position / 8);
+			unsigned first = (unsigned)(position % 8);
+			unsigned n = min(8 - first, count - done);
+			memcpy(buffer + done, (const BYTE*)&word + first, n);
+			done += n;
+			position += n;
+		}
+		return count;
+	}
+
+	const VtDigests& digestsOf(size_t content)
+	{
+		call_once(gDigestOnce[content], [content]() {
+			VtMultiHash hash(gHashTypes);
+			vector<BYTE> buffer(1 << 16);
+			INT64 offset = 0;
+			unsigned read;
+			while ((read = readContent(gContents[content], offset, buffer.data(), (unsigned)buffer.size())) > 0) {
+				hash.update(buffer.data(), read);
+				offset += read;
+			}
+			hash.final(gDigests[content]);
+		});
+		return gDigests[content];
+	}
+
+	VtHashType hashTypeOf(int type)
+	{
+		switch (type) {
+		case XWF_HASHTYPE_MD5:
+			return VT_HASH_MD5;
+		case XWF_HASHTYPE_SHA1:
+			return VT_HASH_SHA1;
+		case XWF_HASHTYPE_SHA256:
+			return VT_HASH_SHA256;
+		}
+		return (VtHashType)0;
+	}
+
+	int parseHashType(const string& name)
+	{
+		if (name == "md5") return XWF_HASHTYPE_MD5;
+		if (name == "sha1") return XWF_HASHTYPE_SHA1;
+		if (name == "sha256") return XWF_HASHTYPE_SHA256;
+		if (name == "none") return 0;
+		return -1;
+	}
+
+	INT64 sampleSize(mt19937_64& rng)
+	{
+		vector<double> p;
+		string kind = options.size.substr(0, options.size.find(':'));
+		stringstream spec(options.size.substr(kind.size()));
+		string field;
+		while (getline(spec, field, ':')) {
+			if (!field.empty()) {
+				p.push_back(atof(field.c_str()));
+			}
+		}
+		p.resize(2, 0);
+
+		double size = p[0];
+		if (kind == "uniform") {
+			size = uniform_real_distribution<double>(p[0], p[1])(rng);
+		}
+		else if (kind == "lognormal") {
+			size = lognormal_distribution<double>(log(max(p[0], 1.0)), p[1])(rng);
+		}
+		else if (kind == "exp") {
+			size = exponential_distribution<double>(1.0 / max(p[0], 1.0))(rng);
+		}
+		return min((INT64)max(size, 0.0), options.maxSize);
+	}
+
+	LONG addFolder(const wstring& name, LONG parent)
+	{
+		SimItem folder = {};
+		folder.name = name;
+		folder.parent = parent;
+		folder.directory = true;
+		folder.flags = XWF_ITEM_DIRECTORY;
+		gItems.push_back(folder);
+		return (LONG)gItems.size() - 1;
+	}
+
+	// A volume that looks like a Windows system volume : known folders, then
+	// random ones, files of common types spread over them
+	void buildVolume()
+	{
+		mt19937_64 rng(options.seed);
+		uniform_real_distribution<double> draw(0, 1);
+
+		LONG root = addFolder(L"(Root directory)", -1);
+		vector<LONG> folders = { root };
+		const wchar_t* known[][2] = {
+			{ L"Windows", L"" }, { L"System32", L"Windows" }, { L"Program Files", L"" }, { L"ProgramData", L"" },
+			{ L"Users", L"" }, { L"user", L"Users" }, { L"Documents", L"user" }, { L"Downloads", L"user" },
+			{ L"Desktop", L"user" }, { L"AppData", L"user" }, { L"Local", L"AppData" }, { L"Temp", L"Local" },
+		};
+		for (const auto& folder : known) {
+			LONG parent = root;
+			for (LONG id : folders) {
+				if (gItems[id].name == folder[1]) {
+					parent = id;
+				}
+			}
+			folders.push_back(addFolder(folder[0], parent));
+		}
+		for (size_t i = 0; i < options.folders; i++) {
+			LONG parent = folders[uniform_int_distribution<size_t>(0, folders.size() - 1)(rng)];
+			folders.push_back(addFolder(L"folder" + to_wstring(i), parent));
+		}
+
+		// extensions by frequency
+		const wchar_t* extensions[] = { L"dll", L"exe", L"sys", L"txt", L"log", L"xml", L"jpg", L"png", L"pdf", L"docx",
+			L"xlsx", L"zip", L"js", L"ps1", L"html", L"dat", L"mui", L"lnk", L"ini", L"bin" };
+		discrete_distribution<int> extension({ 12, 4, 1, 10, 5, 6, 12, 10, 4, 3, 2, 2, 4, 1, 5, 8, 3, 2, 3, 3 });
+
+		uint8_t slots = (options.hash1 != 0 ? 1 : 0) | (options.hash2 != 0 ? 2 : 0);
+		size_t folderCount = gItems.size();
+		size_t total = max(options.items, folderCount);
+		gItems.reserve(total);
+		for (size_t id = folderCount; id < total; id++) {
+			SimItem file = {};
+			const wchar_t* ext = extensions[extension(rng)];
+			file.parent = folders[uniform_int_distribution<size_t>(0, folders.size() - 1)(rng)];
+			file.name = L"file" + to_wstring(id) + L"." + ext;
+
+			// a copy of an earlier file, or a new content
+			if (!gContents.empty() && draw(rng) < options.dup) {
+				file.content = uniform_int_distribution<size_t>(0, gContents.size() - 1)(rng);
+			}
+			else {
+				gContents.push_back({ mix(((uint64_t)options.seed << 32) + gContents.size()), sampleSize(rng) });
+				file.content = gContents.size() - 1;
+			}
+			file.size = gContents[file.content].size;
+
+			// 1 % renamed executables, 2 % deleted, 1 % hidden, 0.1 % tagged
+			bool renamed = draw(rng) < 0.01;
+			file.type = renamed ? L"exe" : ext;
+			file.typeStatus = renamed ? 6 : 3;
+			file.deleted = draw(rng) < 0.02;
+			file.attributes = draw(rng) < 0.01 ? 0x02 : 0;
+			file.flags = draw(rng) < 0.001 ? XWF_ITEM_TAGGED : 0;
+			gItems[file.parent].childFiles++;
+			gItems[file.parent].flags |= XWF_ITEM_HASCHILDREN;
+			gItems.push_back(file);
+			gFiles++;
+			gVolumeSize += file.size;
+		}
+
+		// digests of the hashes of the snapshot and of those X-Ways or the
+		// X-Tension may compute, SHA-1 when the snapshot has none
+		gHashTypes = hashTypeOf(options.hash1) | hashTypeOf(options.hash2);
+		if (gHashTypes == 0) {
+			gHashTypes = VT_HASH_SHA1;
+		}
+		gDigestOnce.reset(new once_flag[gContents.size()]);
+		gDigests.resize(gContents.size());
+		gHashed.reset(new atomic<uint8_t>[gItems.size()]);
+		gProcessing.reset(new atomic<SimHandle*>[gItems.size()]);
+		vector<bool> needed(gContents.size(), false);
+		for (size_t id = 0; id < gItems.size(); id++) {
+			bool hashed = !gItems[id].directory && slots != 0 && draw(rng) < options.hashed;
+			gHashed[id] = hashed ? slots : 0;
+			gProcessing[id] = nullptr;
+			if (hashed) {
+				needed[gItems[id].content] = true;
+			}
+		}
+
+		// hashed up front, on every core, so that XWF_GetHashValue costs what
+		// it costs in X-Ways : a lookup
+		atomic<size_t> next(0);
+		vector<thread> workers;
+		unsigned cores = max(1u, thread::hardware_concurrency());
+		for (unsigned t = 0; t < cores; t++) {
+			workers.emplace_back([&]() {
+				for (size_t content = next++; content < gContents.size(); content = next++) {
+					if (needed[content]) {
+						digestsOf(content);
+					}
+				}
+			});
+		}
+		for (thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	SimItem* itemOf(LONG itemID)
+	{
+		return itemID >= 0 && (size_t)itemID < gItems.size() ? &gItems[itemID] : nullptr;
+	}
+
+	SimHandle* openItem(LONG itemID)
+	{
+		SimItem* item = itemOf(itemID);
+		if (item == nullptr || item->directory) {
+			return nullptr;
+		}
+		return new SimHandle{ SimHandle::ITEM, itemID };
+	}
+
+	void copyString(const wstring& value, wchar_t* buffer, size_t length)
+	{
+		if (buffer == nullptr || length == 0) {
+			return;
+		}
+		size_t count = min(value.size(), length - 1);
+		wmemcpy(buffer, value.c_str(), count);
+		buffer[count] = L'\0';
+	}
+
+	string toUtf8(const wchar_t* message)
+	{
+		string line;
+		for (const wchar_t* p = message; *p != L'\0'; p++) {
+			unsigned long cp = (unsigned long)*p;
+			if (cp < 0x80) {
+				line += (char)cp;
+			}
+			else if (cp < 0x800) {
+				line += (char)(0xC0 | (cp >> 6));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				line += (char)(0xE0 | (cp >> 12));
+				line += (char)(0x80 | ((cp >> 6) & 0x3F));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+			else {
+				line += (char)(0xF0 | (cp >> 18));
+				line += (char)(0x80 | ((cp >> 12) & 0x3F));
+				line += (char)(0x80 | ((cp >> 6) & 0x3F));
+				line += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+		return line;
+	}
+
+	void onSignal(int)
+	{
+		gInterrupted = 1;
+	}
+}
+
+//////////////////////////////////////////
+//										//
+//			XWF_* functions				//
+//										//
+//////////////////////////////////////////
+
+extern "C" {
+
+INT64 XWF_GetSize(HANDLE hVolumeOrItem, LPVOID lpOptional)
+{
+	SimHandle* handle = (SimHandle*)hVolumeOrItem;
+	if (handle == nullptr) {
+		return -1;
+	}
+	return handle->kind == SimHandle::ITEM ? gItems[handle->itemID].size : gVolumeSize;
+}
+
+void XWF_GetVolumeName(HANDLE hVolume, wchar_t* lpString, DWORD nType)
+{
+	copyString(L"Synthetic volume " + to_wstring(options.seed), lpString, 256);
+}
+
+void XWF_GetVolumeInformation(HANDLE hVolume, LPLONG lpFileSystem, DWORD* nBytesPerSector,
+	DWORD* nSectorsPerCluster, INT64* nClusterCount, INT64* nFirstClusterSectorNo)
+{
+	if (lpFileSystem) *lpFileSystem = 0;
+	if (nBytesPerSector) *nBytesPerSector = 512;
+	if (nSectorsPerCluster) *nSectorsPerCluster = 8;
+	if (nClusterCount) *nClusterCount = (gVolumeSize + 4095) / 4096;
+	if (nFirstClusterSectorNo) *nFirstClusterSectorNo = 0;
+}
+
+// items only, the sectors of the volume are not simulated
+DWORD XWF_Read(HANDLE hVolumeOrItem, INT64 nOffset, BYTE* lpBuffer, DWORD nNumberOfBytesToRead)
+{
+	SimHandle* handle = (SimHandle*)hVolumeOrItem;
+	if (handle == nullptr || handle->kind != SimHandle::ITEM) {
+		return 0;
+	}
+	unsigned read = readContent(gContents[gItems[handle->itemID].content], nOffset, lpBuffer, nNumberOfBytesToRead);
+	gBytesRead += read;
+	return read;
+}
+
+void XWF_SelectVolumeSnapshot(HANDLE hVolume)
+{
+}
+
+INT64 XWF_GetVSProp(LONG nPropType, PVOID pBuffer)
+{
+	if (nPropType == XWF_VSPROP_HASHTYPE1) {
+		return options.hash1;
+	}
+	if (nPropType == XWF_VSPROP_HASHTYPE2) {
+		return options.hash2;
+	}
+	return -1;
+}
+
+DWORD XWF_GetItemCount(LPVOID pReserved)
+{
+	return (DWORD)gItems.size();
+}
+
+DWORD XWF_GetFileCount(LONG nDirID)
+{
+	SimItem* item = itemOf(nDirID);
+	return nDirID == -1 ? (DWORD)gFiles : (item != nullptr ? (DWORD)item->childFiles : 0);
+}
+
+const wchar_t* XWF_GetItemName(LONG nItemID)
+{
+	SimItem* item = itemOf(nItemID);
+	return item != nullptr ? item->name.c_str() : L"";
+}
+
+INT64 XWF_GetItemSize(LONG nItemID)
+{
+	SimItem* item = itemOf(nItemID);
+	return item != nullptr ? item->size : -1;
+}
+
+void XWF_SetItemSize(LONG nItemID, INT64 nSize)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item != nullptr) {
+		item->size = nSize;
+	}
+}
+
+// where the data of an item lies is not simulated
+void XWF_GetItemOfs(LONG nItemID, INT64* lpDefOfs, INT64* lpStartSector)
+{
+	if (lpDefOfs) *lpDefOfs = -1;
+	if (lpStartSector) *lpStartSector = -1;
+}
+
+void XWF_SetItemOfs(LONG nItemID, INT64 nDefOfs, INT64 nStartSector)
+{
+}
+
+INT64 XWF_GetItemInformation(LONG nItemID, LONG nInfoType, LPBOOL lpSuccess)
+{
+	SimItem* item = itemOf(nItemID);
+	BOOL success = item != nullptr;
+	INT64 value = 0;
+	if (item != nullptr) {
+		switch (nInfoType) {
+		case XWF_ITEM_INFO_ORIG_ID:
+			value = nItemID;
+			break;
+		case XWF_ITEM_INFO_ATTR:
+			value = item->attributes;
+			break;
+		case XWF_ITEM_INFO_FLAGS:
+			value = item->flags;
+			break;
+		case XWF_ITEM_INFO_DELETION:
+			value = item->deleted ? 1 : 0;
+			break;
+		case XWF_ITEM_INFO_LINKCOUNT:
+			value = 1;
+			break;
+		case XWF_ITEM_INFO_FILECOUNT:
+			value = item->childFiles;
+			break;
+		case XWF_ITEM_INFO_CREATIONTIME:
+		case XWF_ITEM_INFO_MODIFICATIONTIME:
+		case XWF_ITEM_INFO_LASTACCESSTIME:
+		case XWF_ITEM_INFO_ENTRYMODIFICATIONTIME:
+			value = 133170048000000000LL; // 2023-01-01, FILETIME
+			break;
+		default:
+			success = FALSE;
+		}
+	}
+	if (lpSuccess) {
+		*lpSuccess = success;
+	}
+	return value;
+}
+
+BOOL XWF_SetItemInformation(LONG nItemID, LONG nInfoType, INT64 nInfoValue)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item == nullptr) {
+		return FALSE;
+	}
+	switch (nInfoType) {
+	case XWF_ITEM_INFO_FLAGS:
+		item->flags = nInfoValue;
+		return TRUE;
+	case XWF_ITEM_INFO_FLAGS_SET:
+		item->flags |= nInfoValue;
+		return TRUE;
+	case XWF_ITEM_INFO_FLAGS_REMOVE:
+		item->flags &= ~nInfoValue;
+		return TRUE;
+	case XWF_ITEM_INFO_ATTR:
+		item->attributes = nInfoValue;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// type description and its status : 3 = confirmed, 6 = mismatch detected
+LONG XWF_GetItemType(LONG nItemID, wchar_t* lpTypeDescr, DWORD nBufferLenAndFlags)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item == nullptr) {
+		return -1;
+	}
+	copyString(item->type, lpTypeDescr, nBufferLenAndFlags & 0x0FFFFFFF);
+	return item->typeStatus;
+}
+
+void XWF_SetItemType(LONG nItemID, wchar_t* lpTypeDescr, LONG nTypeStatus)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item != nullptr) {
+		item->type = lpTypeDescr != nullptr ? lpTypeDescr : L"";
+		item->typeStatus = nTypeStatus;
+	}
+}
+
+LONG XWF_GetItemParent(LONG nItemID)
+{
+	SimItem* item = itemOf(nItemID);
+	return item != nullptr ? item->parent : -1;
+}
+
+void XWF_SetItemParent(LONG nChildItemID, LONG nParentItemID)
+{
+	SimItem* item = itemOf(nChildItemID);
+	if (item != nullptr && itemOf(nParentItemID) != nullptr) {
+		item->parent = nParentItemID;
+	}
+}
+
+// no hash database is simulated
+LONG XWF_GetHashSetAssocs(LONG nItemID, LPWSTR lpBuffer, LONG nBufferLen)
+{
+	copyString(L"", lpBuffer, nBufferLen);
+	return 0;
+}
+
+LONG XWF_GetReportTableAssocs(LONG nItemID, wchar_t* lpBuffer, LONG nBufferLen)
+{
+	SimItem* item = itemOf(nItemID);
+	lock_guard<mutex> guard(gItemLock);
+	wstring names;
+	if (item != nullptr) {
+		for (size_t table : item->tables) {
+			names += (names.empty() ? L"" : L", ") + gTables[table];
+		}
+	}
+	copyString(names, lpBuffer, nBufferLen);
+	return item != nullptr ? (LONG)item->tables.size() : 0;
+}
+
+// 1 if newly associated, 0 if it already was
+LONG XWF_AddToReportTable(LONG nItemID, wchar_t* lpReportTableName, DWORD nFlags)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item == nullptr || lpReportTableName == nullptr) {
+		return 0;
+	}
+	lock_guard<mutex> guard(gItemLock);
+	size_t table = find(gTables.begin(), gTables.end(), lpReportTableName) - gTables.begin();
+	if (table == gTables.size()) {
+		gTables.push_back(lpReportTableName);
+	}
+	if (find(item->tables.begin(), item->tables.end(), table) != item->tables.end()) {
+		return 0;
+	}
+	item->tables.push_back(table);
+	gTableEntries++;
+	return 1;
+}
+
+wchar_t* XWF_GetComment(LONG nItemID)
+{
+	SimItem* item = itemOf(nItemID);
+	lock_guard<mutex> guard(gItemLock);
+	return item != nullptr && !item->comment.empty() ? &item->comment[0] : nullptr;
+}
+
+// 0 replaces the comment, otherwise appended
+BOOL XWF_AddComment(LONG nItemID, wchar_t* lpComment, DWORD nFlagsHowToAdd)
+{
+	SimItem* item = itemOf(nItemID);
+	if (item == nullptr || lpComment == nullptr) {
+		return FALSE;
+	}
+	lock_guard<mutex> guard(gItemLock);
+	if (nFlagsHowToAdd == 0 || item->comment.empty()) {
+		item->comment = lpComment;
+	}
+	else {
+		item->comment += L"; ";
+		item->comment += lpComment;
+	}
+	gComments++;
+	return TRUE;
+}
+
+// 0x01 : no line break, 0x04 : ANSI string
+void XWF_OutputMessage(const wchar_t* lpMessage, DWORD nFlags)
+{
+	gMessages++;
+	if (options.quiet || lpMessage == nullptr) {
+		return;
+	}
+	lock_guard<mutex> guard(gOutputLock);
+	cerr << ((nFlags & 0x04) ? string((const char*)lpMessage) : toUtf8(lpMessage)) << ((nFlags & 0x01) ? "" : "\n");
+}
+
+void XWF_ShowProgress(wchar_t* lpCaption, DWORD nFlags)
+{
+}
+
+void XWF_SetProgressPercentage(DWORD nPercent)
+{
+}
+
+void XWF_SetProgressDescription(wchar_t* lpStr)
+{
+}
+
+BOOL XWF_ShouldStop(void)
+{
+	return gInterrupted || (options.cancel > 0 && gProcessed >= options.cancel);
+}
+
+void XWF_HideProgress(void)
+{
+}
+
+BOOL XWF_ReleaseMem(PVOID lpBuffer)
+{
+	return TRUE;
+}
+
+HANDLE XWF_OpenItem(HANDLE hVolume, LONG nItemID, DWORD nFlags)
+{
+	gOpened++;
+	return openItem(nItemID);
+}
+
+void XWF_Close(HANDLE hVolumeOrItem)
+{
+	SimHandle* handle = (SimHandle*)hVolumeOrItem;
+	if (handle != nullptr && handle->kind == SimHandle::ITEM) {
+		delete handle;
+	}
+}
+
+// The DWORD at the start of the buffer selects hash 1 or 2, 0x10 has it
+// computed when the snapshot does not hold it yet, from the item handle that
+// follows the DWORD (offset 4, unaligned on x64)
+BOOL XWF_GetHashValue(LONG nItemID, LPVOID lpBuffer)
+{
+	SimItem* item = itemOf(nItemID);
+	DWORD flag;
+	memcpy(&flag, lpBuffer, sizeof(flag));
+	int slot = (flag & 0x0F) == 2 ? 2 : 1;
+	VtHashType type = hashTypeOf(slot == 1 ? options.hash1 : options.hash2);
+	gHashAsked++;
+	if (item == nullptr || item->directory || type == 0) {
+		return FALSE;
+	}
+	if (!(gHashed[nItemID] & slot)) {
+		gHashMissing++;
+		if (!(flag & 0x10)) {
+			return FALSE;
+		}
+
+		// computing needs the item opened by X-Ways, right after the flag
+		SimHandle* handle;
+		memcpy(&handle, (const BYTE*)lpBuffer + sizeof(DWORD), sizeof(handle));
+		if (handle == nullptr || handle != gProcessing[nItemID]) {
+			gHashBadHandle++;
+			return FALSE;
+		}
+		gHashComputed++;
+		gHashed[nItemID] |= slot;
+	}
+	memcpy(lpBuffer, digestsOf(item->content).of(type), vtDigestSize(type));
+	return TRUE;
+}
+
+// the hash of the item is kept if it is the hash of its content
+BOOL XWF_SetHashValue(LONG nItemID, LPVOID lpHash, DWORD nParam)
+{
+	SimItem* item = itemOf(nItemID);
+	int slot = nParam == 2 ? 2 : 1;
+	VtHashType type = hashTypeOf(slot == 1 ? options.hash1 : options.hash2);
+	if (item == nullptr || item->directory || type == 0) {
+		return FALSE;
+	}
+	gHashSet++;
+	if (memcmp(lpHash, digestsOf(item->content).of(type), vtDigestSize(type)) != 0) {
+		gHashMismatch++;
+		return FALSE;
+	}
+	gHashed[nItemID] |= slot;
+	return TRUE;
+}
+
+// a single evidence object, holding the volume
+HANDLE XWF_GetFirstEvObj(LPVOID pReserved)
+{
+	return &gEvidence;
+}
+
+HANDLE XWF_GetNextEvObj(HANDLE hPrevEvidence, LPVOID pReserved)
+{
+	return nullptr;
+}
+
+HANDLE XWF_OpenEvObj(HANDLE hEvidence, DWORD nFlags)
+{
+	return hEvidence == &gEvidence ? &gVolume : nullptr;
+}
+
+VOID XWF_CloseEvObj(HANDLE hEvidence)
+{
+}
+
+HANDLE XWF_GetEvObj(DWORD nEvObjID)
+{
+	return nEvObjID == 0 ? &gEvidence : nullptr;
+}
+
+}
+
+// every export has the signature of its fptr_XWF_* type in X-Tension.h
+#define XWF_EXPORTED(name) static_assert(is_same<decltype(&::name), fptr_##name>::value, #name " differs from X-Tension.h")
+XWF_EXPORTED(XWF_GetSize);
+XWF_EXPORTED(XWF_GetVolumeName);
+XWF_EXPORTED(XWF_GetVolumeInformation);
+XWF_EXPORTED(XWF_Read);
+XWF_EXPORTED(XWF_SelectVolumeSnapshot);
+XWF_EXPORTED(XWF_GetVSProp);
+XWF_EXPORTED(XWF_GetItemCount);
+XWF_EXPORTED(XWF_GetFileCount);
+XWF_EXPORTED(XWF_GetItemName);
+XWF_EXPORTED(XWF_GetItemSize);
+XWF_EXPORTED(XWF_SetItemSize);
+XWF_EXPORTED(XWF_GetItemOfs);
+XWF_EXPORTED(XWF_SetItemOfs);
+XWF_EXPORTED(XWF_GetItemInformation);
+XWF_EXPORTED(XWF_SetItemInformation);
+XWF_EXPORTED(XWF_GetItemType);
+XWF_EXPORTED(XWF_SetItemType);
+XWF_EXPORTED(XWF_GetItemParent);
+XWF_EXPORTED(XWF_SetItemParent);
+XWF_EXPORTED(XWF_GetHashSetAssocs);
+XWF_EXPORTED(XWF_GetReportTableAssocs);
+XWF_EXPORTED(XWF_AddToReportTable);
+XWF_EXPORTED(XWF_GetComment);
+XWF_EXPORTED(XWF_AddComment);
+XWF_EXPORTED(XWF_OutputMessage);
+XWF_EXPORTED(XWF_ShowProgress);
+XWF_EXPORTED(XWF_SetProgressPercentage);
+XWF_EXPORTED(XWF_SetProgressDescription);
+XWF_EXPORTED(XWF_ShouldStop);
+XWF_EXPORTED(XWF_HideProgress);
+XWF_EXPORTED(XWF_ReleaseMem);
+XWF_EXPORTED(XWF_OpenItem);
+XWF_EXPORTED(XWF_Close);
+XWF_EXPORTED(XWF_GetHashValue);
+XWF_EXPORTED(XWF_SetHashValue);
+XWF_EXPORTED(XWF_GetFirstEvObj);
+XWF_EXPORTED(XWF_GetNextEvObj);
+XWF_EXPORTED(XWF_OpenEvObj);
+XWF_EXPORTED(XWF_CloseEvObj);
+XWF_EXPORTED(XWF_GetEvObj);
+
+namespace
+{
+	bool parseArgs(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			if (arg == "--quiet") {
+				options.quiet = true;
+				continue;
+			}
+			if (arg.compare(0, 2, "--") != 0) {
+				options.xtension = arg;
+				continue;
+			}
+			if (i + 1 >= argc) {
+				return false;
+			}
+			string value = argv[++i];
+			if (arg == "--items") options.items = (size_t)atoll(value.c_str());
+			else if (arg == "--size") options.size = value;
+			else if (arg == "--max-size") options.maxSize = atoll(value.c_str());
+			else if (arg == "--dup") options.dup = atof(value.c_str());
+			else if (arg == "--hashed") options.hashed = atof(value.c_str());
+			else if (arg == "--hash1") options.hash1 = parseHashType(value);
+			else if (arg == "--hash2") options.hash2 = parseHashType(value);
+			else if (arg == "--threads") options.threads = (unsigned)max(1, atoi(value.c_str()));
+			else if (arg == "--runs") options.runs = (unsigned)max(1, atoi(value.c_str()));
+			else if (arg == "--folders") options.folders = (size_t)atoll(value.c_str());
+			else if (arg == "--cancel") options.cancel = atol(value.c_str());
+			else if (arg == "--seed") options.seed = (unsigned)atoi(value.c_str());
+			else return false;
+		}
+		return !options.xtension.empty() && options.hash1 >= 0 && options.hash2 >= 0;
+	}
+
+	double secondsSince(steady_clock::time_point start)
+	{
+		return duration<double>(steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (!parseArgs(argc, argv)) {
+		cerr << "usage: xwsim [--items N] [--size fixed:N|uniform:MIN:MAX|lognormal:MEDIAN:SIGMA|exp:MEAN] [--max-size N]\n"
+			"             [--dup P] [--hashed P] [--hash1 md5|sha1|sha256|none] [--hash2 ...] [--threads N] [--runs N]\n"
+			"             [--folders N] [--cancel N] [--seed N] [--quiet] xtension.so\n";
+		return 1;
+	}
+
+	// dlopen only looks in the current directory for an explicit path
+	string path = options.xtension.find('/') == string::npos ? "./" + options.xtension : options.xtension;
+	void* module = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (module == nullptr) {
+		cerr << "[!] Unable to load " << path << " : " << dlerror() << "\n";
+		return 1;
+	}
+	auto init = (decltype(&xt::XT_Init))dlsym(module, "XT_Init");
+	auto done = (decltype(&xt::XT_Done))dlsym(module, "XT_Done");
+	auto prepare = (decltype(&xt::XT_Prepare))dlsym(module, "XT_Prepare");
+	auto finalize = (decltype(&xt::XT_Finalize))dlsym(module, "XT_Finalize");
+	auto processItem = (decltype(&xt::XT_ProcessItem))dlsym(module, "XT_ProcessItem");
+	auto processItemEx = (decltype(&xt::XT_ProcessItemEx))dlsym(module, "XT_ProcessItemEx");
+	if (init == nullptr) {
+		cerr << "[!] " << path << " does not export XT_Init\n";
+		return 1;
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+	buildVolume();
+	double built = secondsSince(start);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	// X-Ways 21.0 for X-Ways Forensics
+	CallerInfo caller = { 0, 0, 2100 };
+	DWORD version;
+	memcpy(&version, &caller, sizeof(version));
+	LONG initResult = init(version, XT_INIT_XWF, nullptr, nullptr);
+	if (initResult < 0) {
+		cerr << "[!] XT_Init refused the host (" << initResult << ")\n";
+		return 1;
+	}
+	unsigned threads = initResult == XT_INIT_THREADSAFE ? options.threads : 1;
+	if (threads < options.threads) {
+		cerr << "[!] The X-Tension is not thread-safe, items processed by 1 thread\n";
+	}
+
+	cout << fixed << setprecision(3);
+	cout << "volume         : " << gItems.size() << " items, " << gFiles << " files, " << gContents.size()
+		<< " distinct contents, " << setprecision(1) << gVolumeSize / 1048576.0 << " MB, built in "
+		<< setprecision(3) << built << " s\n";
+
+	int exitCode = 0;
+	for (unsigned run = 1; run <= options.runs && !gInterrupted; run++) {
+		gProcessed = 0;
+		gHashAsked = gHashMissing = gHashComputed = gHashSet = gHashMismatch = gHashBadHandle = 0;
+		gOpened = gBytesRead = gComments = gTableEntries = gMessages = 0;
+
+		//////////////////////////////////////////
+		//										//
+		//			Run							//
+		//										//
+		//////////////////////////////////////////
+
+		steady_clock::time_point runStart = steady_clock::now();
+		LONG prepared = prepare != nullptr ? prepare(&gVolume, &gEvidence, XT_ACTION_RVS, nullptr) : XT_PREPARE_CALLPI;
+		double prepareTime = secondsSince(runStart);
+
+		steady_clock::time_point processStart = steady_clock::now();
+		atomic<size_t> next(0);
+		atomic<bool> aborted(false);
+		if (prepared >= 0 && (prepared & XT_PREPARE_CALLPI) && (processItemEx != nullptr || processItem != nullptr)) {
+			vector<thread> workers;
+			for (unsigned t = 0; t < threads; t++) {
+				workers.emplace_back([&]() {
+					for (size_t id = next++; id < gItems.size() && !aborted && !::XWF_ShouldStop(); id = next++) {
+						const SimItem& item = gItems[id];
+						if ((item.directory && !(prepared & XT_PREPARE_TARGETDIRS))
+							|| (!item.directory && item.size == 0 && !(prepared & XT_PREPARE_TARGETZEROBYTEFILES))) {
+							continue;
+						}
+
+						// X-Ways opens the item for XT_ProcessItemEx
+						LONG result;
+						if (processItemEx != nullptr) {
+							SimHandle* handle = openItem((LONG)id);
+							gProcessing[id] = handle;
+							result = processItemEx((LONG)id, handle, nullptr);
+							gProcessing[id] = nullptr;
+							::XWF_Close(handle);
+						}
+						else {
+							result = processItem((LONG)id, nullptr);
+						}
+						gProcessed++;
+						if (result == -1) {
+							aborted = true;
+						}
+					}
+				});
+			}
+			for (thread& worker : workers) {
+				worker.join();
+			}
+		}
+		double processTime = secondsSince(processStart);
+
+		steady_clock::time_point finalizeStart = steady_clock::now();
+		LONG finalized = prepared >= 0 && finalize != nullptr ? finalize(&gVolume, &gEvidence, XT_ACTION_RVS, nullptr) : 0;
+		double finalizeTime = secondsSince(finalizeStart);
+		double runTime = secondsSince(runStart);
+
+		long processed = gProcessed;
+		cout << "run " << run << "          : " << processed << " items processed by " << threads << " thread(s), "
+			<< setprecision(1) << processed / max(runTime, 1e-9) << " items/s" << setprecision(3)
+			<< (aborted ? ", aborted by the X-Tension" : "") << (::XWF_ShouldStop() ? ", cancelled" : "") << "\n";
+		cout << "  time         : XT_Prepare " << prepareTime << " s (" << prepared << "), XT_ProcessItemEx " << processTime
+			<< " s, XT_Finalize " << finalizeTime << " s (" << finalized << "), total " << runTime << " s\n";
+		cout << "  hash values  : " << gHashAsked << " asked, " << gHashMissing << " not in the snapshot, " << gHashComputed
+			<< " computed by the host (" << gHashBadHandle << " bad item handle), " << gHashSet << " set by the X-Tension (" << gHashMismatch << " wrong)\n";
+		cout << "  items read   : " << gOpened << " opened by the X-Tension, " << setprecision(1) << gBytesRead / 1048576.0 << " MB read"
+			<< setprecision(3) << "\n";
+		cout << "  results      : " << gComments << " comments, " << gTableEntries << " report table entries, "
+			<< gMessages << " messages\n";
+		if (prepared < 0 || finalized < 0 || aborted || gHashMismatch > 0 || gHashBadHandle > 0) {
+			exitCode = 2;
+		}
+	}
+
+	if (done != nullptr) {
+		done(nullptr);
+	}
+	dlclose(module);
+	return exitCode;
+}